@@ -0,0 +1,362 @@
+/* relocswap-audit.so: an rtld-audit module recording which PLT relocs of each
+ * loaded object are bound, and optionally how often they are called, during a
+ * run.  Use it as:
+ *
+ *   RELOCSWAP_CENSUS_DIR=DIR LD_AUDIT=./relocswap-audit.so PROGRAM ...
+ *
+ * Each object with PLT relocs writes DIR/NAME.PID.census at exit (DIR
+ * defaults to the current directory): a header line
+ *
+ *   relocswap-census 1 PATH NPLT CALLS
+ *
+ * followed by a bitmap of NPLT bits, bit i set if the i'th .rela.plt/.rel.plt
+ * entry was bound, and if CALLS is 1 by NPLT 32-bit call counts.  Call counts
+ * are collected with la_pltenter when RELOCSWAP_CENSUS_CALLS is set, which
+ * routes every PLT call through the loader and is much slower.
+ *
+ * Run by a campaign, the module instead reports to a result ring (ring.h)
+ * named by RELOCSWAP_RING_FD and RELOCSWAP_RING_SLOT: when the program is
+ * relocated, when it exits and where it faults.  Census files are then only
+ * written if RELOCSWAP_CENSUS_DIR is set.
+ */
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <link.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ring.h"
+
+/* A PLT reloc of an object, by the name of its symbol.  The loader passes
+ * the audit callbacks the symbol index of the defining object, so relocs are
+ * found by name. */
+struct pltReloc {
+  const char *name;
+  uint32_t idx;
+};
+
+struct object {
+  const char *name;
+  uint32_t nplt;
+  struct pltReloc *byName; /* Sorted by name. */
+  unsigned char *bound;
+  uint32_t *calls;
+  int isMain;
+  int bindNow; /* Its PLT relocs are bound at load, not on first call. */
+};
+
+static int countCalls;
+static int bindNowEnv;
+static int writeCensus = 1;
+static uint64_t boundCount;
+
+static struct relocswap_ring *ring;
+static uint64_t ringId;
+static pid_t ringPid; /* Forks of the process share the mapping. */
+/* Taken around a push: the ring has a single producer, but faults of several
+ * threads, or of a thread in the middle of a push, report too. */
+static char ringLock;
+
+static const int faultSignals[] = {SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT};
+
+static uint64_t envNumber(const char *name, int *ok) {
+  const char *value = getenv(name);
+  char *end;
+  if (!value || !*value) {
+    *ok = 0;
+    return 0;
+  }
+  const uint64_t n = strtoull(value, &end, 10);
+  if (*end) *ok = 0;
+  return n;
+}
+
+static void report(uint32_t kind, int signo, const void *addr) {
+  if (!ring || getpid() != ringPid) return;
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  struct relocswap_result result = {0};
+  result.id = ringId;
+  result.kind = kind;
+  result.signo = signo;
+  result.addr = (uintptr_t)addr;
+  result.timeNs = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+  result.bound = __atomic_load_n(&boundCount, __ATOMIC_RELAXED);
+  /* With the fault signals blocked, the holder of the lock cannot be
+   * interrupted by a report of its own, so the spin always ends. */
+  sigset_t faults, old;
+  sigemptyset(&faults);
+  for (size_t i = 0; i < sizeof(faultSignals) / sizeof(faultSignals[0]); ++i)
+    sigaddset(&faults, faultSignals[i]);
+  pthread_sigmask(SIG_BLOCK, &faults, &old);
+  while (__atomic_test_and_set(&ringLock, __ATOMIC_ACQUIRE))
+    ;
+  relocswap_ring_push(ring, &result);
+  __atomic_clear(&ringLock, __ATOMIC_RELEASE);
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Report a fatal signal, then let it kill the process with the default
+ * action (SA_RESETHAND) when the faulting instruction runs again or the
+ * signal is raised again. */
+static void onFault(int signo, siginfo_t *info, void *context) {
+  (void)context;
+  report(RELOCSWAP_RESULT_FAULT, signo, info->si_addr);
+  if (info->si_code <= 0) raise(signo);
+}
+
+static void catchFaults(void) {
+  static char altStack[64 * 1024];
+  const stack_t ss = {.ss_sp = altStack, .ss_size = sizeof(altStack)};
+  sigaltstack(&ss, NULL);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = onFault;
+  sa.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_RESETHAND;
+  sigemptyset(&sa.sa_mask);
+  for (size_t i = 0; i < sizeof(faultSignals) / sizeof(faultSignals[0]); ++i)
+    sigaction(faultSignals[i], &sa, NULL);
+}
+
+/* Map the ring of RELOCSWAP_RING_SLOT.  Only the process the campaign started
+ * reports, not its children, so the ring keeps a single producer. */
+static void openRing(void) {
+  int ok = 1;
+  const int fd = (int)envNumber(RELOCSWAP_RING_FD, &ok);
+  const uint64_t slot = envNumber(RELOCSWAP_RING_SLOT, &ok);
+  ringId = envNumber(RELOCSWAP_RING_ID, &ok);
+  const uint64_t parent = envNumber(RELOCSWAP_RING_PARENT, &ok);
+  if (!ok) return;
+  writeCensus = getenv("RELOCSWAP_CENSUS_DIR") != NULL;
+  if ((uint64_t)getppid() != parent) return;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct relocswap_ring))
+    return;
+  char *base =
+      mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (base == MAP_FAILED) return;
+  struct relocswap_ring *first = (struct relocswap_ring *)base;
+  const size_t size = relocswap_ring_size(first->capacity);
+  if (first->magic != RELOCSWAP_RING_MAGIC ||
+      (slot + 1) * size > (uint64_t)st.st_size) {
+    munmap(base, st.st_size);
+    return;
+  }
+  ring = (struct relocswap_ring *)(base + slot * size);
+  ringPid = getpid();
+  /* Before relocation, to report faults in ifunc resolvers too. */
+  catchFaults();
+}
+
+unsigned int la_version(unsigned int version) {
+  countCalls = getenv("RELOCSWAP_CENSUS_CALLS") != NULL;
+  const char *bindNow = getenv("LD_BIND_NOW");
+  bindNowEnv = bindNow && *bindNow;
+  openRing();
+  if (bindNowEnv && writeCensus)
+    fprintf(stderr, "relocswap-audit: LD_BIND_NOW is set, censuses will "
+                    "record every PLT reloc as bound\n");
+  return version < LAV_CURRENT ? version : LAV_CURRENT;
+}
+
+void la_preinit(uintptr_t *cookie) {
+  (void)cookie;
+  if (!ring) return;
+  report(RELOCSWAP_RESULT_LOADED, 0, NULL);
+}
+
+static int compareRelocs(const void *a, const void *b) {
+  return strcmp(((const struct pltReloc *)a)->name,
+                ((const struct pltReloc *)b)->name);
+}
+
+/* Dynamic entries may or may not have been adjusted by the load address. */
+static uintptr_t dynPtr(const struct link_map *map, uintptr_t ptr) {
+  return ptr < map->l_addr ? ptr + map->l_addr : ptr;
+}
+
+unsigned int la_objopen(struct link_map *map, Lmid_t lmid, uintptr_t *cookie) {
+  uintptr_t jmprel = 0, pltrelsz = 0, pltrel = DT_RELA, symtab = 0, strtab = 0;
+  int bindNow = bindNowEnv;
+  for (const ElfW(Dyn) *dyn = map->l_ld; dyn && dyn->d_tag != DT_NULL; ++dyn) {
+    if (dyn->d_tag == DT_JMPREL) jmprel = dynPtr(map, dyn->d_un.d_ptr);
+    if (dyn->d_tag == DT_PLTRELSZ) pltrelsz = dyn->d_un.d_val;
+    if (dyn->d_tag == DT_PLTREL) pltrel = dyn->d_un.d_val;
+    if (dyn->d_tag == DT_SYMTAB) symtab = dynPtr(map, dyn->d_un.d_ptr);
+    if (dyn->d_tag == DT_STRTAB) strtab = dynPtr(map, dyn->d_un.d_ptr);
+    if (dyn->d_tag == DT_BIND_NOW ||
+        (dyn->d_tag == DT_FLAGS && (dyn->d_un.d_val & DF_BIND_NOW)) ||
+        (dyn->d_tag == DT_FLAGS_1 && (dyn->d_un.d_val & DF_1_NOW)))
+      bindNow = 1;
+  }
+
+  struct object *obj = calloc(1, sizeof(*obj));
+  if (!obj) return 0;
+  obj->name = map->l_name;
+  obj->isMain = lmid == LM_ID_BASE && map->l_name && !map->l_name[0];
+  obj->bindNow = bindNow;
+  *cookie = (uintptr_t)obj;
+  if (!jmprel || !pltrelsz || !symtab || !strtab)
+    return LA_FLG_BINDFROM | LA_FLG_BINDTO;
+
+  const size_t entSize =
+      pltrel == DT_RELA ? sizeof(ElfW(Rela)) : sizeof(ElfW(Rel));
+  obj->nplt = pltrelsz / entSize;
+  obj->byName = calloc(obj->nplt, sizeof(struct pltReloc));
+  obj->bound = calloc((obj->nplt + 7) / 8, 1);
+  obj->calls = countCalls ? calloc(obj->nplt, sizeof(uint32_t)) : NULL;
+  if (!obj->byName || !obj->bound || (countCalls && !obj->calls)) {
+    obj->nplt = 0;
+    return LA_FLG_BINDFROM | LA_FLG_BINDTO;
+  }
+  for (uint32_t i = 0; i < obj->nplt; ++i) {
+    /* r_info is the second word of both Rel and Rela entries. */
+    const ElfW(Rel) *rel = (const ElfW(Rel) *)(jmprel + i * entSize);
+#if __ELF_NATIVE_CLASS == 64
+    const uint64_t sym = ELF64_R_SYM(rel->r_info);
+#else
+    const uint64_t sym = ELF32_R_SYM(rel->r_info);
+#endif
+    const ElfW(Sym) *syms = (const ElfW(Sym) *)symtab;
+    obj->byName[i].name = (const char *)strtab + syms[sym].st_name;
+    obj->byName[i].idx = i;
+  }
+  qsort(obj->byName, obj->nplt, sizeof(struct pltReloc), compareRelocs);
+  return LA_FLG_BINDFROM | LA_FLG_BINDTO;
+}
+
+/* The first of the PLT relocs of 'name', or nplt if there is none. */
+static size_t findReloc(const struct object *obj, const char *name) {
+  size_t lo = 0, hi = obj->nplt;
+  while (lo < hi) {
+    const size_t mid = (lo + hi) / 2;
+    if (strcmp(obj->byName[mid].name, name) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < obj->nplt && strcmp(obj->byName[lo].name, name) == 0 ? lo
+                                                                   : obj->nplt;
+}
+
+/* Mark the PLT relocs of 'name' as bound, false if there are none. */
+static int markBound(struct object *obj, const char *name) {
+  size_t i = findReloc(obj, name);
+  if (i == obj->nplt) return 0;
+  for (; i < obj->nplt && strcmp(obj->byName[i].name, name) == 0; ++i) {
+    const uint32_t idx = obj->byName[i].idx;
+    const unsigned char bit = 1 << (idx % 8);
+    if (!(__atomic_fetch_or(&obj->bound[idx / 8], bit, __ATOMIC_RELAXED) & bit))
+      __atomic_fetch_add(&boundCount, 1, __ATOMIC_RELAXED);
+  }
+  return 1;
+}
+
+static uintptr_t symbind(const char *name, uintptr_t *refcook,
+                         unsigned int *flags, uintptr_t value) {
+  struct object *obj = (struct object *)*refcook;
+  const int found = obj && obj->nplt && markBound(obj, name);
+  if (!found || !obj->calls)
+    *flags |= LA_SYMB_NOPLTENTER | LA_SYMB_NOPLTEXIT;
+  else
+    *flags |= LA_SYMB_NOPLTEXIT;
+  return value;
+}
+
+#if __ELF_NATIVE_CLASS == 64
+uintptr_t la_symbind64(Elf64_Sym *sym, unsigned int ndx, uintptr_t *refcook,
+                       uintptr_t *defcook, unsigned int *flags,
+                       const char *symname) {
+  (void)ndx;
+  (void)defcook;
+  return symbind(symname, refcook, flags, sym->st_value);
+}
+#else
+uintptr_t la_symbind32(Elf32_Sym *sym, unsigned int ndx, uintptr_t *refcook,
+                       uintptr_t *defcook, unsigned int *flags,
+                       const char *symname) {
+  (void)ndx;
+  (void)defcook;
+  return symbind(symname, refcook, flags, sym->st_value);
+}
+#endif
+
+static void countCall(uintptr_t *refcook, const char *name) {
+  struct object *obj = (struct object *)*refcook;
+  if (!obj || !obj->calls) return;
+  const size_t i = findReloc(obj, name);
+  if (i < obj->nplt)
+    __atomic_fetch_add(&obj->calls[obj->byName[i].idx], 1, __ATOMIC_RELAXED);
+}
+
+#if defined(__x86_64__)
+ElfW(Addr) la_x86_64_gnu_pltenter(ElfW(Sym) *sym, unsigned int ndx,
+                                  uintptr_t *refcook, uintptr_t *defcook,
+                                  La_x86_64_regs *regs, unsigned int *flags,
+                                  const char *symname, long *framesizep) {
+  (void)ndx, (void)defcook, (void)regs, (void)flags, (void)framesizep;
+  countCall(refcook, symname);
+  return sym->st_value;
+}
+#elif defined(__aarch64__)
+ElfW(Addr) la_aarch64_gnu_pltenter(ElfW(Sym) *sym, unsigned int ndx,
+                                   uintptr_t *refcook, uintptr_t *defcook,
+                                   La_aarch64_regs *regs, unsigned int *flags,
+                                   const char *symname, long *framesizep) {
+  (void)ndx, (void)defcook, (void)regs, (void)flags, (void)framesizep;
+  countCall(refcook, symname);
+  return sym->st_value;
+}
+#elif defined(__i386__)
+ElfW(Addr) la_i86_gnu_pltenter(ElfW(Sym) *sym, unsigned int ndx,
+                               uintptr_t *refcook, uintptr_t *defcook,
+                               La_i86_regs *regs, unsigned int *flags,
+                               const char *symname, long *framesizep) {
+  (void)ndx, (void)defcook, (void)regs, (void)flags, (void)framesizep;
+  countCall(refcook, symname);
+  return sym->st_value;
+}
+#endif
+
+unsigned int la_objclose(uintptr_t *cookie) {
+  struct object *obj = (struct object *)*cookie;
+  if (obj && obj->isMain) report(RELOCSWAP_RESULT_EXIT, 0, NULL);
+  if (!obj || !obj->nplt || !writeCensus) return 0;
+
+  char path[PATH_MAX] = "";
+  if (obj->name && obj->name[0]) {
+    strncpy(path, obj->name, sizeof(path) - 1);
+  } else {
+    const ssize_t n = readlink("/proc/self/exe", path, sizeof(path) - 1);
+    path[n > 0 ? n : 0] = '\0';
+  }
+  const char *base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  const char *dir = getenv("RELOCSWAP_CENSUS_DIR");
+  char fname[PATH_MAX];
+  snprintf(fname, sizeof(fname), "%s/%s.%d.census", dir ? dir : ".", base,
+           (int)getpid());
+
+  FILE *fp = fopen(fname, "w");
+  if (!fp) return 0;
+  fprintf(fp, "relocswap-census 1 %s %u %d\n", path, obj->nplt,
+          obj->calls != NULL);
+  fwrite(obj->bound, 1, (obj->nplt + 7) / 8, fp);
+  if (obj->calls) fwrite(obj->calls, sizeof(uint32_t), obj->nplt, fp);
+  fclose(fp);
+  /* LD_BIND_NOW was reported once, by la_version. */
+  if (obj->bindNow && !bindNowEnv)
+    fprintf(stderr, "relocswap-audit: %s is linked with -z now, its census "
+                    "records every PLT reloc as bound\n", path);
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include "batch.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <ext/stdio_filebuf.h>
+
+#include <cstring>
+#include <filesystem>
+#include <sstream>
+
+namespace {
+CachePolicy inputPolicy = CachePolicy::Keep;
+}
+
+void setInputCachePolicy(CachePolicy policy) { inputPolicy = policy; }
+
+InputFile::InputFile(const std::string &path)
+    : fd(open(path.c_str(), O_RDONLY | O_CLOEXEC)) {
+  if (fd < 0) return;
+  // Parsing reads scattered headers and tables: readahead only wastes cache.
+  if (inputPolicy != CachePolicy::Keep)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+  buf = std::make_unique<__gnu_cxx::stdio_filebuf<char>>(
+      fd, std::ios::in | std::ios::binary);
+  in.rdbuf(buf.get());
+}
+
+InputFile::~InputFile() {
+  if (fd >= 0 && inputPolicy != CachePolicy::Keep)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+bool isElfFile(const std::filesystem::path &path) {
+  char magic[SELFMAG];
+  std::ifstream fp(path, std::ios::binary);
+  return fp.read(magic, SELFMAG) && memcmp(magic, ELFMAG, SELFMAG) == 0;
+}
+
+std::vector<std::string> collectInputs(const std::vector<std::string> &args) {
+  namespace fs = std::filesystem;
+  std::vector<std::string> inputs;
+  for (const auto &arg : args) {
+    if (!fs::is_directory(arg)) {
+      inputs.push_back(arg);
+      continue;
+    }
+    std::vector<std::string> found;
+    for (const auto &entry : fs::recursive_directory_iterator(
+             arg, fs::directory_options::skip_permission_denied))
+      if (entry.is_regular_file() && !entry.is_symlink() &&
+          isElfFile(entry.path()))
+        found.push_back(entry.path());
+    std::sort(found.begin(), found.end());
+    inputs.insert(inputs.end(), found.begin(), found.end());
+  }
+  return inputs;
+}
+
+void FleetWeights::load(const char *fname) {
+  std::ifstream fp(fname);
+  if (!fp) errExit(std::string("Failed to open weights file ") + fname);
+  std::string line;
+  while (std::getline(fp, line)) {
+    std::istringstream fields(line);
+    double count;
+    std::string path;
+    if (fields >> count >> path) weights.emplace_back(path, count);
+  }
+}
+
+double FleetWeights::weight(const std::string &path) const {
+  const std::string name = std::filesystem::path(path).filename();
+  for (const auto &[listed, count] : weights)
+    if (listed == path) return count;
+  for (const auto &[listed, count] : weights)
+    if (std::filesystem::path(listed).filename() == name) return count;
+  return 1;
+}
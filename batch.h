@@ -0,0 +1,150 @@
+#ifndef RELOCSWAP_BATCH_H
+#define RELOCSWAP_BATCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "elffile.h"
+#include "output.h"
+#include "trace.h"
+
+// True if 'path' starts with the ELF magic.
+bool isElfFile(const std::filesystem::path &path);
+
+// Expand the FILE arguments of a batch: directories are walked recursively
+// and only regular files starting with the ELF magic are kept.
+std::vector<std::string> collectInputs(const std::vector<std::string> &args);
+
+// Process counts by library for fleet totals, read from lines of
+// "COUNT PATH".  Inputs are matched by path, then by file name.
+class FleetWeights {
+  std::vector<std::pair<std::string, double>> weights;
+
+ public:
+  void load(const char *fname);
+  double weight(const std::string &path) const;  // 1 if not listed.
+};
+
+// True on the threads of a pool of parallelFor.
+inline thread_local bool inWorkerPool = false;
+
+// Call fn(i) for each i in [0, n) on a pool of 'jobs' workers, one per core
+// if 'jobs' is 0.  Inside a pool already, as when a batch decodes its inputs,
+// fn runs on the calling thread rather than on a pool of its own.  The first
+// exception fn throws stops the pool and is rethrown once it is joined; the
+// workers inherit the RecoverErrors of the caller.
+template <class Fn>
+void parallelFor(size_t n, Fn fn, unsigned jobs = 0) {
+  std::atomic<size_t> next{0};
+  if (!jobs) jobs = std::max(1U, std::thread::hardware_concurrency());
+  const size_t nThreads = inWorkerPool ? 1 : std::min<size_t>(n, jobs);
+  const bool recover = RecoverErrors::active();
+  std::exception_ptr error;
+  std::mutex errorLock;
+  auto work = [&] {
+    const bool outer = inWorkerPool;
+    inWorkerPool = outer || nThreads > 1;
+    RecoverErrors scope(recover);
+    try {
+      for (size_t i; (i = next++) < n;) fn(i);
+    } catch (...) {
+      std::lock_guard<std::mutex> guard(errorLock);
+      if (!error) error = std::current_exception();
+      next = n;
+    }
+    inWorkerPool = outer;
+  };
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < nThreads; ++i) workers.emplace_back(work);
+  work();
+  for (auto &w : workers) w.join();
+  if (error) std::rethrow_exception(error);
+}
+
+// Call fn(begin, end) for chunks of at most 'chunkSize' of [0, n) on a pool
+// of workers, on the calling thread if there is a single chunk.
+template <class Fn>
+void forChunks(size_t n, size_t chunkSize, Fn fn) {
+  parallelFor((n + chunkSize - 1) / chunkSize, [&](size_t c) {
+    fn(c * chunkSize, std::min(n, (c + 1) * chunkSize));
+  });
+}
+
+// The page cache policy of batch inputs, CachePolicy::Keep by default.  Other
+// policies read inputs without readahead and drop them once processed, so a
+// scan of a whole library directory does not evict the working set.
+void setInputCachePolicy(CachePolicy policy);
+
+// A batch input, read through a descriptor of its own: the hints of the
+// policy apply to an open file, so they go to the one the parse reads.
+class InputFile {
+  int fd = -1;
+  std::unique_ptr<std::streambuf> buf;  // Owns fd once made.
+  std::istream in{nullptr};
+
+ public:
+  explicit InputFile(const std::string &path);
+  ~InputFile();  // Drops the file from the page cache, unless kept.
+  InputFile(const InputFile &) = delete;
+  InputFile &operator=(const InputFile &) = delete;
+
+  bool isOpen() const { return fd >= 0; }
+  std::istream &stream() { return in; }
+};
+
+// The results of a batch, by input.  An input that could not be read or
+// parsed has its error instead.
+template <class T>
+struct InputResults {
+  std::vector<T> values;
+  std::vector<std::string> errors;  // "" if the input was processed.
+  size_t failed = 0;
+
+  bool ok(size_t i) const { return errors[i].empty(); }
+};
+
+// Parse every input on a pool of workers and return fn(path, elf) for each,
+// in the order of 'inputs'.  Inputs failing to parse, or failing in fn, are
+// reported and skipped.
+template <class T, class Fn>
+InputResults<T> mapInputs(const std::vector<std::string> &inputs, Fn fn) {
+  InputResults<T> results;
+  results.values.resize(inputs.size());
+  results.errors.resize(inputs.size());
+  parallelFor(inputs.size(), [&](size_t i) {
+    TraceSpan span("input", inputs[i]);
+    RecoverErrors recover;
+    try {
+      std::unique_ptr<InputFile> file;
+      {
+        TraceSpan open("open");
+        file = std::make_unique<InputFile>(inputs[i]);
+      }
+      if (!file->isOpen()) errExit("Failed to open input file.");
+      std::unique_ptr<Elf> elf(parseElf(file->stream()));
+      TraceSpan analyze("analyze");
+      results.values[i] = fn(inputs[i], *elf);
+    } catch (const InputError &e) {
+      results.errors[i] = e.what();
+    }
+  });
+  for (size_t i = 0; i < inputs.size(); ++i)
+    if (!results.ok(i)) {
+      std::cerr << "Skipped " << inputs[i] << ": " << results.errors[i]
+                << std::endl;
+      ++results.failed;
+    }
+  return results;
+}
+
+#endif  // RELOCSWAP_BATCH_H
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Time the reloc listings of relocswap --format=readelf, readelf -r and, when
+# installed, llvm-readobj -r and llvm-readelf -r, and check that relocswap
+# prints the same bytes as readelf.
+#
+# Usage: bench/readelf.sh [FILE...]   (default: the largest system libraries)
+# RELOCSWAP names the binary to time (default: ./relocswap, see make release).
+# RUNS is the number of timed runs of each tool (default: 5).
+
+RELOCSWAP=${RELOCSWAP:-./relocswap}
+RUNS=${RUNS:-5}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+if [ $# -eq 0 ]; then
+  set -- $(find /usr/lib /usr/lib64 /usr/bin -type f -name '*.so*' \
+             -size +1M 2>/dev/null | xargs ls -S 2>/dev/null | head -5)
+fi
+command -v readelf >/dev/null || { echo "readelf is not installed." >&2; exit 1; }
+
+# Best wall time of RUNS runs of a command, in ms.
+best() {
+  best=
+  i=0
+  while [ $i -lt "$RUNS" ]; do
+    start=$(date +%s%N)
+    "$@" > /dev/null 2>&1
+    end=$(date +%s%N)
+    t=$(( (end - start) / 1000000 ))
+    if [ -z "$best" ] || [ $t -lt "$best" ]; then best=$t; fi
+    i=$((i + 1))
+  done
+  echo "$best"
+}
+
+status=0
+printf '%-40s %8s %9s %9s %13s %13s\n' FILE RELOCS 'relocswap' readelf \
+  llvm-readobj llvm-readelf
+for f in "$@"; do
+  "$RELOCSWAP" --format=readelf "$f" > "$tmp/relocswap" 2>/dev/null
+  readelf -r "$f" > "$tmp/readelf" 2>/dev/null
+  if ! cmp -s "$tmp/relocswap" "$tmp/readelf"; then
+    echo "$f: the output differs from readelf -r" >&2
+    status=1
+  fi
+  relocs=$(grep -c '^[0-9a-f]\{8\}' "$tmp/readelf")
+  ours=$(best "$RELOCSWAP" --format=readelf "$f")
+  theirs=$(best readelf -r "$f")
+  readobj=-
+  command -v llvm-readobj >/dev/null && readobj=$(best llvm-readobj -r "$f")
+  llvmreadelf=-
+  command -v llvm-readelf >/dev/null && llvmreadelf=$(best llvm-readelf -r "$f")
+  printf '%-40s %8s %7s ms %6s ms %10s ms %10s ms\n' "$(basename "$f")" \
+    "$relocs" "$ours" "$theirs" "$readobj" "$llvmreadelf"
+done
+exit $status
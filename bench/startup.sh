@@ -0,0 +1,39 @@
+#!/bin/sh
+# Time relocswap from exec to exit for one swap of a small fixture, the way
+# harnesses that run it once per variant do, against the cost of running
+# /bin/true from the same loop.
+#
+# Usage: bench/startup.sh [RELOCSWAP...]   (default: ./relocswap; build one
+#        with make release or make static)
+# FIXTURE is the file swapped (default: /bin/true).
+# RUNS is the number of runs averaged (default: 200).
+
+FIXTURE=${FIXTURE:-/bin/true}
+RUNS=${RUNS:-200}
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+[ $# -eq 0 ] && set -- ./relocswap
+
+# Mean wall time of RUNS runs of a command, in us.
+mean() {
+  i=0
+  start=$(date +%s%N)
+  while [ $i -lt "$RUNS" ]; do
+    "$@" > /dev/null 2>&1
+    i=$((i + 1))
+  done
+  end=$(date +%s%N)
+  echo $(( (end - start) / RUNS / 1000 ))
+}
+
+printf '%-40s %10s %10s\n' BINARY '-n 1' '--quiet'
+printf '%-40s %7s us\n' /bin/true "$(mean /bin/true)"
+for bin in "$@"; do
+  if ! "$bin" -n 1 -o "$tmp/out" "$FIXTURE" > /dev/null; then
+    echo "$bin failed on $FIXTURE" >&2
+    exit 1
+  fi
+  logged=$(mean "$bin" -n 1 -o "$tmp/out" "$FIXTURE")
+  quiet=$(mean "$bin" -n 1 -o "$tmp/out" --quiet "$FIXTURE")
+  printf '%-40s %7s us %7s us\n' "$bin" "$logged" "$quiet"
+done
@@ -0,0 +1,191 @@
+#include "budget.h"
+
+#include <elf.h>
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "batch.h"
+#include "footprint.h"
+
+namespace {
+constexpr const char *metricNames[] = {"relocs", "lookups", "pages", "bytes"};
+constexpr uint64_t BudgetMetrics::*metricFields[] = {
+    &BudgetMetrics::relocs, &BudgetMetrics::lookups, &BudgetMetrics::pages,
+    &BudgetMetrics::bytes};
+
+// The key of a binary without a SONAME.
+std::string pathKey(const std::string &root, const std::string &path) {
+  if (std::filesystem::is_directory(root))
+    return std::filesystem::relative(path, root);
+  return std::filesystem::path(path).filename();
+}
+
+BudgetMetrics measure(const std::string &root, const std::string &path,
+                      const Elf &elf) {
+  BudgetMetrics metrics;
+  const DynEntry *soname = elf.findDyn(DT_SONAME);
+  metrics.key = soname ? elf.dynString(soname->val) : pathKey(root, path);
+
+  for (const auto &rel : elf.relocations()) {
+    ++metrics.byType[rel.type];
+    ++metrics.relocs;
+    metrics.lookups += rel.sym != 0;
+  }
+  for (const auto &sec : elf.sections()) {
+    if (sec.type == SHT_REL || sec.type == SHT_RELA || sec.type == SHT_RELR)
+      metrics.bytes += sec.size;
+    if (sec.type != SHT_RELR) continue;
+    // Packed relocs count as RELATIVE ones.
+    std::ifstream in(path, std::ios::binary);
+    const uint64_t packed =
+        decodeRelr(readBytes(in, sec.offset, sec.size), elf.is64() ? 8 : 4)
+            .size();
+    metrics.byType[relativeType(elf.machine())] += packed;
+    metrics.relocs += packed;
+  }
+  metrics.pages = computeFootprint(path, elf).pages;
+  return metrics;
+}
+
+// Adds the inputs that could not be measured to 'skipped'.
+std::map<std::string, BudgetMetrics> measureAll(
+    const std::string &root, const std::vector<std::string> &inputs,
+    size_t &skipped) {
+  std::map<std::string, BudgetMetrics> byKey;
+  auto results = mapInputs<BudgetMetrics>(
+      inputs, [&](const std::string &path, const Elf &elf) {
+        return measure(root, path, elf);
+      });
+  // Binaries sharing a SONAME, as compat copies do, are keyed by their paths.
+  std::map<std::string, size_t> uses;
+  for (size_t i = 0; i < inputs.size(); ++i)
+    if (results.ok(i)) ++uses[results.values[i].key];
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!results.ok(i)) continue;
+    BudgetMetrics &metrics = results.values[i];
+    if (uses[metrics.key] > 1) {
+      const std::string key = pathKey(root, inputs[i]);
+      std::cerr << "Warning: " << inputs[i] << " shares the SONAME "
+                << metrics.key << ", compared as " << key << std::endl;
+      metrics.key = key;
+    }
+    const std::string key = metrics.key;
+    if (!byKey.emplace(key, std::move(metrics)).second) {
+      std::cerr << "Skipped " << inputs[i] << ": another binary has the key "
+                << key << std::endl;
+      ++skipped;
+    }
+  }
+  skipped += results.failed;
+  return byKey;
+}
+
+std::string formatChange(uint64_t before, uint64_t after) {
+  char buf[96];
+  if (before)
+    snprintf(buf, sizeof(buf), "%lu -> %lu (%+.1f%%)", (unsigned long)before,
+             (unsigned long)after, 100.0 * ((double)after - before) / before);
+  else
+    snprintf(buf, sizeof(buf), "%lu -> %lu", (unsigned long)before,
+             (unsigned long)after);
+  return buf;
+}
+}  // namespace
+
+Budget::Budget() {
+  for (const char *name : metricNames) limits[name] = {5, 0};
+}
+
+void Budget::setLimit(const std::string &spec) {
+  const auto eq = spec.find('=');
+  const std::string name = spec.substr(0, eq);
+  if (eq == std::string::npos || !limits.count(name))
+    errExit("Invalid budget threshold " + spec);
+  const std::string value = spec.substr(eq + 1);
+  BudgetLimit limit;
+  if (!value.empty() && value.back() == '%')
+    limit.percent = std::atof(value.c_str());
+  else
+    limit.absolute = std::strtoull(value.c_str(), nullptr, 10);
+  limits[name] = limit;
+}
+
+bool Budget::compare(const std::string &oldRoot,
+                     const std::vector<std::string> &oldInputs,
+                     const std::string &newRoot,
+                     const std::vector<std::string> &newInputs) const {
+  size_t skipped = 0;
+  const auto before = measureAll(oldRoot, oldInputs, skipped);
+  const auto after = measureAll(newRoot, newInputs, skipped);
+
+  // Returns true if the growth from 'a' to 'b' is within budget.
+  auto check = [&](const BudgetMetrics &a, const BudgetMetrics &b,
+                   bool &changed) {
+    bool within = true;
+    std::string report;
+    for (size_t i = 0; i < std::size(metricNames); ++i) {
+      const uint64_t va = a.*metricFields[i], vb = b.*metricFields[i];
+      if (va == vb) continue;
+      const BudgetLimit &limit = limits.at(metricNames[i]);
+      const bool over =
+          vb > va + limit.absolute + (uint64_t)(va * limit.percent / 100);
+      within &= !over;
+      report += std::string("  ") + metricNames[i] + ' ' +
+                formatChange(va, vb) + (over ? "  OVER BUDGET" : "") + '\n';
+    }
+    changed = !report.empty();
+    if (changed) {
+      std::cout << b.key << std::endl << report;
+      for (const auto &[type, count] : b.byType) {
+        const auto it = a.byType.find(type);
+        const uint64_t old = it == a.byType.end() ? 0 : it->second;
+        if (old != count)
+          std::cout << "    type " << type << ": " << formatChange(old, count)
+                    << std::endl;
+      }
+      for (const auto &[type, count] : a.byType)
+        if (!b.byType.count(type))
+          std::cout << "    type " << type << ": " << formatChange(count, 0)
+                    << std::endl;
+    }
+    return within;
+  };
+
+  bool within = true;
+  size_t compared = 0, changed = 0, over = 0;
+  BudgetMetrics totalBefore, totalAfter;
+  totalBefore.key = totalAfter.key = "Total";
+  for (const auto &[key, b] : after) {
+    const auto it = before.find(key);
+    if (it == before.end()) {
+      std::cout << key << ": added" << std::endl;
+      continue;
+    }
+    const BudgetMetrics &a = it->second;
+    for (size_t i = 0; i < std::size(metricFields); ++i) {
+      totalBefore.*metricFields[i] += a.*metricFields[i];
+      totalAfter.*metricFields[i] += b.*metricFields[i];
+    }
+    bool differs;
+    ++compared;
+    if (!check(a, b, differs)) {
+      within = false;
+      ++over;
+    }
+    changed += differs;
+  }
+  for (const auto &[key, a] : before)
+    if (!after.count(key)) std::cout << key << ": removed" << std::endl;
+
+  bool totalDiffers;
+  if (!check(totalBefore, totalAfter, totalDiffers)) within = false;
+  std::cout << compared << " binaries compared, " << changed << " changed, "
+            << over << " over budget";
+  // A binary that could not be measured may have grown unchecked.
+  if (skipped) std::cout << ", " << skipped << " skipped";
+  std::cout << std::endl;
+  return within && !skipped;
+}
@@ -0,0 +1,46 @@
+#ifndef RELOCSWAP_BUDGET_H
+#define RELOCSWAP_BUDGET_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "elffile.h"
+
+// The reloc costs of one binary that are tracked between builds.
+struct BudgetMetrics {
+  // DT_SONAME, or the path below the compared directory if there is none or
+  // several binaries share it.
+  std::string key;
+  std::map<uint32_t, uint64_t> byType;
+  uint64_t relocs = 0;
+  uint64_t lookups = 0;  // Relocs needing a symbol lookup.
+  uint64_t pages = 0;    // File backed pages dirtied by relocs.
+  uint64_t bytes = 0;    // Size of the reloc sections.
+};
+
+// How much a metric may grow: 'percent' of the old value plus 'absolute'.
+struct BudgetLimit {
+  double percent = 0;
+  uint64_t absolute = 0;
+};
+
+class Budget {
+  std::map<std::string, BudgetLimit> limits;
+
+ public:
+  Budget();
+  // Parse "NAME=LIMIT", NAME one of relocs, lookups, pages or bytes, and
+  // LIMIT a count or a percentage such as "5%".
+  void setLimit(const std::string &spec);
+  // Compare the binaries of 'oldInputs' and 'newInputs', with 'oldRoot' and
+  // 'newRoot' the directories (or files) they were collected from.  Returns
+  // false if any budget is exceeded, or if a binary could not be measured.
+  bool compare(const std::string &oldRoot,
+               const std::vector<std::string> &oldInputs,
+               const std::string &newRoot,
+               const std::vector<std::string> &newInputs) const;
+};
+
+#endif  // RELOCSWAP_BUDGET_H
@@ -0,0 +1,746 @@
+#include "campaign.h"
+
+#include <elf.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#include "batch.h"
+#include "pack.h"
+#include "ring.h"
+#include "spawn.h"
+#include "store.h"
+#include "trace.h"
+
+namespace {
+namespace fs = std::filesystem;
+// The PT_INTERP of an executable, "" if it has none.
+std::string interpreter(const std::string &path) {
+  if (!isElfFile(path)) return "";
+  std::ifstream fp(path, std::ios::binary);
+  std::unique_ptr<Elf> elf(parseElf(fp));
+  for (const auto &seg : elf->segments())
+    if (seg.type == PT_INTERP)
+      return readBytes(fp, seg.offset, seg.fileSize).c_str();
+  return "";
+}
+
+// FNV-1a of the reloc tables of a variant, the only bytes applySwaps changes:
+// those of the input, 'tables', with the variant's 'patches'.
+uint64_t variantHash(const std::vector<MemorySink> &tables,
+                     const std::vector<Patch> &patches) {
+  uint64_t hash = 14695981039346656037ULL;
+  for (MemorySink table : tables) {
+    table.write(patches);
+    for (unsigned char c : table.image) hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+std::string hexHash(uint64_t hash) {
+  std::ostringstream out;
+  out << std::hex << std::setw(16) << std::setfill('0') << hash;
+  return out.str();
+}
+
+size_t countOf(const std::string &text, const char *needle) {
+  size_t n = 0;
+  for (auto pos = text.find(needle); pos != std::string::npos;
+       pos = text.find(needle, pos + 1))
+    ++n;
+  return n;
+}
+
+// The distribution of each metric over runs of the unmodified binary.
+class Baseline {
+  std::vector<int64_t> samples[metricCount];
+
+ public:
+  size_t runs = 0;
+
+  void add(const Process &proc) {
+    ++runs;
+    for (int m = 0; m < metricCount; ++m)
+      if (proc.usage[m] >= 0) samples[m].push_back(proc.usage[m]);
+  }
+  void finish() {
+    for (auto &values : samples) std::sort(values.begin(), values.end());
+  }
+  // -1 if the metric was not measured.
+  int64_t median(int m) const {
+    return samples[m].empty() ? -1 : samples[m][samples[m].size() / 2];
+  }
+  // value / median if 'value' is both 'minRatio' above the median and an
+  // outlier of the baseline runs (robust z-score above 3.5), else 0.
+  double excess(int m, int64_t value, double minRatio) const {
+    const auto &values = samples[m];
+    if (values.size() < 3 || value < 0) return 0;
+    const double mid = median(m);
+    std::vector<double> deviations;
+    for (int64_t v : values) deviations.push_back(std::abs(v - mid));
+    std::nth_element(deviations.begin(),
+                     deviations.begin() + deviations.size() / 2,
+                     deviations.end());
+    // Counters like instructions barely vary: allow them 0.5%.
+    const double scale = std::max(
+        {1.4826 * deviations[deviations.size() / 2], mid * 0.005, 1.0});
+    const double ratio = mid > 0 ? value / mid : 0;
+    return (value - mid) / scale > 3.5 && ratio > 1 + minRatio ? ratio : 0;
+  }
+};
+
+// Result rings in an inherited memfd, one per job so each has a single
+// producer: the variant that job is running.  They are drained once per batch
+// and hold all of a batch's results.
+class ResultRings {
+  int fd = -1;
+  char *base = nullptr;
+  size_t ringSize = 0, size = 0;
+  std::mutex mutex;
+  std::vector<unsigned> free;
+
+ public:
+  ResultRings(unsigned count, uint32_t capacity) {
+    ringSize = relocswap_ring_size(capacity);
+    size = count * ringSize;
+    fd = memfd_create("relocswap-results", 0);
+    if (fd < 0 || ftruncate(fd, size) != 0) return;
+    void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return;
+    base = (char *)p;
+    for (unsigned i = 0; i < count; ++i) {
+      ring(i)->magic = RELOCSWAP_RING_MAGIC;
+      ring(i)->capacity = capacity;
+      free.push_back(count - 1 - i);
+    }
+  }
+  ~ResultRings() {
+    if (base) munmap(base, size);
+    if (fd >= 0) close(fd);
+  }
+  bool ok() const { return base; }
+  int memfd() const { return fd; }
+  unsigned count() const { return size / ringSize; }
+  relocswap_ring *ring(unsigned slot) const {
+    return (relocswap_ring *)(base + slot * ringSize);
+  }
+  unsigned acquire() {
+    std::lock_guard<std::mutex> lock(mutex);
+    const unsigned slot = free.back();
+    free.pop_back();
+    return slot;
+  }
+  void release(unsigned slot) {
+    std::lock_guard<std::mutex> lock(mutex);
+    free.push_back(slot);
+  }
+  uint64_t dropped() const {
+    uint64_t n = 0;
+    for (unsigned i = 0; i < count(); ++i)
+      n += __atomic_load_n(&ring(i)->dropped, __ATOMIC_RELAXED);
+    return n;
+  }
+};
+
+struct Variant {
+  std::string dir, path, swaps;
+  SwapPlan plan;
+  uint64_t id = 0;  // In the result rings and the pack.
+  uint64_t hash = 0;
+  ssize_t duplicateOf = -1;  // An earlier variant of the batch.
+  bool cached = false;       // Outcome from a previous batch.
+  bool rejected = false;
+  Outcome outcome = Outcome::Ok;
+  int detail = 0;  // Exit status, signal, or percent of the baseline usage.
+  OutputDigest out, err;
+  // Reported through the result rings.
+  int64_t startNs = 0;  // Of the run, CLOCK_MONOTONIC.
+  int64_t loadNs = -1;  // From exec to relocated, if the variant got there.
+  bool reported = false;
+  int faultSignal = 0;
+  uint64_t faultAddr = 0;
+};
+
+// Variants that wrote the same thing, other than what the unmodified binary
+// wrote.
+struct OutputBucket {
+  uint64_t variants = 0;
+  // The first variant, as a sample.
+  uint64_t hash;
+  Outcome outcome;
+  OutputDigest out, err;
+};
+
+uint64_t outputKey(const OutputDigest &out, const OutputDigest &err) {
+  return out.hash ^ (err.hash * 0x9e3779b97f4a7c15ULL);
+}
+
+// The first line of 'text', shortened for a report.
+std::string firstLine(const std::string &text) {
+  std::string line = text.substr(0, text.find('\n'));
+  if (line.size() > 60) line = line.substr(0, 57) + "...";
+  return line;
+}
+
+// Runs the variants of one binary.
+class Campaign {
+  const Elf &elf;
+  const CampaignOptions &opts;
+  const std::string inputPath;
+  std::string name;  // Of the variant files.
+  bool isLibrary = false;
+  std::vector<std::string> command;
+  std::string interp;  // Of the program, for the prefilter.
+  std::vector<MemorySink> tables;  // The reloc tables of the input.
+  fs::path workDir;
+
+  int baseStatus = 0;
+  Baseline baseline;
+  uint64_t baseOutput = 0;    // outputKey() of the unmodified binary.
+  bool outputStable = true;  // The same in all baseline runs.
+  std::unordered_map<uint64_t, OutputBucket> buckets;
+  size_t baseUndefined = 0;  // Undefined symbol warnings of the prefilter.
+  std::unordered_map<uint64_t, std::pair<Outcome, int>> verdicts;
+  std::unique_ptr<ResultRings> rings;  // With CampaignOptions::audit.
+  std::unique_ptr<PackWriter> pack;    // With CampaignOptions::pack.
+  uint64_t packBase = 0;  // Pack id of variant 0, after earlier campaigns.
+  WriteTimings writeTimings;
+  std::unique_ptr<VariantStore> store;  // With CampaignOptions::store.
+  std::string baseId;                   // Of the input, in the store.
+  std::vector<int64_t> baseLoadNs;
+
+  // Totals.
+  uint64_t outcomes[outcomeCount] = {};
+  uint64_t duplicates = 0, checked = 0, rejected = 0, runs = 0;
+  double checkSeconds = 0, runSeconds = 0;
+  uint64_t reported = 0, loadCrashes = 0, drainNs = 0;
+  std::vector<int64_t> loadNs;
+  std::unordered_map<uint64_t, uint64_t> faultAddrs;
+
+  std::vector<std::string> argvFor(const std::string &path) const {
+    std::vector<std::string> argv = command;
+    for (auto &arg : argv)
+      for (size_t pos = 0; (pos = arg.find("{}", pos)) != std::string::npos;
+           pos += path.size())
+        arg.replace(pos, 2, path);
+    return argv;
+  }
+
+  std::vector<std::string> envFor(const std::string &dir) const {
+    if (!isLibrary) return {};
+    const char *old = getenv("LD_LIBRARY_PATH");
+    return {"LD_LIBRARY_PATH=" + dir + (old && *old ? ":" + std::string(old)
+                                                    : "")};
+  }
+
+  // Like ldd -r: ld.so with LD_TRACE_LOADED_OBJECTS, LD_BIND_NOW and
+  // LD_WARN loads and relocates the program and its libraries, then exits
+  // without running their code.  Objects the command dlopens are not
+  // checked.
+  bool loads(const Variant &v, Process &proc) const {
+    auto env = envFor(v.dir);
+    env.push_back("LD_TRACE_LOADED_OBJECTS=1");
+    env.push_back("LD_BIND_NOW=1");
+    env.push_back("LD_WARN=yes");
+    SpawnOptions spawn;
+    spawn.timeout = opts.timeout;
+    spawn.capture = true;
+    return runProcess({interp, findProgram(argvFor(v.path)[0])}, env, spawn,
+                      proc);
+  }
+
+  bool run(const Variant &v, Process &proc) const {
+    SpawnOptions spawn;
+    spawn.timeout = opts.timeout;
+    spawn.measure = true;
+    spawn.digest = true;
+    auto env = envFor(v.dir);
+    if (!rings) return runProcess(argvFor(v.path), env, spawn, proc);
+    const unsigned slot = rings->acquire();
+    const char *audit = getenv("LD_AUDIT");
+    env.push_back("LD_AUDIT=" + opts.audit +
+                  (audit && *audit ? ":" + std::string(audit) : ""));
+    env.push_back(RELOCSWAP_RING_FD "=" + std::to_string(rings->memfd()));
+    env.push_back(RELOCSWAP_RING_SLOT "=" + std::to_string(slot));
+    env.push_back(RELOCSWAP_RING_ID "=" + std::to_string(v.id));
+    env.push_back(RELOCSWAP_RING_PARENT "=" + std::to_string(getpid()));
+    const bool started = runProcess(argvFor(v.path), env, spawn, proc);
+    rings->release(slot);
+    return started;
+  }
+
+  // Collect the results of the variants with ids from 'first', which all
+  // ran since the last drain.
+  void drainRings(std::vector<Variant> &variants, uint64_t first);
+
+  // Page faults stand for the memory used when there is no cgroup.
+  int memoryMetric() const {
+    return baseline.median(mPeakMemory) >= 0 ? mPeakMemory : mPageFaults;
+  }
+
+  void classify(const Process &proc, Variant &v) const {
+    if (proc.timedOut) {
+      v.outcome = Outcome::Timeout;
+    } else if (WIFSIGNALED(proc.status)) {
+      v.outcome = Outcome::Crash;
+      v.detail = WTERMSIG(proc.status);
+    } else if (proc.status != baseStatus) {
+      v.outcome = Outcome::Exit;
+      v.detail = WEXITSTATUS(proc.status);
+    } else if (outputStable && outputKey(proc.out, proc.err) != baseOutput) {
+      v.outcome = Outcome::Output;
+    } else if (double ratio = std::max(
+                   baseline.excess(mInstructions, proc.usage[mInstructions],
+                                   0.05),
+                   baseline.excess(mTaskClock, proc.usage[mTaskClock], 0.25))) {
+      v.outcome = Outcome::Slow;
+      v.detail = ratio * 100;
+    } else if (double ratio = baseline.excess(memoryMetric(),
+                                              proc.usage[memoryMetric()],
+                                              0.25)) {
+      v.outcome = Outcome::MemHog;
+      v.detail = ratio * 100;
+    }
+  }
+
+  // A copy of the input, with 'swaps' relocs swapped if not 0, and its hash.
+  void materialize(Variant &v, size_t id, int swaps) {
+    TraceSpan span("materialize", std::to_string(id));
+    v.dir = workDir / std::to_string(id);
+    v.path = v.dir + "/" + name;
+    v.id = id;
+    fs::create_directories(v.dir);
+    PatchRecorder patches;
+    if (swaps) {
+      // Keep the swaps for the variants worth keeping.
+      v.plan = elf.planSwaps(swaps, &v.swaps);
+      elf.applySwaps(patches, v.plan);
+    }
+    {
+      TraceSpan hash("hash");
+      v.hash = variantHash(tables, patches.patches);
+    }
+    writeVariant(inputPath, v.path, std::move(patches.patches),
+                 opts.cachePolicy, writeTimings);
+  }
+
+  void keep(const Variant &v) const {
+    std::string from = v.path;
+    if (store) {
+      const std::string object = store->put(baseId, hashPlan(v.plan), v.path);
+      store->addResult(object, outcomeName(v.outcome), v.detail);
+      from = store->objectPath(object);
+    }
+    if (opts.keepDir.empty()) return;
+    const fs::path dir = fs::path(opts.keepDir) / hexHash(v.hash);
+    if (fs::exists(dir)) return;
+    fs::create_directories(dir);
+    std::error_code ec;
+    fs::create_hard_link(from, dir / name, ec);
+    if (ec) fs::copy_file(from, dir / name);
+    std::ofstream swaps(dir / "swaps.txt");
+    swaps << outcomeName(v.outcome) << " " << v.detail;
+    if (v.faultSignal)
+      swaps << " fault 0x" << std::hex << v.faultAddr << std::dec;
+    swaps << "\n" << v.swaps;
+  }
+
+  // Keep the output of the first variant of each bucket.
+  void addToBucket(const Variant &v) {
+    OutputBucket &bucket = buckets[outputKey(v.out, v.err)];
+    if (bucket.variants++) return;
+    bucket.hash = v.hash;
+    bucket.outcome = v.outcome;
+    bucket.out = v.out;
+    bucket.err = v.err;
+    if (opts.keepDir.empty()) return;
+    const fs::path dir = fs::path(opts.keepDir) / "outputs" /
+                         hexHash(outputKey(v.out, v.err));
+    fs::create_directories(dir);
+    std::ofstream(dir / "stdout") << v.out.head;
+    std::ofstream(dir / "stderr") << v.err.head;
+    std::ofstream(dir / "variant") << hexHash(v.hash) << "\n";
+  }
+
+  void runBatch(size_t first, size_t n);
+
+ public:
+  Campaign(const Elf &elf, const char *fname, const CampaignOptions &opts);
+  ~Campaign() {
+    if (!workDir.empty()) fs::remove_all(workDir);
+  }
+  bool run();
+  void print() const;
+};
+
+Campaign::Campaign(const Elf &elf, const char *fname,
+                   const CampaignOptions &opts)
+    : elf(elf), opts(opts), inputPath(fname) {
+  name = fs::path(fname).filename();
+  const bool hasInterp =
+      std::any_of(elf.segments().begin(), elf.segments().end(),
+                  [](const Segment &s) { return s.type == PT_INTERP; });
+  // Some libraries, like libc.so.6, can also be run: a soname decides.
+  const DynEntry *soname = elf.findDyn(DT_SONAME);
+  isLibrary = (soname && *elf.dynString(soname->val)) ||
+              (elf.type() == ET_DYN && !hasInterp);
+  if (isLibrary) {
+    if (opts.command.empty())
+      errExit("Running variants of a shared object needs a command "
+              "(-- CMD [ARG...]).");
+    // The command finds it by soname.
+    if (soname && *elf.dynString(soname->val))
+      name = elf.dynString(soname->val);
+  }
+  command = opts.command.empty() ? std::vector<std::string>{"{}"}
+                                 : opts.command;
+
+  std::vector<uint32_t> sections;
+  for (const auto &rel : elf.relocations()) sections.push_back(rel.section);
+  std::sort(sections.begin(), sections.end());
+  sections.erase(std::unique(sections.begin(), sections.end()),
+                 sections.end());
+  std::ifstream fp(inputPath, std::ios::binary);
+  for (uint32_t idx : sections) {
+    const Section &sec = elf.sections()[idx];
+    tables.emplace_back(sec.offset, readBytes(fp, sec.offset, sec.size));
+  }
+
+  char tmpl[] = "relocswap-XXXXXX";
+  const std::string dir = fs::temp_directory_path() / tmpl;
+  std::vector<char> path(dir.begin(), dir.end());
+  path.push_back('\0');
+  if (!mkdtemp(path.data())) errExit("Failed to create a work directory.");
+  workDir = path.data();
+  if (!opts.pack.empty()) {
+    pack.reset(new PackWriter(opts.pack, packHeader(inputPath, elf)));
+    packBase = std::max<uint64_t>(pack->firstFreeId(), 1) - 1;
+  }
+  if (!opts.store.empty()) {
+    char stamp[32];
+    const time_t now = time(nullptr);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&now));
+    store.reset(new VariantStore(opts.store, name + "-" + stamp + "-" +
+                                                 std::to_string(getpid())));
+    baseId = storeBaseId(inputPath, elf);
+  }
+}
+
+void Campaign::drainRings(std::vector<Variant> &variants, uint64_t first) {
+  TraceSpan span("drain rings");
+  const auto start = std::chrono::steady_clock::now();
+  relocswap_result results[256];
+  for (unsigned slot = 0; slot < rings->count(); ++slot) {
+    while (size_t n = relocswap_ring_drain(rings->ring(slot), results, 256)) {
+      for (size_t i = 0; i < n; ++i) {
+        const relocswap_result &r = results[i];
+        if (r.id < first || r.id - first >= variants.size()) continue;
+        Variant &v = variants[r.id - first];
+        v.reported = true;
+        if (r.kind == RELOCSWAP_RESULT_LOADED) {
+          v.loadNs = r.timeNs - v.startNs;
+        } else if (r.kind == RELOCSWAP_RESULT_FAULT) {
+          v.faultSignal = r.signo;
+          v.faultAddr = r.addr;
+        }
+      }
+    }
+  }
+  drainNs += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                 std::chrono::steady_clock::now() - start)
+                 .count();
+}
+
+void Campaign::runBatch(size_t first, size_t n) {
+  TraceSpan span("batch", std::to_string(first));
+  // planSwaps draws from rand(): generate the variants serially.
+  std::vector<Variant> batch(n);
+  std::unordered_map<uint64_t, size_t> inBatch;
+  for (size_t i = 0; i < n; ++i) {
+    Variant &v = batch[i];
+    materialize(v, first + i, opts.swaps);
+    const auto it = verdicts.find(v.hash);
+    if (it != verdicts.end()) {
+      v.cached = true;
+      std::tie(v.outcome, v.detail) = it->second;
+    } else if (!inBatch.emplace(v.hash, i).second) {
+      v.duplicateOf = inBatch[v.hash];
+    }
+  }
+  auto isNew = [&](const Variant &v) { return !v.cached && v.duplicateOf < 0; };
+
+  std::vector<double> checkTimes(n), runTimes(n);
+  if (!interp.empty()) {
+    parallelFor(
+        n,
+        [&](size_t i) {
+          Variant &v = batch[i];
+          Process proc;
+          if (!isNew(v) || !loads(v, proc)) return;
+          checkTimes[i] = proc.seconds;
+          if (proc.timedOut || !WIFEXITED(proc.status) ||
+              WEXITSTATUS(proc.status) != 0 ||
+              countOf(proc.output, "undefined symbol") > baseUndefined) {
+            v.rejected = true;
+            v.outcome = Outcome::LoadFail;
+            v.detail = WIFSIGNALED(proc.status) ? WTERMSIG(proc.status) : 0;
+          }
+        },
+        opts.jobs);
+  }
+  parallelFor(
+      n,
+      [&](size_t i) {
+        Variant &v = batch[i];
+        Process proc;
+        if (!isNew(v) || v.rejected || !run(v, proc)) return;
+        runTimes[i] = proc.seconds;
+        v.startNs = proc.startNs;
+        v.out = std::move(proc.out);
+        v.err = std::move(proc.err);
+        classify(proc, v);
+        if (pack)
+          pack->append(packBase + v.id, v.plan, (int)v.outcome, v.detail);
+      },
+      opts.jobs);
+  if (rings) drainRings(batch, first);
+
+  for (size_t i = 0; i < n; ++i) {
+    Variant &v = batch[i];
+    if (v.duplicateOf >= 0) {
+      v.outcome = batch[v.duplicateOf].outcome;
+      v.detail = batch[v.duplicateOf].detail;
+    }
+    if (pack && (!isNew(v) || v.rejected))
+      pack->append(packBase + v.id, v.plan, (int)v.outcome, v.detail);
+    if (isNew(v)) {
+      verdicts[v.hash] = {v.outcome, v.detail};
+      checked += !interp.empty();
+      rejected += v.rejected;
+      runs += !v.rejected;
+      checkSeconds += checkTimes[i];
+      runSeconds += runTimes[i];
+      reported += v.reported;
+      if (v.loadNs >= 0) loadNs.push_back(v.loadNs);
+      if (v.reported && v.loadNs < 0 && v.outcome == Outcome::Crash)
+        ++loadCrashes;
+      if (v.faultSignal) ++faultAddrs[v.faultAddr];
+      if (v.outcome != Outcome::Ok && (store || !opts.keepDir.empty()))
+        keep(v);
+      if (!v.rejected && outputStable && outputKey(v.out, v.err) != baseOutput)
+        addToBucket(v);
+    } else {
+      ++duplicates;
+    }
+    ++outcomes[(int)v.outcome];
+    fs::remove_all(v.dir);
+  }
+}
+
+bool Campaign::run() {
+  const unsigned jobs =
+      opts.jobs ? opts.jobs : std::max(1U, std::thread::hardware_concurrency());
+  const size_t batchSize = std::max<size_t>(64, 8 * jobs);
+  if (!opts.audit.empty()) {
+    // Up to 3 results per variant.
+    uint32_t capacity = 1;
+    while (capacity < 3 * batchSize) capacity *= 2;
+    rings.reset(new ResultRings(jobs, capacity));
+    if (!rings->ok()) {
+      std::cerr << "Failed to create the result rings." << std::endl;
+      rings.reset();
+    }
+  }
+
+  if (!peakMemoryAvailable())
+    std::cerr << "Peak memory is unavailable without a cgroup v2 with the "
+                 "memory controller, page faults stand for it."
+              << std::endl;
+
+  // The unmodified binary, copied like the variants.
+  std::vector<Variant> bases(1);
+  Variant &base = bases[0];
+  materialize(base, 0, 0);
+  for (int i = 0; i < std::max(opts.baselineRuns, 1); ++i) {
+    Process proc;
+    base.startNs = 0;
+    if (!run(base, proc) || proc.timedOut) {
+      std::cerr << "The unmodified " << inputPath << " did not finish in "
+                << opts.timeout << " s." << std::endl;
+      return false;
+    }
+    if (i > 0 && proc.status != baseStatus)
+      std::cerr << "The unmodified " << inputPath
+                << " exits inconsistently, status " << proc.status
+                << " after " << baseStatus << std::endl;
+    if (i > 0 && outputStable && outputKey(proc.out, proc.err) != baseOutput) {
+      std::cerr << "The unmodified " << inputPath
+                << " writes different output in each run, output is not "
+                   "compared."
+                << std::endl;
+      outputStable = false;
+    }
+    baseStatus = proc.status;
+    baseOutput = outputKey(proc.out, proc.err);
+    baseline.add(proc);
+    if (rings) {
+      base.startNs = proc.startNs;
+      base.loadNs = -1;
+      drainRings(bases, 0);
+      if (base.loadNs >= 0) baseLoadNs.push_back(base.loadNs);
+    }
+  }
+  baseline.finish();
+  std::sort(baseLoadNs.begin(), baseLoadNs.end());
+  if (rings && !base.reported) {
+    std::cerr << opts.audit << " reported nothing for " << inputPath
+              << ", results are not collected." << std::endl;
+    rings.reset();
+  }
+
+  if (opts.prefilter) {
+    interp = interpreter(findProgram(argvFor(base.path)[0]));
+    Process check;
+    if (!interp.empty() && loads(base, check) && !check.timedOut &&
+        check.status == 0)
+      baseUndefined = countOf(check.output, "undefined symbol");
+    else
+      interp.clear();
+    if (interp.empty())
+      std::cerr << "ld.so cannot check " << inputPath
+                << ", prefilter disabled." << std::endl;
+  }
+  fs::remove_all(base.dir);
+
+  for (size_t first = 1; first <= (size_t)opts.variants; first += batchSize)
+    runBatch(first, std::min(batchSize, opts.variants + 1 - first));
+  std::sort(loadNs.begin(), loadNs.end());
+  return true;
+}
+
+void Campaign::print() const {
+  std::cout << inputPath << ": " << opts.variants << " variants, "
+            << opts.swaps << " swaps each" << std::endl;
+  std::cout << "  baseline (median of " << baseline.runs << " runs):";
+  for (int m = 0; m < metricCount; ++m)
+    if (baseline.median(m) >= 0)
+      std::cout << " " << metricName(m) << " " << baseline.median(m);
+  std::cout << std::endl;
+  for (int i = 0; i < outcomeCount; ++i)
+    if (outcomes[i])
+      std::cout << "  " << outcomeName((Outcome)i) << ": " << outcomes[i]
+                << std::endl;
+  if (!buckets.empty()) {
+    std::vector<const OutputBucket *> sorted;
+    for (const auto &entry : buckets) sorted.push_back(&entry.second);
+    std::sort(sorted.begin(), sorted.end(),
+              [](const OutputBucket *a, const OutputBucket *b) {
+                return a->variants > b->variants;
+              });
+    std::cout << "  " << buckets.size()
+              << " distinct outputs other than the baseline's:" << std::endl;
+    for (size_t i = 0; i < sorted.size() && i < 10; ++i) {
+      const OutputBucket &b = *sorted[i];
+      std::cout << "    " << b.variants << " variants, first "
+                << hexHash(b.hash) << " (" << outcomeName(b.outcome)
+                << "): " << b.out.bytes << " bytes out, " << b.err.bytes
+                << " bytes err";
+      const std::string &head = b.out.bytes ? b.out.head : b.err.head;
+      if (!head.empty()) std::cout << ": \"" << firstLine(head) << "\"";
+      std::cout << std::endl;
+    }
+  }
+  if (duplicates)
+    std::cout << "  " << duplicates
+              << " duplicate variants took a cached verdict" << std::endl;
+  if (rings && runs) {
+    std::cout << "Results: " << reported << " of " << runs
+              << " runs reported through the rings";
+    if (rings->dropped()) std::cout << ", " << rings->dropped() << " dropped";
+    // Only the rings: exit statuses and output still come through waitpid
+    // and the pipes of each run.
+    std::cout << ", " << drainNs / runs << " ns per run to drain the rings"
+              << std::endl;
+    if (!loadNs.empty()) {
+      std::cout << "  relocated in " << loadNs[loadNs.size() / 2] / 1000
+                << " us (median)";
+      if (!baseLoadNs.empty())
+        std::cout << ", baseline " << baseLoadNs[baseLoadNs.size() / 2] / 1000
+                  << " us";
+      std::cout << std::endl;
+    }
+    if (loadCrashes)
+      std::cout << "  " << loadCrashes << " crashed while being relocated"
+                << std::endl;
+    if (!faultAddrs.empty()) {
+      std::vector<std::pair<uint64_t, uint64_t>> sorted(faultAddrs.begin(),
+                                                        faultAddrs.end());
+      std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+        return a.second > b.second;
+      });
+      std::cout << "  " << sorted.size() << " distinct fault addresses:"
+                << std::hex;
+      for (size_t i = 0; i < sorted.size() && i < 5; ++i)
+        std::cout << " 0x" << sorted[i].first << std::dec << " ("
+                  << sorted[i].second << ")" << std::hex;
+      std::cout << std::dec << std::endl;
+    }
+  }
+  if (opts.timings) writeTimings.print(std::cout, opts.cachePolicy);
+  if (pack)
+    std::cout << "Packed as variants " << packBase + 1 << " to "
+              << packBase + opts.variants << " of " << opts.pack << std::endl;
+  if (checked) {
+    // What the rejected variants would have cost, at the mean run time.
+    const double saved = runs ? rejected * runSeconds / runs : 0;
+    std::cout << "Prefilter: rejected " << rejected << " of " << checked
+              << " variants (" << std::fixed << std::setprecision(2)
+              << 100.0 * rejected / checked << "%) in " << checkSeconds
+              << " s, saving about " << saved << " s of runs"
+              << std::defaultfloat << std::endl;
+  }
+}
+}  // namespace
+
+const char *outcomeName(Outcome outcome) {
+  switch (outcome) {
+    case Outcome::Ok:
+      return "ok";
+    case Outcome::Output:
+      return "output";
+    case Outcome::Slow:
+      return "slow";
+    case Outcome::MemHog:
+      return "memhog";
+    case Outcome::Exit:
+      return "exit";
+    case Outcome::Crash:
+      return "crash";
+    case Outcome::Timeout:
+      return "timeout";
+    case Outcome::LoadFail:
+      return "load-fail";
+  }
+  return "?";
+}
+
+bool runCampaign(const Elf &elf, const char *fname,
+                 const CampaignOptions &opts) {
+  Campaign campaign(elf, fname, opts);
+  if (!campaign.run()) return false;
+  campaign.print();
+  return true;
+}
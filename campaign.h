@@ -0,0 +1,52 @@
+#ifndef RELOCSWAP_CAMPAIGN_H
+#define RELOCSWAP_CAMPAIGN_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "elffile.h"
+#include "output.h"
+
+// Run mode: generate variants of a binary with swapped relocs, run each one
+// and classify what happened.
+enum class Outcome {
+  Ok,        // Exited like the unmodified binary.
+  Output,    // Like Ok, but wrote something else to stdout or stderr.
+  Slow,      // Like Ok, but significantly slower than the unmodified binary.
+  MemHog,    // Like Ok, but used significantly more memory.
+  Exit,      // Exited with another status.
+  Crash,     // Killed by a signal.
+  Timeout,   // Killed after CampaignOptions::timeout.
+  LoadFail,  // Rejected by the loader before running.
+};
+constexpr int outcomeCount = (int)Outcome::LoadFail + 1;
+const char *outcomeName(Outcome outcome);
+
+struct CampaignOptions {
+  int variants = 0;
+  int swaps = 1;          // Per variant.
+  unsigned jobs = 0;      // Variants run at once, 0 for one per core.
+  double timeout = 10;    // Seconds.
+  int baselineRuns = 10;  // Of the unmodified binary, to compare usage.
+  bool prefilter = true;  // Check variants with ld.so before running them.
+  std::string keepDir;    // Where variants that fail are kept, if not empty.
+  std::string pack;       // A variant pack recording every variant, if set.
+  std::string store;      // A store where variants that fail go, if set.
+  CachePolicy cachePolicy = CachePolicy::Keep;  // Of the variants written.
+  bool timings = false;  // Report the time spent writing variants.
+  // relocswap-audit.so, to collect results from inside the variants: when
+  // they were relocated and where they faulted.  Only reported by a variant
+  // the campaign runs directly, not through a shell.
+  std::string audit;
+  // The command running a variant, "{}" standing for its path.  Empty to run
+  // the variant itself.  Shared objects are found by the command through
+  // LD_LIBRARY_PATH, under their soname.
+  std::vector<std::string> command;
+};
+
+// Returns false if the unmodified binary cannot be run.
+bool runCampaign(const Elf &elf, const char *fname,
+                 const CampaignOptions &opts);
+
+#endif  // RELOCSWAP_CAMPAIGN_H
@@ -0,0 +1,81 @@
+#include "census.h"
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+void loadCensus(const std::string &fname, Census &census) {
+  std::ifstream fp(fname, std::ios::binary);
+  if (!fp) errExit("Failed to open census file " + fname);
+  std::string line, magic, path;
+  unsigned version = 0, hasCalls = 0;
+  size_t nplt = 0;
+  std::getline(fp, line);
+  std::istringstream header(line);
+  header >> magic >> version >> path >> nplt >> hasCalls;
+  if (!header || magic != "relocswap-census" || version != 1)
+    errExit("Invalid census file " + fname);
+
+  if (census.files == 0) {
+    census.path = path;
+    census.bound.assign(nplt, false);
+  } else if (census.bound.size() != nplt) {
+    errExit("Census file " + fname + " records " + std::to_string(nplt) +
+            " PLT relocs, expected " + std::to_string(census.bound.size()));
+  }
+  ++census.files;
+
+  std::string bitmap((nplt + 7) / 8, '\0');
+  fp.read(&bitmap[0], bitmap.size());
+  if (!fp) errExit("Truncated census file " + fname);
+  for (size_t i = 0; i < nplt; ++i)
+    if (bitmap[i / 8] & (1 << (i % 8))) census.bound[i] = true;
+
+  if (!hasCalls) return;
+  std::vector<uint32_t> calls(nplt);
+  fp.read((char *)calls.data(), nplt * sizeof(uint32_t));
+  if (!fp) errExit("Truncated census file " + fname);
+  census.calls.resize(nplt);
+  for (size_t i = 0; i < nplt; ++i) census.calls[i] += calls[i];
+}
+
+std::vector<double> censusWeights(const Elf &elf, const Census &census,
+                                  double unbound) {
+  const auto &relocs = elf.relocations();
+  const Section *plt = elf.findSection(".rela.plt");
+  std::vector<double> weights(relocs.size(), 1);
+  size_t idx = 0, bound = 0;
+  for (size_t i = 0; i < relocs.size(); ++i) {
+    if (!plt || relocs[i].section != plt - elf.sections().data()) continue;
+    if (idx < census.bound.size() && census.bound[idx]) {
+      // Favor hot calls, without letting a few of them take every swap.
+      weights[i] =
+          census.calls.empty() ? 1 : 1 + std::log2(1 + census.calls[idx]);
+      ++bound;
+    } else {
+      weights[i] = unbound;
+    }
+    ++idx;
+  }
+  if (idx != census.bound.size())
+    errExit("The census of " + census.path + " records " +
+            std::to_string(census.bound.size()) +
+            " PLT relocs, the input has " + std::to_string(idx));
+  std::cout << "Census: " << bound << " of " << idx << " PLT relocs bound in "
+            << census.files << " run(s)" << std::endl;
+  // Bound at load, every PLT reloc is, and none calls through the loader, so
+  // counting calls would not help either: the weights tell nothing apart.
+  const bool bindNow = elf.bindNow();
+  bool called = false;
+  for (uint64_t n : census.calls) called |= n != 0;
+  if (bindNow)
+    std::cerr << "Warning: " << census.path
+              << " is linked with -z now, its census records every PLT reloc "
+                 "as bound." << std::endl;
+  else if (idx && bound == idx && !called)
+    std::cerr << "Warning: the census records every PLT reloc as bound"
+              << (census.calls.empty() ? "" : " and none called")
+              << ", as under LD_BIND_NOW." << std::endl;
+  return weights;
+}
@@ -0,0 +1,28 @@
+#ifndef RELOCSWAP_CENSUS_H
+#define RELOCSWAP_CENSUS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "elffile.h"
+
+// The PLT relocs a workload bound, and optionally called, as recorded by
+// relocswap-audit.so (see audit.c).  Census files of several runs of the same
+// binary are merged.
+struct Census {
+  std::string path;             // The binary recorded by the first file.
+  std::vector<bool> bound;      // By .rela.plt index.
+  std::vector<uint64_t> calls;  // Empty unless calls were counted.
+  size_t files = 0;
+};
+
+void loadCensus(const std::string &fname, Census &census);
+
+// Swap weights for Elf::setSwapWeights: PLT relocs are weighted by their calls
+// (1 if only bindings were recorded), or 'unbound' if the workload never bound
+// them.  Other relocs have a weight of 1.
+std::vector<double> censusWeights(const Elf &elf, const Census &census,
+                                  double unbound);
+
+#endif  // RELOCSWAP_CENSUS_H
@@ -0,0 +1,122 @@
+#include "demangle.h"
+
+#include <cxxabi.h>
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+bool demangleOn = false;
+
+namespace {
+// The character of the escape "$..$" at 'e', of 'len' bytes at most, and its
+// length in 'escapeLen', or 0 if there is none.
+char rustEscape(const char *e, size_t len, size_t &escapeLen) {
+  static const struct {
+    const char *code;
+    char c;
+  } escapes[] = {{"$C$", ','},  {"$SP$", '@'}, {"$BP$", '*'}, {"$RF$", '&'},
+                 {"$LT$", '<'}, {"$GT$", '>'}, {"$LP$", '('}, {"$RP$", ')'}};
+  for (const auto &escape : escapes) {
+    escapeLen = strlen(escape.code);
+    if (len >= escapeLen && !memcmp(e, escape.code, escapeLen))
+      return escape.c;
+  }
+  // $uXX$: a printable ASCII character in lower case hex.
+  auto nibble = [](char c) {
+    return isdigit(c) ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+  };
+  if (len < 5 || e[1] != 'u' || e[4] != '$') return 0;
+  const int hi = nibble(e[2]), lo = nibble(e[3]);
+  if (hi < 0 || hi > 7 || lo < 0 || (hi << 4 | lo) < 0x20) return 0;
+  escapeLen = 5;
+  return hi << 4 | lo;
+}
+
+// Rust's legacy mangling, _ZN, the path and a hash, E: a valid Itanium name
+// that __cxa_demangle would leave full of escapes.  The path is printed as
+// libiberty prints it, with the hash left out.
+bool demangleRust(const char *name, std::string &out) {
+  if (strncmp(name, "_ZN", 3)) return false;
+  const char *sym = name + 3;
+  size_t len = strlen(sym);
+  for (size_t i = 0; i < len; ++i)
+    if (!isalnum((unsigned char)sym[i]) && !strchr("_$.:@", sym[i]))
+      return false;
+  // A ".suffix" may follow the E.
+  for (bool dotSuffix = true; len && !(dotSuffix && sym[len - 1] == 'E');)
+    dotSuffix = sym[--len] == '.';
+  if (!len || sym[len - 1] != 'E') return false;
+  --len;
+  if (len <= 19 || memcmp(sym + len - 19, "17h", 3)) return false;
+
+  std::vector<std::pair<const char *, size_t>> idents;
+  for (size_t next = 0; next < len;) {
+    if (!isdigit((unsigned char)sym[next])) return false;
+    size_t n = sym[next++] - '0';
+    if (n)
+      while (next < len && isdigit((unsigned char)sym[next]))
+        if ((n = n * 10 + sym[next++] - '0') > len) return false;
+    if (n > len - next) return false;
+    idents.emplace_back(sym + next, n);
+    next += n;
+  }
+  // The hash: 16 hex digits, at least 5 of them distinct.
+  const auto [hash, hashLen] = idents.back();
+  unsigned seen = 0;
+  for (size_t i = 1; i < hashLen; ++i)
+    if (isdigit(hash[i]) || (hash[i] >= 'a' && hash[i] <= 'f'))
+      seen |= 1 << (isdigit(hash[i]) ? hash[i] - '0' : hash[i] - 'a' + 10);
+    else
+      return false;
+  if (hashLen != 17 || hash[0] != 'h' || __builtin_popcount(seen) < 5)
+    return false;
+
+  idents.pop_back();
+  for (size_t i = 0; i < idents.size(); ++i) {
+    auto [s, n] = idents[i];
+    if (i) out.append("::");
+    if (n >= 2 && s[0] == '_' && s[1] == '$') ++s, --n;
+    while (n) {
+      size_t step = 1;
+      if (s[0] == '$') {
+        const char c = rustEscape(s, n, step);
+        if (!c) {
+          out.append(s, n);  // Verbatim from an unknown escape on.
+          break;
+        }
+        out.push_back(c);
+      } else if (s[0] == '.') {
+        step = n >= 2 && s[1] == '.' ? 2 : 1;
+        out.append(step == 2 ? "::" : "-");
+      } else {
+        while (step < n && s[step] != '$' && s[step] != '.') ++step;
+        out.append(s, step);
+      }
+      s += step, n -= step;
+    }
+  }
+  out.push_back('\0');
+  return true;
+}
+}  // namespace
+
+bool demangleTo(const char *name, std::string &out) {
+  // Only Itanium ABI names: __cxa_demangle would also take "i" for int.
+  if (name[0] != '_' || name[1] != 'Z') return false;
+  if (demangleRust(name, out)) return true;
+  int status;
+  char *res = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (!res) return false;
+  out.append(res).push_back('\0');
+  free(res);
+  return true;
+}
+
+std::string demangle(const std::string &name) {
+  std::string res;
+  if (!demangleOn || !demangleTo(name.c_str(), res)) return name;
+  res.pop_back();
+  return res;
+}
@@ -0,0 +1,68 @@
+#ifndef RELOCSWAP_DEMANGLE_H
+#define RELOCSWAP_DEMANGLE_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "batch.h"
+
+// --demangle: C++ symbol names, and Rust's legacy ones, are printed demangled
+// as readelf -C prints them.  Rust v0 names (_R) are left as they are.
+
+extern bool demangleOn;  // Set once by --demangle, before any worker starts.
+
+// Append the demangled 'name' and a NUL to 'out'.  False, leaving 'out' as it
+// is, if 'name' is not a mangled name.
+bool demangleTo(const char *name, std::string &out);
+// 'name' demangled if demangleOn and a mangled name, else 'name'.
+std::string demangle(const std::string &name);
+
+// The demangled names of the symbols of a symbol table, for dumps of millions
+// of relocs: each symbol wanted is demangled once, by a pool of workers, into
+// arenas that live as long as the names, so formatting allocates nothing.
+class SymbolNames {
+  static constexpr size_t chunkSize = 1 << 10;
+  std::vector<uint8_t> state;  // 0 if not wanted, 1 if wanted, 2 if done.
+  std::vector<const char *> names;  // nullptr if not demangled.
+  std::deque<std::string> arenas;   // One per chunk, never moved.
+
+ public:
+  explicit SymbolNames(size_t count) : state(count), names(count) {}
+
+  void want(uint64_t idx) {
+    if (idx < state.size() && !state[idx]) state[idx] = 1;
+  }
+  // Demangle the symbols wanted since the last call, name(idx) being the
+  // mangled name of symbol 'idx', or nullptr.  'name' is called from several
+  // threads.
+  template <class NameFn>
+  void demangle(NameFn name) {
+    TraceSpan span("demangle");
+    std::vector<uint64_t> todo;
+    for (size_t i = 0; i < state.size(); ++i)
+      if (state[i] == 1) todo.push_back(i), state[i] = 2;
+    const size_t first = arenas.size();
+    arenas.resize(first + (todo.size() + chunkSize - 1) / chunkSize);
+    forChunks(todo.size(), chunkSize, [&](size_t begin, size_t end) {
+      std::string &arena = arenas[first + begin / chunkSize];
+      // Offsets until the arena is complete, as it moves while it grows.
+      std::vector<size_t> at(end - begin, std::string::npos);
+      for (size_t i = begin; i < end; ++i) {
+        const char *mangled = name(todo[i]);
+        const size_t pos = arena.size();
+        if (mangled && demangleTo(mangled, arena)) at[i - begin] = pos;
+      }
+      for (size_t i = begin; i < end; ++i)
+        if (at[i - begin] != std::string::npos)
+          names[todo[i]] = arena.data() + at[i - begin];
+    });
+  }
+  // The demangled name of symbol 'idx', or 'mangled' if there is none.
+  const char *operator()(uint64_t idx, const char *mangled) const {
+    return idx < names.size() && names[idx] ? names[idx] : mangled;
+  }
+};
+
+#endif  // RELOCSWAP_DEMANGLE_H
@@ -0,0 +1,853 @@
+#include "elffile.h"
+
+#include <elf.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "batch.h"
+#include "demangle.h"
+#include "filter.h"
+#include "format.h"
+#include "output.h"
+#include "radix.h"
+#include "trace.h"
+
+namespace {
+thread_local bool recoverErrors = false;
+}
+
+RecoverErrors::RecoverErrors(bool on) : outer(recoverErrors) {
+  recoverErrors = on;
+}
+
+RecoverErrors::~RecoverErrors() { recoverErrors = outer; }
+
+bool RecoverErrors::active() { return recoverErrors; }
+
+void errExit(std::string msg) {
+  if (recoverErrors) throw InputError(msg);
+  std::cerr << msg << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+namespace {
+struct MachineRelocs {
+  uint16_t machine;
+  uint32_t relative, irelative, copy, jumpSlot, globDat;
+};
+
+constexpr uint32_t noType = ~0U;
+constexpr MachineRelocs machineRelocs[] = {
+    {EM_X86_64, R_X86_64_RELATIVE, R_X86_64_IRELATIVE, R_X86_64_COPY,
+     R_X86_64_JUMP_SLOT, R_X86_64_GLOB_DAT},
+    {EM_386, R_386_RELATIVE, R_386_IRELATIVE, R_386_COPY, R_386_JMP_SLOT,
+     R_386_GLOB_DAT},
+    {EM_AARCH64, R_AARCH64_RELATIVE, R_AARCH64_IRELATIVE, R_AARCH64_COPY,
+     R_AARCH64_JUMP_SLOT, R_AARCH64_GLOB_DAT},
+    {EM_ARM, R_ARM_RELATIVE, R_ARM_IRELATIVE, R_ARM_COPY, R_ARM_JUMP_SLOT,
+     R_ARM_GLOB_DAT},
+    {EM_RISCV, R_RISCV_RELATIVE, R_RISCV_IRELATIVE, R_RISCV_COPY,
+     R_RISCV_JUMP_SLOT, noType},
+    {EM_PPC64, R_PPC64_RELATIVE, R_PPC64_IRELATIVE, R_PPC64_COPY,
+     R_PPC64_JMP_SLOT, R_PPC64_GLOB_DAT},
+    {EM_S390, R_390_RELATIVE, R_390_IRELATIVE, R_390_COPY, R_390_JMP_SLOT,
+     R_390_GLOB_DAT},
+};
+
+const MachineRelocs *findMachine(uint16_t machine) {
+  for (const auto &m : machineRelocs)
+    if (m.machine == machine) return &m;
+  return nullptr;
+}
+}  // namespace
+
+RelocKind relocKind(uint16_t machine, uint32_t type) {
+  const MachineRelocs *m = findMachine(machine);
+  if (type == 0) return RelocKind::None;
+  if (!m) return RelocKind::Other;
+  if (type == m->relative) return RelocKind::Relative;
+  if (type == m->irelative) return RelocKind::IRelative;
+  if (type == m->copy) return RelocKind::Copy;
+  if (type == m->jumpSlot) return RelocKind::JumpSlot;
+  if (type == m->globDat) return RelocKind::GlobDat;
+  return RelocKind::Other;
+}
+
+uint32_t relativeType(uint16_t machine) {
+  const MachineRelocs *m = findMachine(machine);
+  return m ? m->relative : 0;
+}
+
+// A sparse permutation of a reloc table: maps a slot to the index of the
+// entry whose r_offset (and r_addend) the slot holds.  Slots not present are
+// unchanged.
+using SwapPerm = std::unordered_map<size_t, size_t>;
+
+static size_t permAt(const SwapPerm &perm, size_t idx) {
+  const auto it = perm.find(idx);
+  return it == perm.end() ? idx : it->second;
+}
+
+// Compose a run of transpositions, applied in order, into a permutation.
+static SwapPerm composeRun(const Swap *first, const Swap *last) {
+  SwapPerm perm;
+  perm.reserve(2 * (last - first));
+  for (const Swap *s = first; s != last; ++s) {
+    if (s->first == s->second) continue;
+    const size_t a = permAt(perm, s->first);
+    const size_t b = permAt(perm, s->second);
+    perm[s->first] = b;
+    perm[s->second] = a;
+  }
+  return perm;
+}
+
+// Returns the permutation of applying 'first' and then 'second'.
+static SwapPerm composePerms(const SwapPerm &first, const SwapPerm &second) {
+  SwapPerm perm;
+  perm.reserve(first.size() + second.size());
+  for (const auto &[slot, src] : second) perm[slot] = permAt(first, src);
+  for (const auto &[slot, src] : first)
+    if (!second.count(slot)) perm[slot] = src;
+  return perm;
+}
+
+// Compose a sequence of transpositions into the final permutation.  Long
+// sequences are split into chunks composed in parallel, and the chunk results
+// are merged pairwise as a tree; the few swaps of a variant are composed on
+// the calling thread.  Returns the slots that changed, sorted.
+std::vector<Swap> composeSwaps(const std::vector<Swap> &swaps) {
+  constexpr size_t minChunk = 1 << 16;
+  const size_t nThreads = std::max(1U, std::thread::hardware_concurrency());
+  const size_t nChunks =
+      std::max<size_t>(1, std::min(nThreads, swaps.size() / minChunk));
+
+  std::vector<SwapPerm> perms(nChunks);
+  const size_t chunkSize = (swaps.size() + nChunks - 1) / nChunks;
+  parallelFor(nChunks, [&](size_t i) {
+    const size_t begin = std::min(swaps.size(), i * chunkSize);
+    const size_t end = std::min(swaps.size(), begin + chunkSize);
+    perms[i] = composeRun(swaps.data() + begin, swaps.data() + end);
+  });
+
+  // Merge neighbors, preserving order, until one permutation remains.
+  while (perms.size() > 1) {
+    std::vector<SwapPerm> merged((perms.size() + 1) / 2);
+    parallelFor(perms.size() / 2, [&](size_t i) {
+      merged[i] = composePerms(perms[2 * i], perms[2 * i + 1]);
+    });
+    if (perms.size() % 2) merged.back() = std::move(perms.back());
+    perms = std::move(merged);
+  }
+
+  std::vector<Swap> moved;
+  for (const auto &[slot, src] : perms[0])
+    if (slot != src) moved.emplace_back(slot, src);
+  std::sort(moved.begin(), moved.end());
+  return moved;
+}
+
+const Section *Elf::findSection(const std::string &name) const {
+  for (const auto &sec : sections())
+    if (sec.name == name) return &sec;
+  return nullptr;
+}
+
+const DynEntry *Elf::findDyn(int64_t tag) const {
+  for (const auto &dyn : dynamic()) {
+    if (dyn.tag == DT_NULL) break;
+    if (dyn.tag == tag) return &dyn;
+  }
+  return nullptr;
+}
+
+bool Elf::bindNow() const {
+  const DynEntry *flags = findDyn(DT_FLAGS);
+  const DynEntry *flags1 = findDyn(DT_FLAGS_1);
+  return findDyn(DT_BIND_NOW) || (flags && (flags->val & DF_BIND_NOW)) ||
+         (flags1 && (flags1->val & DF_1_NOW));
+}
+
+bool Elf::addrToOffset(uint64_t addr, uint64_t &offset) const {
+  for (const auto &seg : segments())
+    if (seg.type == PT_LOAD && addr >= seg.vaddr &&
+        addr < seg.vaddr + seg.fileSize) {
+      offset = seg.offset + (addr - seg.vaddr);
+      return true;
+    }
+  return false;
+}
+
+std::string readBytes(std::istream &in, uint64_t offset, uint64_t size) {
+  std::string bytes(size, '\0');
+  in.seekg(offset);
+  in.read(bytes.data(), size);
+  if (!in) errExit("Failed to read the input file.");
+  return bytes;
+}
+
+std::string readBuildId(std::istream &in, const Elf &elf) {
+  for (const auto &sec : elf.sections()) {
+    if (sec.type != SHT_NOTE || sec.size < 16) continue;
+    // Notes are 4-byte aligned in both classes: namesz, descsz, type, name.
+    const std::string note = readBytes(in, sec.offset, sec.size);
+    for (size_t pos = 0; pos + 12 <= note.size();) {
+      uint32_t nameSize, descSize, type;
+      memcpy(&nameSize, &note[pos], 4);
+      memcpy(&descSize, &note[pos + 4], 4);
+      memcpy(&type, &note[pos + 8], 4);
+      const size_t desc = pos + 12 + ((nameSize + 3) & ~3u);
+      if (desc + descSize > note.size()) break;
+      if (type == NT_GNU_BUILD_ID && nameSize == 4 &&
+          note.compare(pos + 12, 4, "GNU\0", 4) == 0) {
+        static const char digits[] = "0123456789abcdef";
+        std::string hex;
+        for (size_t i = desc; i < desc + descSize; ++i) {
+          hex += digits[(unsigned char)note[i] >> 4];
+          hex += digits[note[i] & 15];
+        }
+        return hex;
+      }
+      pos = desc + ((descSize + 3) & ~3u);
+    }
+  }
+  return "";
+}
+
+std::vector<uint64_t> decodeRelr(const std::string &data, unsigned wordSize) {
+  std::vector<uint64_t> addrs;
+  uint64_t base = 0;
+  for (size_t i = 0; i + wordSize <= data.size(); i += wordSize) {
+    uint64_t word = 0;
+    memcpy(&word, &data[i], wordSize);
+    if ((word & 1) == 0) {  // An address, followed by a word at base.
+      addrs.push_back(word);
+      base = word + wordSize;
+      continue;
+    }
+    // A bitmap of the next wordSize * 8 - 1 words.
+    for (unsigned bit = 0; (word >>= 1) != 0; ++bit)
+      if (word & 1) addrs.push_back(base + bit * wordSize);
+    base += (wordSize * 8 - 1) * wordSize;
+  }
+  return addrs;
+}
+
+bool setDynEntry(std::vector<DynEntry> &dyn, int64_t tag, uint64_t val) {
+  for (size_t i = 0; i < dyn.size(); ++i) {
+    // Keep at least one DT_NULL to terminate the array.
+    if (dyn[i].tag == tag || (dyn[i].tag == DT_NULL && i + 1 < dyn.size())) {
+      dyn[i].tag = tag;
+      dyn[i].val = val;
+      return true;
+    }
+    if (dyn[i].tag == DT_NULL) break;
+  }
+  return false;
+}
+
+void removeDynEntry(std::vector<DynEntry> &dyn, int64_t tag) {
+  for (size_t i = 0; i < dyn.size() && dyn[i].tag != DT_NULL; ++i) {
+    if (dyn[i].tag != tag) continue;
+    // Shift the remaining entries down, keeping their file offsets.
+    for (size_t j = i; j + 1 < dyn.size(); ++j) {
+      dyn[j].tag = dyn[j + 1].tag;
+      dyn[j].val = dyn[j + 1].val;
+    }
+    dyn.back().tag = DT_NULL;
+    dyn.back().val = 0;
+    return;
+  }
+}
+
+void writeDynamic(const Elf &elf, PatchSink &output,
+                  const std::vector<DynEntry> &dyn) {
+  std::vector<Patch> batch;
+  for (const auto &entry : dyn)
+    batch.emplace_back(entry.fileOffset, elf.encodeDyn(entry));
+  std::sort(batch.begin(), batch.end());
+  output.write(batch);
+}
+
+namespace {
+template <class EhdrT, class PhdrT, class ShdrT, class RelT, class RelaT,
+          class SymT, class DynT>
+class ElfT : public Elf {
+  static constexpr bool isElf64 = sizeof(EhdrT) == sizeof(Elf64_Ehdr);
+  // Tables are decoded in chunks of this many entries, on all cores if large.
+  static constexpr size_t decodeChunk = 1 << 16;
+
+  // A parsed reloc section: a run of 'count' entries, starting at 'first', of
+  // either relocs or relocsAddends.
+  struct RelocTable {
+    uint32_t section;
+    bool withAddends;
+    size_t first;
+    size_t count;
+    bool sorted;  // By r_offset.
+  };
+
+  EhdrT header;
+  // The uint64_t in each pair represents the offset in the file for that reloc.
+  std::vector<std::pair<uint64_t, RelT>> relocs;  // Relocs without addends.
+  std::vector<std::pair<uint64_t, RelaT>> relocsAddends;  // Relocs + addends.
+  std::vector<RelocTable> relocTables;
+  mutable std::once_flag relocsDecoded, relocsSortedByOffset;
+  mutable std::vector<Reloc> allRelocs;  // Of relocations(), once decoded.
+  mutable std::vector<uint32_t> byOffset;  // Of relocsByOffset(), once sorted.
+  // Cumulative swap weights of relocs and relocsAddends, empty if unweighted.
+  std::vector<double> relWeights, relaWeights;
+  std::vector<SymT> symbolTable;
+  std::vector<char> stringTable;
+  std::vector<char> sectionStringTable;
+  std::vector<Section> sectionHeaders;
+  std::vector<Segment> programHeaders;
+  std::vector<DynEntry> dynamicEntries;
+
+  static uint32_t relSym(uint64_t rInfo) {
+    return isElf64 ? ELF64_R_SYM(rInfo) : ELF32_R_SYM(rInfo);
+  }
+
+  static uint32_t relType(uint64_t rInfo) {
+    return isElf64 ? ELF64_R_TYPE(rInfo) : ELF32_R_TYPE(rInfo);
+  }
+
+  // Split the 'n' relocs of 'data', 'entSize' bytes apart and starting at
+  // file offset 'offset', onto the end of 'entries'.  Returns whether they are
+  // sorted by r_offset.
+  template <class T>
+  static bool decodeEntries(const std::vector<char> &data, size_t n,
+                            uint64_t entSize, uint64_t offset,
+                            std::vector<std::pair<uint64_t, T>> &entries) {
+    if (n && entSize < sizeof(T)) errExit("Invalid relocation entry size.");
+    entries.resize(entries.size() + n);
+    auto *const first = entries.data() + entries.size() - n;
+    std::vector<char> chunkSorted((n + decodeChunk - 1) / decodeChunk);
+    forChunks(n, decodeChunk, [&](size_t begin, size_t end) {
+      bool sorted = true;
+      for (size_t i = begin; i < end; ++i) {
+        first[i].first = offset + i * entSize;
+        memcpy(&first[i].second, &data[i * entSize], sizeof(T));
+        if (i > begin)
+          sorted &= first[i - 1].second.r_offset <= first[i].second.r_offset;
+      }
+      chunkSorted[begin / decodeChunk] = sorted;
+    });
+    for (size_t c = 0; c < chunkSorted.size(); ++c)
+      if (!chunkSorted[c] ||
+          (c && first[c * decodeChunk - 1].second.r_offset >
+                    first[c * decodeChunk].second.r_offset))
+        return false;
+    return true;
+  }
+
+  void addRels(std::istream &fp, const ShdrT &shdr) {
+    assert(fp && "Invalid input stream.");
+    assert((shdr.sh_type == SHT_REL || shdr.sh_type == SHT_RELA) &&
+           "Invalid section header.");
+    const auto pos = fp.tellg();
+    TraceSpan span("load relocs", &sectionStringTable[shdr.sh_name]);
+
+    fp.seekg(shdr.sh_offset);
+
+    RelocTable table{(uint32_t)sectionHeaders.size(),
+                     shdr.sh_type == SHT_RELA, 0, 0, true};
+    // Read the whole section at once, then split it into entries.
+    const size_t n = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+    std::vector<char> data(n * shdr.sh_entsize);
+    fp.read(data.data(), data.size());
+    if (!fp) errExit("Failed to read relocation.");
+    if (shdr.sh_type == SHT_REL) {
+      table.first = relocs.size();
+      table.sorted =
+          decodeEntries(data, n, shdr.sh_entsize, shdr.sh_offset, relocs);
+    } else {
+      table.first = relocsAddends.size();
+      table.sorted = decodeEntries(data, n, shdr.sh_entsize, shdr.sh_offset,
+                                   relocsAddends);
+    }
+    table.count = n;
+    relocTables.push_back(table);
+
+    fp.seekg(pos);
+  }
+
+  void addSectionStringTable(std::istream &fp, const EhdrT &hdr) {
+    assert(fp && "Invalid input stream.");
+    const auto pos = fp.tellg();
+    TraceSpan span("load shstrtab");
+
+    fp.seekg(hdr.e_shoff + (hdr.e_shstrndx * hdr.e_shentsize));
+    ShdrT shdr;
+    fp.read((char *)&shdr, hdr.e_shentsize);
+    if (!fp) errExit("Failed to read the section string table header.");
+
+    fp.seekg(shdr.sh_offset);
+    sectionStringTable.resize(shdr.sh_size);
+    fp.read(sectionStringTable.data(), shdr.sh_size);
+    if (!fp) errExit("Failed to read the section string table.");
+
+    fp.seekg(pos);
+  }
+
+  void addStringTable(std::istream &fp, const ShdrT &shdr) {
+    assert(shdr.sh_type == SHT_STRTAB && "Invalid section header.");
+    assert(fp && "Invalid input stream.");
+    const auto pos = fp.tellg();
+    TraceSpan span("load dynstr");
+    fp.seekg(shdr.sh_offset);
+    stringTable.resize(shdr.sh_size);
+    fp.read(stringTable.data(), shdr.sh_size);
+    if (!fp) errExit("Failed to read string table.");
+    fp.seekg(pos);
+  }
+
+  void addSymbolTable(std::istream &fp, const ShdrT &shdr) {
+    assert(fp && "Invalid input stream.");
+    assert(shdr.sh_type == SHT_DYNSYM && "Invalid section header.");
+    const auto pos = fp.tellg();
+    TraceSpan span("load dynsym");
+    const size_t n = shdr.sh_entsize ? shdr.sh_size / shdr.sh_entsize : 0;
+    if (n && shdr.sh_entsize < sizeof(SymT))
+      errExit("Invalid symbol table entry size.");
+    std::vector<char> data(n * shdr.sh_entsize);
+    fp.seekg(shdr.sh_offset);
+    fp.read(data.data(), data.size());
+    if (!fp) errExit("Failed to read symbol table entry.");
+    symbolTable.resize(n);
+    forChunks(n, decodeChunk, [&](size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i)
+        memcpy(&symbolTable[i], &data[i * shdr.sh_entsize], sizeof(SymT));
+    });
+    fp.seekg(pos);
+  }
+
+  void addDynamic(std::istream &fp, const ShdrT &shdr) {
+    assert(fp && "Invalid input stream.");
+    assert(shdr.sh_type == SHT_DYNAMIC && "Invalid section header.");
+    const auto pos = fp.tellg();
+    TraceSpan span("load dynamic");
+    fp.seekg(shdr.sh_offset);
+    for (size_t i = 0; i < shdr.sh_size / sizeof(DynT); ++i) {
+      DynT dyn;
+      const auto dynOffset = fp.tellg();
+      fp.read((char *)&dyn, sizeof(DynT));
+      if (!fp) errExit("Failed to read dynamic entry.");
+      dynamicEntries.push_back(
+          {(int64_t)dyn.d_tag, (uint64_t)dyn.d_un.d_val, (uint64_t)dynOffset});
+    }
+    fp.seekg(pos);
+  }
+
+  void addProgramHeaders(std::istream &fp, const EhdrT &hdr) {
+    assert(fp && "Invalid input stream.");
+    const auto pos = fp.tellg();
+    TraceSpan span("load phdrs");
+    for (size_t i = 0; i < hdr.e_phnum; ++i) {
+      PhdrT phdr;
+      fp.seekg(hdr.e_phoff + i * hdr.e_phentsize);
+      fp.read((char *)&phdr, sizeof(PhdrT));
+      if (!fp) errExit("Failed to read program header.");
+      programHeaders.push_back({phdr.p_type, phdr.p_flags, phdr.p_offset,
+                                phdr.p_vaddr, phdr.p_filesz, phdr.p_memsz});
+    }
+    fp.seekg(pos);
+  }
+
+  const char *symName(uint64_t rInfo) const {
+    const uint64_t symIdx = relSym(rInfo);
+    if (symIdx < symbolTable.size()) {
+      const SymT *sym = &symbolTable[symIdx];
+      if (sym->st_name < stringTable.size()) return &stringTable[sym->st_name];
+    }
+    return "N/A";
+  }
+
+  void dumpReloc(const RelT &rel, const char *name, TextBuffer &out) const {
+    out.hex(rel.r_offset).put(", 0x").hex(rel.r_info).put(name);
+  }
+
+  void dumpReloc(const RelaT &rel, const char *name, TextBuffer &out) const {
+    // Addends print as the unsigned words they are stored in.
+    out.hex(rel.r_offset).put(", 0x").hex(rel.r_info).put(", 0x");
+    out.hex((std::make_unsigned_t<decltype(rel.r_addend)>)rel.r_addend);
+    out.put(", ").put(name);
+  }
+
+ public:
+  bool is64() const override { return isElf64; }
+  uint16_t type() const override { return header.e_type; }
+  uint16_t machine() const override { return header.e_machine; }
+  const std::vector<Section> &sections() const override {
+    return sectionHeaders;
+  }
+  const std::vector<Segment> &segments() const override {
+    return programHeaders;
+  }
+  const std::vector<DynEntry> &dynamic() const override {
+    return dynamicEntries;
+  }
+
+  const std::vector<Reloc> &relocations() const override {
+    std::call_once(relocsDecoded, [this] { decodeRelocations(); });
+    return allRelocs;
+  }
+
+  const std::vector<uint32_t> &relocsByOffset() const override {
+    std::call_once(relocsSortedByOffset, [this] {
+      const std::vector<Reloc> &all = relocations();
+      TraceSpan span("sort relocs");
+      byOffset.resize(all.size());
+      std::iota(byOffset.begin(), byOffset.end(), 0);
+      // Tables sorted already, one after the other, need no sort.
+      bool sorted = true;
+      size_t at = 0;
+      for (const auto &table : relocTables) {
+        sorted &= table.sorted && (!at || !table.count ||
+                                   all[at - 1].offset <= all[at].offset);
+        at += table.count;
+      }
+      if (!sorted)
+        radixSort(byOffset, [&](uint32_t i) { return all[i].offset; });
+    });
+    return byOffset;
+  }
+
+  std::optional<bool> relocsSorted(uint32_t section) const override {
+    for (const auto &table : relocTables)
+      if (table.section == section) return table.sorted;
+    return std::nullopt;
+  }
+
+  void decodeRelocations() const {
+    TraceSpan span("decode relocs");
+    allRelocs.resize(relocs.size() + relocsAddends.size());
+    Reloc *out = allRelocs.data();
+    for (const auto &table : relocTables) {
+      forChunks(table.count, decodeChunk, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+          if (table.withAddends) {
+            const auto &[fileOffset, rela] = relocsAddends[table.first + i];
+            out[i] = {fileOffset, rela.r_offset, rela.r_info,
+                      (int64_t)rela.r_addend, relType(rela.r_info),
+                      relSym(rela.r_info), table.section};
+          } else {
+            const auto &[fileOffset, rel] = relocs[table.first + i];
+            out[i] = {fileOffset, rel.r_offset, rel.r_info, 0,
+                      relType(rel.r_info), relSym(rel.r_info), table.section};
+          }
+        }
+      });
+      out += table.count;
+    }
+  }
+
+  size_t symbolCount() const override { return symbolTable.size(); }
+
+  Symbol symbol(size_t idx) const override {
+    assert(idx < symbolTable.size() && "Invalid symbol index.");
+    const SymT &sym = symbolTable[idx];
+    const char *name =
+        sym.st_name < stringTable.size() ? &stringTable[sym.st_name] : "";
+    return {name,         sym.st_value, sym.st_size, sym.st_shndx,
+            sym.st_info,  sym.st_other};
+  }
+
+  std::string relocSymName(const uint64_t rInfo) const override {
+    return symName(rInfo);
+  }
+
+  const char *dynString(uint64_t offset) const override {
+    return offset < stringTable.size() ? &stringTable[offset] : "";
+  }
+
+  std::string encodeReloc(const Reloc &rel, bool withAddend) const override {
+    if (withAddend) {
+      RelaT rela;
+      rela.r_offset = rel.offset;
+      rela.r_info = rel.info;
+      rela.r_addend = rel.addend;
+      return std::string((const char *)&rela, sizeof(RelaT));
+    }
+    RelT r;
+    r.r_offset = rel.offset;
+    r.r_info = rel.info;
+    return std::string((const char *)&r, sizeof(RelT));
+  }
+
+  std::string encodeDyn(const DynEntry &entry) const override {
+    DynT dyn;
+    dyn.d_tag = entry.tag;
+    dyn.d_un.d_val = entry.val;
+    return std::string((const char *)&dyn, sizeof(DynT));
+  }
+
+  std::string encodeSection(const Section &sec) const override {
+    ShdrT shdr;
+    shdr.sh_name = sec.nameIdx;
+    shdr.sh_type = sec.type;
+    shdr.sh_flags = sec.flags;
+    shdr.sh_addr = sec.addr;
+    shdr.sh_offset = sec.offset;
+    shdr.sh_size = sec.size;
+    shdr.sh_link = sec.link;
+    shdr.sh_info = sec.info;
+    shdr.sh_addralign = sec.align;
+    shdr.sh_entsize = sec.entSize;
+    return std::string((const char *)&shdr, sizeof(ShdrT));
+  }
+
+  std::string encodeHeader(uint64_t shoff, uint16_t shnum) const override {
+    EhdrT hdr = header;
+    hdr.e_shoff = shoff;
+    hdr.e_shnum = shnum;
+    return std::string((const char *)&hdr, sizeof(EhdrT));
+  }
+
+  // Print the entries of the reloc tables in 'entries' that 'filter' lets
+  // through, numbered by their index in 'entries'.  Large tables are printed
+  // in chunks by a pool of workers.  With 'names', the symbols of the entries
+  // are demangled before, and matched and printed demangled.
+  template <class T>
+  void dumpEntries(const std::vector<std::pair<uint64_t, T>> &entries,
+                   bool withAddends, const RelocFilter &filter,
+                   SymbolNames *names, TextBuffer &out) const {
+    filter.addSymbols(0, symbolTable.size());
+    for (const auto &table : relocTables) {
+      if (table.withAddends != withAddends) continue;
+      const auto *first = entries.data() + table.first;
+      const auto [begin, end] = filter.candidates(
+          table.count, [&](size_t i) { return first[i].second.r_offset; },
+          table.sorted);
+      if (names) {
+        for (size_t i = begin; i < end; ++i)
+          if (filter.matchType(relType(first[i].second.r_info)) &&
+              filter.matchOffset(first[i].second.r_offset))
+            names->want(relSym(first[i].second.r_info));
+        names->demangle([&](uint64_t idx) {
+          return dynString(symbolTable[idx].st_name);
+        });
+      }
+      auto print = [&, begin = begin](size_t from, size_t to,
+                                      TextBuffer &buffer) {
+        for (size_t i = begin + from; i < begin + to; ++i) {
+          const auto &[fileOffset, rel] = first[i];
+          const uint32_t symIdx = relSym(rel.r_info);
+          if (!filter.matchType(relType(rel.r_info)) ||
+              !filter.matchOffset(rel.r_offset) ||
+              !filter.matchSymbol(0, symIdx, [&] {
+                if (symIdx >= symbolTable.size()) return "";
+                const char *name = dynString(symbolTable[symIdx].st_name);
+                return names ? (*names)(symIdx, name) : name;
+              }))
+            continue;
+          const char *name = symName(rel.r_info);
+          if (names) name = (*names)(symIdx, name);
+          buffer.put("  ").dec(table.first + i).put(") 0x").hex(fileOffset);
+          buffer.put(", ");
+          dumpReloc(rel, name, buffer);
+          buffer.put('\n');
+        }
+      };
+      formatChunks(end - begin, out, print);
+    }
+  }
+
+  void dumpRelocs(const RelocFilter &filter, TextBuffer &out) const override {
+    std::unique_ptr<SymbolNames> names;
+    if (demangleOn) names = std::make_unique<SymbolNames>(symbolTable.size());
+    if (!relocs.empty()) {
+      out.put("Dynamic relocs (").dec(relocs.size()).put(")\n");
+      out.put("ELFOffset, RelocOffset, RelocInfo, SymName\n");
+      dumpEntries(relocs, false, filter, names.get(), out);
+    }
+
+    if (!relocsAddends.empty()) {
+      out.put("Dynamic or PLT relocs with addends (");
+      out.dec(relocsAddends.size()).put(")\n");
+      out.put("ELFOffset, RelocOffset, RelocInfo, RelocAddend, SymName\n");
+      dumpEntries(relocsAddends, true, filter, names.get(), out);
+    }
+  }
+
+  // Pick an index of a table with the cumulative weights 'cum'.
+  static size_t pickWeighted(const std::vector<double> &cum) {
+    const double x = rand() / (RAND_MAX + 1.0) * cum.back();
+    const auto it = std::upper_bound(cum.begin(), cum.end(), x);
+    return std::min<size_t>(it - cum.begin(), cum.size() - 1);
+  }
+
+  void setSwapWeights(const std::vector<double> &weights) override {
+    assert(weights.size() == relocs.size() + relocsAddends.size() &&
+           "Invalid weights.");
+    relWeights.assign(relocs.size(), 0);
+    relaWeights.assign(relocsAddends.size(), 0);
+    size_t k = 0;
+    for (const auto &table : relocTables)
+      for (size_t i = table.first; i < table.first + table.count; ++i)
+        (table.withAddends ? relaWeights : relWeights)[i] = weights[k++];
+    std::partial_sum(relWeights.begin(), relWeights.end(), relWeights.begin());
+    std::partial_sum(relaWeights.begin(), relaWeights.end(),
+                     relaWeights.begin());
+  }
+
+  SwapPlan planSwaps(int n, std::string *log) const override {
+    assert(n > 0 && "Invalid input.");
+    TraceSpan span("planSwaps");
+    std::vector<Swap> relSwaps, relaSwaps;
+    const bool weighted = !relWeights.empty() || !relaWeights.empty();
+    const double relTotal = relWeights.empty() ? 0 : relWeights.back();
+    const double relaTotal = relaWeights.empty() ? 0 : relaWeights.back();
+    if (weighted && relTotal + relaTotal <= 0) return {};
+    for (int i = 0; i < n; ++i) {
+      bool useRelocs = false;
+      if (weighted)  // Choose the table by its share of the weight.
+        useRelocs = rand() / (RAND_MAX + 1.0) * (relTotal + relaTotal) <
+                    relTotal;
+      else if (!relocs.empty() && !relocsAddends.empty())
+        useRelocs = rand() % 2;
+      else if (!relocs.empty())
+        useRelocs = true;
+      else if (!relocsAddends.empty())
+        useRelocs = false;
+      else  // Both sets are empty.
+        return {};
+
+      // Choose what reloc collection to use.
+      if (useRelocs) {  // Swap 2 relocs.
+        const size_t aIdx =
+            weighted ? pickWeighted(relWeights) : rand() % relocs.size();
+        const size_t bIdx =
+            weighted ? pickWeighted(relWeights) : rand() % relocs.size();
+        relSwaps.emplace_back(aIdx, bIdx);
+        if (log)
+          *log += "Swapped reloc " + std::to_string(aIdx) + " with " +
+                  std::to_string(bIdx) + "\n";
+      } else {  // Else, swap 2 relocs with addends.
+        const size_t aIdx = weighted ? pickWeighted(relaWeights)
+                                     : rand() % relocsAddends.size();
+        const size_t bIdx = weighted ? pickWeighted(relaWeights)
+                                     : rand() % relocsAddends.size();
+        relaSwaps.emplace_back(aIdx, bIdx);
+        if (log)
+          *log += "Swapped reloc with addend " + std::to_string(aIdx) +
+                  " with " + std::to_string(bIdx) + "\n";
+      }
+    }
+
+    return {composeSwaps(relSwaps), composeSwaps(relaSwaps)};
+  }
+
+  void applySwaps(PatchSink &output, const SwapPlan &plan) const override {
+    TraceSpan span("applySwaps");
+    // Each slot keeps its r_info, and takes the r_offset (and r_addend) of its
+    // source entry.
+    std::vector<Patch> batch;
+    batch.reserve(plan.rel.size() + plan.rela.size());
+    for (const auto &[slot, src] : plan.rel) {
+      if (slot >= relocs.size() || src >= relocs.size())
+        errExit("Swap plan does not match the relocs.");
+      RelT rel = relocs[slot].second;
+      rel.r_offset = relocs[src].second.r_offset;
+      batch.emplace_back(relocs[slot].first,
+                         std::string((char *)&rel, sizeof(RelT)));
+    }
+    for (const auto &[slot, src] : plan.rela) {
+      if (slot >= relocsAddends.size() || src >= relocsAddends.size())
+        errExit("Swap plan does not match the relocs with addends.");
+      RelaT rela = relocsAddends[slot].second;
+      rela.r_offset = relocsAddends[src].second.r_offset;
+      rela.r_addend = relocsAddends[src].second.r_addend;
+      batch.emplace_back(relocsAddends[slot].first,
+                         std::string((char *)&rela, sizeof(RelaT)));
+    }
+    std::sort(batch.begin(), batch.end());
+    output.write(batch);
+  }
+
+  bool isSection(size_t idx, const std::string &name) const {
+    return (idx < sectionStringTable.size()) &&
+           (name == &sectionStringTable[idx]);
+  }
+
+  void parse(std::istream &fp) override {
+    assert(fp && "Invalid fp state.");
+
+    // Read the header.
+    EhdrT &hdr = header;
+    fp.read((char *)&hdr, sizeof(EhdrT));
+    if (!fp) errExit("Failed to read ELF header.");
+
+    // Read the section string table and the program headers.
+    addSectionStringTable(fp, hdr);
+    addProgramHeaders(fp, hdr);
+
+    // Read the sections.
+    fp.seekg(hdr.e_shoff);
+    for (size_t i = 0; i < hdr.e_shnum; ++i) {
+      ShdrT shdr;
+      const auto shdrOffset = fp.tellg();
+      fp.read((char *)&shdr, sizeof(ShdrT));
+      if (!fp) errExit("Failed to read section header.");
+
+      // Read in specific sections.
+      if ((shdr.sh_type == SHT_REL || shdr.sh_type == SHT_RELA) &&
+          (isSection(shdr.sh_name, ".rel.dyn") ||
+           isSection(shdr.sh_name, ".rela.dyn") ||
+           isSection(shdr.sh_name, ".rela.plt")))
+        addRels(fp, shdr);
+      else if (shdr.sh_type == SHT_STRTAB && isSection(shdr.sh_name, ".dynstr"))
+        addStringTable(fp, shdr);
+      else if (shdr.sh_type == SHT_DYNSYM && isSection(shdr.sh_name, ".dynsym"))
+        addSymbolTable(fp, shdr);
+      else if (shdr.sh_type == SHT_DYNAMIC)
+        addDynamic(fp, shdr);
+
+      const char *name = shdr.sh_name < sectionStringTable.size()
+                             ? &sectionStringTable[shdr.sh_name]
+                             : "";
+      sectionHeaders.push_back({name, shdr.sh_name, (uint64_t)shdrOffset,
+                                shdr.sh_type, shdr.sh_flags, shdr.sh_addr,
+                                shdr.sh_offset, shdr.sh_size, shdr.sh_entsize,
+                                shdr.sh_addralign, shdr.sh_link,
+                                shdr.sh_info});
+    }
+  }
+};
+
+using Elf32 = ElfT<Elf32_Ehdr, Elf32_Phdr, Elf32_Shdr, Elf32_Rel, Elf32_Rela,
+                   Elf32_Sym, Elf32_Dyn>;
+using Elf64 = ElfT<Elf64_Ehdr, Elf64_Phdr, Elf64_Shdr, Elf64_Rel, Elf64_Rela,
+                   Elf64_Sym, Elf64_Dyn>;
+}  // namespace
+
+Elf *parseElf(std::istream &fp) {
+  assert(fp && "Invalid input.");
+  TraceSpan span("parse");
+  char buf[EI_NIDENT] = {0};
+  fp.read(buf, EI_NIDENT);
+  if (!fp || (memcmp(buf, ELFMAG, SELFMAG) != 0) ||
+      (buf[EI_CLASS] != ELFCLASS32 && buf[EI_CLASS] != ELFCLASS64))
+    errExit("Failed to read ELF header.");
+  fp.seekg(0);
+
+  Elf *elf;
+  if (buf[EI_CLASS] == ELFCLASS32)
+    elf = new Elf32();
+  else
+    elf = new Elf64();
+  elf->parse(fp);
+
+  return elf;
+}
@@ -0,0 +1,186 @@
+#ifndef RELOCSWAP_ELFFILE_H
+#define RELOCSWAP_ELFFILE_H
+
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+[[noreturn]] void errExit(std::string msg);
+
+// What errExit throws, rather than print and exit, inside a RecoverErrors.
+struct InputError : std::runtime_error {
+  using std::runtime_error::runtime_error;
+};
+
+// While alive, errExit on this thread throws InputError: a batch skips an
+// input it cannot read and goes on with the others.
+class RecoverErrors {
+  const bool outer;
+
+ public:
+  explicit RecoverErrors(bool on = true);
+  ~RecoverErrors();
+  static bool active();
+};
+
+class PatchSink;
+class RelocFilter;
+class TextBuffer;
+
+// The following are widened to 64 bits so code outside of ElfT does not depend
+// on the ELF class of the input.
+struct Section {
+  std::string name;
+  uint32_t nameIdx;       // sh_name
+  uint64_t headerOffset;  // Offset of the section header in the file.
+  uint32_t type;
+  uint64_t flags;
+  uint64_t addr;
+  uint64_t offset;
+  uint64_t size;
+  uint64_t entSize;
+  uint64_t align;
+  uint32_t link;
+  uint32_t info;
+};
+
+struct Segment {
+  uint32_t type;
+  uint32_t flags;
+  uint64_t offset;
+  uint64_t vaddr;
+  uint64_t fileSize;
+  uint64_t memSize;
+};
+
+struct DynEntry {
+  int64_t tag;
+  uint64_t val;
+  uint64_t fileOffset;  // Offset of the entry in the file.
+};
+
+struct Symbol {
+  const char *name;
+  uint64_t value;
+  uint64_t size;
+  uint16_t shndx;
+  uint8_t info;
+  uint8_t other;
+};
+
+struct Reloc {
+  uint64_t fileOffset;  // Offset of the entry in the file.
+  uint64_t offset;      // r_offset
+  uint64_t info;        // r_info
+  int64_t addend;       // r_addend, 0 for SHT_REL entries.
+  uint32_t type;
+  uint32_t sym;
+  uint32_t section;  // Index into Elf::sections().
+};
+
+// Machine independent classification of dynamic reloc types.
+enum class RelocKind {
+  None,
+  Relative,
+  IRelative,
+  Copy,
+  JumpSlot,
+  GlobDat,
+  Other,  // Any other type, most of which need a symbol lookup.
+};
+
+RelocKind relocKind(uint16_t machine, uint32_t type);
+uint32_t relativeType(uint16_t machine);  // 0 if the machine is unknown.
+// The name readelf gives a reloc type, or nullptr if unknown.
+const char *relocTypeName(uint16_t machine, uint32_t type);
+// The type readelf calls 'name', with or without the machine's "R_..._"
+// prefix.  False if there is none.
+bool relocTypeByName(uint16_t machine, const std::string &name,
+                     uint32_t &type);
+
+// Swap sequences: each pair of indices is a transposition of a reloc table.
+using Swap = std::pair<size_t, size_t>;
+std::vector<Swap> composeSwaps(const std::vector<Swap> &swaps);
+
+// The composed swaps of a variant, for the Rel and the Rela relocs: (slot,
+// src) pairs sorted by slot, as returned by composeSwaps.
+struct SwapPlan {
+  std::vector<Swap> rel, rela;
+};
+
+struct Elf {
+  virtual ~Elf() = default;
+  // Print the relocs 'filter' lets through to 'out'.
+  virtual void dumpRelocs(const RelocFilter &filter, TextBuffer &out) const = 0;
+  // Choose 'n' pseudo-random swaps, adding a line for each to 'log' if not
+  // null.
+  virtual SwapPlan planSwaps(int n, std::string *log) const = 0;
+  // Write the relocs moved by 'plan' to 'output', a copy of this file, as one
+  // batch.
+  virtual void applySwaps(PatchSink &output, const SwapPlan &plan) const = 0;
+  // Weights for choosing the relocs planSwaps swaps, one per entry of
+  // relocations(); a reloc of weight 0 is never swapped.  Without weights
+  // every reloc is equally likely.
+  virtual void setSwapWeights(const std::vector<double> &weights) = 0;
+  virtual void parse(std::istream &fp) = 0;
+
+  virtual bool is64() const = 0;
+  virtual uint16_t type() const = 0;
+  virtual uint16_t machine() const = 0;
+  virtual const std::vector<Section> &sections() const = 0;
+  virtual const std::vector<Segment> &segments() const = 0;
+  virtual const std::vector<DynEntry> &dynamic() const = 0;
+
+  // The dynamic relocs, grouped by section, in file order.  Decoded on the
+  // first call.
+  virtual const std::vector<Reloc> &relocations() const = 0;
+  // Indexes of relocations() by r_offset, relocs of the same address in file
+  // order.  Sorted on the first call.
+  virtual const std::vector<uint32_t> &relocsByOffset() const = 0;
+  // Whether the dynamic reloc section 'section' is sorted by r_offset, as
+  // found while decoding it, or nullopt if it is not one of those decoded.
+  virtual std::optional<bool> relocsSorted(uint32_t section) const = 0;
+  virtual size_t symbolCount() const = 0;
+  virtual Symbol symbol(size_t idx) const = 0;
+  virtual std::string relocSymName(uint64_t rInfo) const = 0;
+  // A string of .dynstr, or "" if 'offset' is out of range.
+  virtual const char *dynString(uint64_t offset) const = 0;
+
+  // Encode entries in the ELF class of this file.
+  virtual std::string encodeReloc(const Reloc &rel, bool withAddend) const = 0;
+  virtual std::string encodeDyn(const DynEntry &dyn) const = 0;
+  virtual std::string encodeSection(const Section &sec) const = 0;
+  // The ELF header with its section header table fields replaced.
+  virtual std::string encodeHeader(uint64_t shoff, uint16_t shnum) const = 0;
+
+  const Section *findSection(const std::string &name) const;
+  const DynEntry *findDyn(int64_t tag) const;
+  // Linked with -z now: the loader binds every PLT reloc at load time.
+  bool bindNow() const;
+  // Map a virtual address to its offset in the file, false if unmapped.
+  bool addrToOffset(uint64_t addr, uint64_t &offset) const;
+};
+
+Elf *parseElf(std::istream &fp);
+
+// Read 'size' bytes at 'offset' of 'in', exiting on failure.
+std::string readBytes(std::istream &in, uint64_t offset, uint64_t size);
+// The GNU build-id of 'elf' read from 'in', in hex, or "" if it has none.
+std::string readBuildId(std::istream &in, const Elf &elf);
+// Decode the addresses of a SHT_RELR section's contents.
+std::vector<uint64_t> decodeRelr(const std::string &data, unsigned wordSize);
+
+// Set 'tag' to 'val' in a copy of Elf::dynamic(), using a spare DT_NULL if the
+// tag is not present.  Returns false if there is no room.
+bool setDynEntry(std::vector<DynEntry> &dyn, int64_t tag, uint64_t val);
+// Remove 'tag', if present, keeping the array terminated.
+void removeDynEntry(std::vector<DynEntry> &dyn, int64_t tag);
+// Write the entries of 'dyn' to their offsets in 'output'.
+void writeDynamic(const Elf &elf, PatchSink &output,
+                  const std::vector<DynEntry> &dyn);
+
+#endif  // RELOCSWAP_ELFFILE_H
@@ -0,0 +1,87 @@
+#include "filter.h"
+
+#include <cstdlib>
+
+namespace {
+struct KindName {
+  const char *name;
+  RelocKind kind;
+};
+constexpr KindName kindNames[] = {
+    {"RELATIVE", RelocKind::Relative}, {"IRELATIVE", RelocKind::IRelative},
+    {"COPY", RelocKind::Copy},         {"JUMP_SLOT", RelocKind::JumpSlot},
+    {"GLOB_DAT", RelocKind::GlobDat},
+};
+}  // namespace
+
+void RelocFilter::addRange(const std::string &range) {
+  const size_t dash = range.find('-');
+  char *end;
+  const uint64_t begin = std::strtoull(range.c_str(), &end, 16);
+  if (dash == std::string::npos || end != range.c_str() + dash)
+    errExit("Error: an address range is BEGIN-END, in hex: " + range);
+  const uint64_t last = std::strtoull(range.c_str() + dash + 1, &end, 16);
+  if (*end || dash + 1 == range.size())
+    errExit("Error: an address range is BEGIN-END, in hex: " + range);
+  ranges.emplace_back(begin, last);
+}
+
+void RelocFilter::bind(const Elf &elf) {
+  machine = elf.machine();
+  types.clear();
+  kinds.clear();
+  for (const auto &name : typeNames) {
+    bool found = false;
+    for (const auto &k : kindNames)
+      if (name == k.name) {
+        kinds.push_back(k.kind);
+        found = true;
+      }
+    uint32_t type;
+    char *end;
+    const unsigned long number = std::strtoul(name.c_str(), &end, 0);
+    if (relocTypeByName(machine, name, type)) {
+      types.push_back(type);
+    } else if (!name.empty() && !*end) {
+      types.push_back(number);
+    } else if (!found) {
+      errExit("Error: no reloc type " + name + " on machine " +
+              std::to_string(machine));
+    }
+  }
+
+  for (const auto &name : sectionNames) {
+    const Section *sec = elf.findSection(name);
+    if (!sec) errExit("Error: no section " + name);
+    ranges.emplace_back(sec->addr, sec->addr + sec->size);
+  }
+  sectionNames.clear();
+
+  std::string pattern;
+  for (const auto &p : patterns)
+    pattern += (pattern.empty() ? "(?:" : "|(?:") + p + ")";
+  if (!patterns.empty()) {
+    try {
+      symbolRegex.reset(new std::regex(pattern, std::regex::optimize));
+    } catch (const std::regex_error &e) {
+      errExit("Error: bad symbol regex " + pattern + ": " + e.what());
+    }
+  }
+  symbolMatches.clear();
+}
+
+void RelocFilter::addSymbols(uint32_t table, size_t count) const {
+  if (!symbolRegex) return;
+  auto &matches = symbolMatches[table];
+  if (count <= matches.count) return;
+  matches.state.reset(new std::atomic<int8_t>[count]());
+  matches.count = count;
+}
+
+bool RelocFilter::matchType(uint32_t type) const {
+  if (typeNames.empty()) return true;
+  if (std::find(types.begin(), types.end(), type) != types.end()) return true;
+  if (kinds.empty()) return false;
+  const RelocKind kind = relocKind(machine, type);
+  return std::find(kinds.begin(), kinds.end(), kind) != kinds.end();
+}
@@ -0,0 +1,121 @@
+#ifndef RELOCSWAP_FILTER_H
+#define RELOCSWAP_FILTER_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "elffile.h"
+
+// The relocs a dump prints.  Conditions of one kind are alternatives, and an
+// entry must meet a condition of each kind given.  The checks are ordered by
+// cost for dumps to skip entries before decoding or formatting them: the type
+// from r_info, then r_offset, then the symbol name, matched once per symbol.
+class RelocFilter {
+  std::vector<std::string> typeNames;
+  std::vector<std::string> patterns;
+  std::vector<std::string> sectionNames;
+  std::vector<std::pair<uint64_t, uint64_t>> ranges;  // [begin, end)
+
+  // Bound to a file by bind().
+  uint16_t machine = 0;
+  std::vector<uint32_t> types;
+  std::vector<RelocKind> kinds;
+  std::unique_ptr<std::regex> symbolRegex;
+  // Whether each symbol matched, by symbol table and index: 0 if not checked
+  // yet, 1 if not, 2 if it did.  Workers formatting chunks of a table share
+  // them.
+  struct SymbolMatches {
+    size_t count = 0;
+    std::unique_ptr<std::atomic<int8_t>[]> state;
+  };
+  mutable std::unordered_map<uint64_t, SymbolMatches> symbolMatches;
+
+ public:
+  // NAME as readelf prints it, with or without the "R_..._" prefix, a number,
+  // or RELATIVE, IRELATIVE, COPY, JUMP_SLOT or GLOB_DAT on any machine.
+  void addType(const std::string &name) { typeNames.push_back(name); }
+  // Symbols whose name contains a match of the ECMAScript 'regex'.
+  void addSymbol(const std::string &regex) { patterns.push_back(regex); }
+  // Relocs of the addresses in section 'name'.
+  void addSection(const std::string &name) { sectionNames.push_back(name); }
+  // Relocs of the addresses in "BEGIN-END", in hex, END excluded.
+  void addRange(const std::string &range);
+
+  bool empty() const {
+    return typeNames.empty() && patterns.empty() && sectionNames.empty() &&
+           ranges.empty();
+  }
+  bool filtersSymbols() const { return symbolRegex != nullptr; }
+
+  // Resolve the names of types and sections in 'elf', exiting if unknown.
+  void bind(const Elf &elf);
+
+  bool matchType(uint32_t type) const;
+  bool matchOffset(uint64_t offset) const {
+    if (ranges.empty()) return true;
+    for (const auto &[begin, end] : ranges)
+      if (offset >= begin && offset < end) return true;
+    return false;
+  }
+  // Make room for the results of the 'count' symbols of the symbol table of
+  // section 'table', before matchSymbol is called on them.
+  void addSymbols(uint32_t table, size_t count) const;
+  // 'name' is called for the name of symbol 'idx' of the symbol table of
+  // section 'table' the first time that symbol is checked.  Symbol 0 never
+  // matches a symbol condition.  Safe to call from several threads.
+  template <class NameFn>
+  bool matchSymbol(uint32_t table, uint64_t idx, NameFn name) const {
+    if (!symbolRegex) return true;
+    if (idx == 0) return false;
+    const auto it = symbolMatches.find(table);
+    if (it == symbolMatches.end() || idx >= it->second.count)
+      return std::regex_search((const char *)name(), *symbolRegex);
+    auto &state = it->second.state[idx];
+    int8_t match = state.load(std::memory_order_relaxed);
+    if (!match) {
+      match = std::regex_search((const char *)name(), *symbolRegex) ? 2 : 1;
+      state.store(match, std::memory_order_relaxed);
+    }
+    return match == 2;
+  }
+
+  // The entries [first, last) of a table of 'n' relocs that may meet the
+  // address conditions, with offsetAt(i) the r_offset of entry i.  Tables
+  // sorted by r_offset, as most are, are cut down to the addresses wanted.
+  // 'sorted' is what the parse found (Elf::relocsSorted), or nullopt to check
+  // the table here.
+  template <class OffsetAt>
+  std::pair<size_t, size_t> candidates(size_t n, OffsetAt offsetAt,
+                                       std::optional<bool> sorted) const {
+    if (ranges.empty() || n == 0) return {0, n};
+    if (sorted && !*sorted) return {0, n};
+    for (size_t i = 1; !sorted && i < n; ++i)
+      if (offsetAt(i) < offsetAt(i - 1)) return {0, n};
+    uint64_t lo = UINT64_MAX, hi = 0;
+    for (const auto &[begin, end] : ranges)
+      lo = std::min(lo, begin), hi = std::max(hi, end);
+    // The first entry from 'from' with an offset of at least 'bound'.
+    auto lowerBound = [&](size_t from, uint64_t bound) {
+      for (size_t count = n - from; count > 0;) {
+        const size_t half = count / 2;
+        if (offsetAt(from + half) < bound)
+          from += half + 1, count -= half + 1;
+        else
+          count = half;
+      }
+      return from;
+    };
+    const size_t first = lowerBound(0, lo);
+    return {first, lowerBound(first, hi)};
+  }
+};
+
+#endif  // RELOCSWAP_FILTER_H
@@ -0,0 +1,132 @@
+#include "footprint.h"
+
+#include <elf.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+#include "demangle.h"
+#include "radix.h"
+
+namespace {
+constexpr uint64_t pageSize = 4096;
+constexpr size_t topCount = 5;
+
+// Count the distinct pages of each key in (key, page) pairs, in page order,
+// and return the names of the keys with the most pages.
+template <class NameFn>
+std::vector<std::pair<std::string, uint64_t>> topPages(
+    std::vector<std::pair<uint32_t, uint64_t>> &keyPages, NameFn name) {
+  radixSort(keyPages, [](const auto &p) { return (uint64_t)p.first; });
+  keyPages.erase(std::unique(keyPages.begin(), keyPages.end()),
+                 keyPages.end());
+  std::vector<std::pair<uint32_t, uint64_t>> counts;
+  for (const auto &[key, page] : keyPages) {
+    if (counts.empty() || counts.back().first != key)
+      counts.emplace_back(key, 0);
+    ++counts.back().second;
+  }
+  std::stable_sort(counts.begin(), counts.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.second > b.second;
+                   });
+  std::vector<std::pair<std::string, uint64_t>> top;
+  for (size_t i = 0; i < counts.size() && i < topCount; ++i)
+    top.emplace_back(name(counts[i].first), counts[i].second);
+  return top;
+}
+}  // namespace
+
+Footprint computeFootprint(const std::string &path, const Elf &elf) {
+  Footprint fp;
+  const DynEntry *flags = elf.findDyn(DT_FLAGS);
+  fp.textRel = elf.findDyn(DT_TEXTREL) || (flags && (flags->val & DF_TEXTREL));
+
+  // Every target address, with the symbol relocated there (0 for none), by
+  // address.
+  std::vector<std::pair<uint64_t, uint32_t>> targets;
+  const std::vector<Reloc> &relocs = elf.relocations();
+  for (uint32_t i : elf.relocsByOffset())
+    targets.emplace_back(relocs[i].offset, relocs[i].sym);
+  for (const auto &sec : elf.sections()) {
+    if (sec.type != SHT_RELR) continue;
+    std::ifstream in(path, std::ios::binary);
+    const size_t middle = targets.size();
+    for (uint64_t addr : decodeRelr(readBytes(in, sec.offset, sec.size),
+                                    elf.is64() ? 8 : 4))
+      targets.emplace_back(addr, 0);
+    // RELR encodes increasing addresses, unless the file is broken.
+    auto byAddr = [](const auto &a, const auto &b) {
+      return a.first < b.first;
+    };
+    if (!std::is_sorted(targets.begin() + middle, targets.end(), byAddr))
+      std::sort(targets.begin() + middle, targets.end(), byAddr);
+    std::inplace_merge(targets.begin(), targets.begin() + middle,
+                       targets.end(), byAddr);
+  }
+
+  // Allocated sections by address, to attribute each target.
+  const auto &sections = elf.sections();
+  std::vector<uint32_t> allocated;
+  for (uint32_t i = 0; i < sections.size(); ++i)
+    if (sections[i].flags & SHF_ALLOC) allocated.push_back(i);
+  std::sort(allocated.begin(), allocated.end(), [&](uint32_t a, uint32_t b) {
+    return sections[a].addr < sections[b].addr;
+  });
+  const uint32_t noSection = sections.size();
+  auto sectionAt = [&](uint64_t addr) {
+    auto it = std::upper_bound(
+        allocated.begin(), allocated.end(), addr,
+        [&](uint64_t a, uint32_t idx) { return a < sections[idx].addr; });
+    if (it == allocated.begin()) return noSection;
+    const Section &sec = sections[*--it];
+    return addr < sec.addr + std::max<uint64_t>(sec.size, 1) ? *it
+                                                             : noSection;
+  };
+
+  std::vector<uint64_t> pages;
+  std::vector<std::pair<uint32_t, uint64_t>> bySection, bySymbol;
+  for (const auto &[addr, sym] : targets) {
+    uint64_t fileOffset;
+    if (!elf.addrToOffset(addr, fileOffset))
+      continue;  // Anonymous memory (.bss) is private anyway.
+    const uint64_t page = addr / pageSize;
+    pages.push_back(page);
+    bySection.emplace_back(sectionAt(addr), page);
+    if (sym && sym < elf.symbolCount()) bySymbol.emplace_back(sym, page);
+  }
+  pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+  for (uint64_t page : pages) {
+    const uint64_t addr = page * pageSize;
+    for (const auto &seg : elf.segments()) {
+      // A page is RELRO or text if the segment covers any of its bytes.
+      if (addr + pageSize <= seg.vaddr || addr >= seg.vaddr + seg.memSize)
+        continue;
+      if (seg.type == PT_GNU_RELRO) ++fp.relroPages;
+      if (seg.type == PT_LOAD && !(seg.flags & PF_W)) ++fp.textPages;
+    }
+  }
+  fp.pages = pages.size();
+  fp.sections = topPages(bySection, [&](uint32_t idx) {
+    return idx < sections.size() ? sections[idx].name : "(none)";
+  });
+  fp.symbols = topPages(bySymbol, [&](uint32_t idx) {
+    return std::string(elf.symbol(idx).name);
+  });
+  return fp;
+}
+
+void printFootprint(const std::string &path, const Footprint &fp) {
+  std::cout << path << ": " << fp.pages << " dirty pages ("
+            << fp.pages * pageSize / 1024 << " KiB), " << fp.relroPages
+            << " RELRO, " << fp.textPages << " text"
+            << (fp.textRel ? ", DT_TEXTREL" : "") << std::endl;
+  for (const auto &[name, pages] : fp.sections)
+    std::cout << "  section " << name << ": " << pages << " pages"
+              << std::endl;
+  for (const auto &[name, pages] : fp.symbols)
+    std::cout << "  symbol " << demangle(name) << ": " << pages << " pages"
+              << std::endl;
+}
@@ -0,0 +1,26 @@
+#ifndef RELOCSWAP_FOOTPRINT_H
+#define RELOCSWAP_FOOTPRINT_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "elffile.h"
+
+// The pages a binary's dynamic relocs make private and dirty in every process
+// that loads it.
+struct Footprint {
+  uint64_t pages = 0;       // Distinct file backed pages written by relocs.
+  uint64_t relroPages = 0;  // Those of 'pages' covered by PT_GNU_RELRO.
+  uint64_t textPages = 0;   // Those of 'pages' in non-writable segments.
+  bool textRel = false;     // DT_TEXTREL or DF_TEXTREL is set.
+  // Pages dirtied, by section and by symbol, most first.
+  std::vector<std::pair<std::string, uint64_t>> sections;
+  std::vector<std::pair<std::string, uint64_t>> symbols;
+};
+
+Footprint computeFootprint(const std::string &path, const Elf &elf);
+void printFootprint(const std::string &path, const Footprint &fp);
+
+#endif  // RELOCSWAP_FOOTPRINT_H
@@ -0,0 +1,74 @@
+#include "format.h"
+
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <cstring>
+
+#include "elffile.h"
+
+void TextBuffer::flush() {
+  if (fd < 0) return;
+  for (size_t done = 0; done < text.size();) {
+    const ssize_t n = write(fd, text.data() + done, text.size() - done);
+    if (n <= 0) errExit("Failed to write the output.");
+    done += n;
+  }
+  text.clear();
+}
+
+TextBuffer &TextBuffer::put(const char *s) { return put(s, strlen(s)); }
+
+TextBuffer &TextBuffer::left(const char *s, size_t width) {
+  const size_t n = strnlen(s, width);
+  text.append(s, n);
+  return spaces(width - n);
+}
+
+TextBuffer &TextBuffer::hex(uint64_t v, unsigned width) {
+  static const char digits[] = "0123456789abcdef";
+  char buf[16];
+  unsigned n = 0;
+  do {
+    buf[15 - n++] = digits[v & 15];
+    v >>= 4;
+  } while (v);
+  if (width > n) text.append(width - n, '0');
+  return put(buf + 16 - n, n);
+}
+
+TextBuffer &TextBuffer::dec(uint64_t v) {
+  char buf[20];
+  unsigned n = 0;
+  do {
+    buf[19 - n++] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+  return put(buf + 20 - n, n);
+}
+
+void TextBuffer::putChunks(const TextBuffer *chunks, size_t count) {
+  if (fd < 0) {
+    for (size_t i = 0; i < count; ++i) text += chunks[i].text;
+    return;
+  }
+  flush();
+  std::vector<iovec> iov;
+  for (size_t i = 0; i < count; ++i)
+    if (!chunks[i].text.empty())
+      iov.push_back({(void *)chunks[i].text.data(), chunks[i].text.size()});
+  for (size_t i = 0; i < iov.size();) {
+    const ssize_t n =
+        writev(fd, &iov[i], std::min<size_t>(iov.size() - i, IOV_MAX));
+    if (n <= 0) errExit("Failed to write the output.");
+    // Skip what was written, resuming within a chunk after a short write.
+    for (size_t done = n; done;) {
+      const size_t step = std::min(done, iov[i].iov_len);
+      iov[i].iov_base = (char *)iov[i].iov_base + step;
+      iov[i].iov_len -= step;
+      done -= step;
+      if (!iov[i].iov_len) ++i;
+    }
+  }
+}
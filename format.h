@@ -0,0 +1,92 @@
+#ifndef RELOCSWAP_FORMAT_H
+#define RELOCSWAP_FORMAT_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "batch.h"
+
+// Text formatting for dumps of millions of lines: appends to a string without
+// the locale and state handling of iostreams, and writes it to 'fd' in large
+// blocks.  With 'fd' -1 the text is only collected.
+class TextBuffer {
+  int fd;
+  std::string text;
+
+ public:
+  static constexpr size_t blockSize = 1 << 16;
+
+  explicit TextBuffer(int fd = -1) : fd(fd) {
+    if (fd >= 0) text.reserve(2 * blockSize);
+  }
+  ~TextBuffer() { flush(); }
+  TextBuffer(const TextBuffer &) = delete;
+  TextBuffer &operator=(const TextBuffer &) = delete;
+
+  // Write the text collected so far, if writing to a file.
+  void flush();
+  const std::string &str() const { return text; }
+  std::string take() { return std::move(text); }
+  void clear() { text.clear(); }
+
+  TextBuffer &put(char c) {
+    text.push_back(c);
+    if (text.size() >= blockSize && fd >= 0) flush();
+    return *this;
+  }
+  TextBuffer &put(const char *s, size_t n) {
+    text.append(s, n);
+    if (text.size() >= blockSize && fd >= 0) flush();
+    return *this;
+  }
+  TextBuffer &put(const std::string &s) { return put(s.data(), s.size()); }
+  TextBuffer &put(const char *s);
+  TextBuffer &spaces(size_t n) {
+    text.append(n, ' ');
+    return *this;
+  }
+  // 's' left aligned in 'width' columns, cut to 'width' if longer.
+  TextBuffer &left(const char *s, size_t width);
+  // Lower case hex, zero padded to 'width' digits.
+  TextBuffer &hex(uint64_t v, unsigned width = 1);
+  TextBuffer &dec(uint64_t v);
+
+  // Append the text of the 'count' buffers 'chunks' in order, written with
+  // writev if writing to a file.
+  void putChunks(const TextBuffer *chunks, size_t count);
+};
+
+// Put the text of 'n' entries to 'out' as fn(begin, end, buffer) formats the
+// entries [begin, end) into 'buffer'.  On more than one core, large tables
+// are cut into chunks formatted by a pool of workers, two chunks per worker
+// at a time, and put in order, so the text is that of a serial dump.
+template <class Fn>
+void formatChunks(size_t n, TextBuffer &out, Fn fn) {
+  constexpr size_t chunkSize = 1 << 12;
+  const unsigned jobs = std::thread::hardware_concurrency();
+  if (n <= chunkSize || jobs < 2) {
+    fn(0, n, out);
+    return;
+  }
+  // The buffers are kept from window to window, their pages faulted in once.
+  const size_t window = 2 * jobs;
+  std::vector<TextBuffer> chunks(window);
+  for (size_t first = 0; first < n; first += chunkSize * window) {
+    const size_t count =
+        std::min(window, (n - first + chunkSize - 1) / chunkSize);
+    parallelFor(
+        count,
+        [&](size_t c) {
+          const size_t begin = first + c * chunkSize;
+          chunks[c].clear();
+          fn(begin, std::min(n, begin + chunkSize), chunks[c]);
+        },
+        jobs);
+    out.putChunks(chunks.data(), count);
+  }
+}
+
+#endif  // RELOCSWAP_FORMAT_H
@@ -0,0 +1,79 @@
+#include "interpose.h"
+
+#include <elf.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+
+#include "demangle.h"
+
+namespace {
+constexpr size_t topCount = 10;
+
+bool isOwnExport(const Symbol &sym) {
+  const unsigned bind = ELF64_ST_BIND(sym.info);
+  return sym.shndx != SHN_UNDEF && sym.shndx != SHN_ABS &&
+         (bind == STB_GLOBAL || bind == STB_WEAK) &&
+         ELF64_ST_VISIBILITY(sym.other) == STV_DEFAULT;
+}
+
+bool isFunction(const Symbol &sym) {
+  const unsigned type = ELF64_ST_TYPE(sym.info);
+  return type == STT_FUNC || type == STT_GNU_IFUNC;
+}
+}  // namespace
+
+Interposition analyzeInterposition(const std::string &, const Elf &elf) {
+  Interposition ip;
+  std::map<std::string, uint64_t> bySymbol;
+  // The loader skips a lookup when a reloc repeats the previous symbol.
+  uint32_t lastSym = 0;
+  for (const auto &rel : elf.relocations()) {
+    if (rel.sym == 0 || rel.sym >= elf.symbolCount()) continue;
+    const bool cached = rel.sym == lastSym;
+    lastSym = rel.sym;
+    ++ip.symbolRelocs;
+
+    const Symbol sym = elf.symbol(rel.sym);
+    const RelocKind kind = relocKind(elf.machine(), rel.type);
+    if (!isOwnExport(sym) || ELF64_ST_TYPE(sym.info) == STT_TLS ||
+        kind == RelocKind::Copy)
+      continue;
+    ++ip.ownRelocs;
+    ++bySymbol[sym.name];
+    if (isFunction(sym)) {
+      ++(kind == RelocKind::JumpSlot ? ip.funcSlotsRemoved : ip.funcToRelative);
+      ip.funcLookupsSaved += !cached;
+    } else {
+      ++ip.dataToRelative;
+      ip.dataLookupsSaved += !cached;
+    }
+  }
+
+  ip.ownSymbols = bySymbol.size();
+  ip.symbols.assign(bySymbol.begin(), bySymbol.end());
+  std::stable_sort(
+      ip.symbols.begin(), ip.symbols.end(),
+      [](const auto &a, const auto &b) { return a.second > b.second; });
+  return ip;
+}
+
+void printInterposition(const std::string &path, const Interposition &ip) {
+  std::cout << path << ": " << ip.ownRelocs << " of " << ip.symbolRelocs
+            << " symbol relocs bind " << ip.ownSymbols << " own exports"
+            << std::endl
+            << "  -Bsymbolic-functions: " << ip.funcSlotsRemoved
+            << " JUMP_SLOT removed, " << ip.funcToRelative
+            << " to RELATIVE, " << ip.funcLookupsSaved << " lookups saved"
+            << std::endl
+            << "  protected data:       " << ip.dataToRelative
+            << " to RELATIVE, " << ip.dataLookupsSaved << " more lookups saved"
+            << std::endl;
+  for (size_t i = 0; i < ip.symbols.size() && i < topCount; ++i)
+    std::cout << "  " << demangle(ip.symbols[i].first) << ": "
+              << ip.symbols[i].second << " relocs" << std::endl;
+  if (ip.symbols.size() > topCount)
+    std::cout << "  ... " << ip.symbols.size() - topCount << " more symbols"
+              << std::endl;
+}
@@ -0,0 +1,33 @@
+#ifndef RELOCSWAP_INTERPOSE_H
+#define RELOCSWAP_INTERPOSE_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "elffile.h"
+
+// Symbol relocs that bind a symbol the object defines itself, and would
+// become RELATIVE relocs or disappear if the object were linked with
+// -Bsymbolic-functions or its symbols had protected visibility.
+struct Interposition {
+  uint64_t symbolRelocs = 0;  // Relocs needing a symbol lookup.
+  uint64_t ownRelocs = 0;     // Of those, binding the object's own exports.
+  uint64_t ownSymbols = 0;    // Distinct exports bound by 'ownRelocs'.
+  // -Bsymbolic-functions: JUMP_SLOTs of own functions are removed, other
+  // relocs of own functions become RELATIVE.
+  uint64_t funcSlotsRemoved = 0;
+  uint64_t funcToRelative = 0;
+  uint64_t funcLookupsSaved = 0;
+  // Protected visibility for data as well: their relocs become RELATIVE.
+  uint64_t dataToRelative = 0;
+  uint64_t dataLookupsSaved = 0;
+  // Relocs by symbol, most first.
+  std::vector<std::pair<std::string, uint64_t>> symbols;
+};
+
+Interposition analyzeInterposition(const std::string &path, const Elf &elf);
+void printInterposition(const std::string &path, const Interposition &ip);
+
+#endif  // RELOCSWAP_INTERPOSE_H
@@ -0,0 +1,121 @@
+#include "loadstats.h"
+
+#include <elf.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+
+#include "spawn.h"
+
+// Seconds a run measured is given, and the loader output kept from it.
+constexpr double loaderTimeout = 5;
+constexpr size_t maxLoaderOutput = 1 << 20;
+
+static bool findCounter(const std::string &text, const char *label,
+                        uint64_t &value) {
+  const auto pos = text.find(label);
+  if (pos == std::string::npos) return false;
+  value = strtoull(text.c_str() + pos + strlen(label), nullptr, 10);
+  return true;
+}
+
+bool parseLoaderStats(const std::string &text, LoaderStats &stats) {
+  const auto start = text.find("runtime linker statistics:");
+  if (start == std::string::npos) return false;
+  // Only consider the startup block, not the one printed at exit.
+  const auto end = text.find("final number", start);
+  const std::string block = text.substr(start, end - start);
+  bool found = findCounter(block, "total startup time in dynamic loader:",
+                           stats.startupCycles);
+  findCounter(block, "time needed for relocation:", stats.relocCycles);
+  findCounter(block, "number of relocations:", stats.relocations);
+  findCounter(block, "number of relocations from cache:",
+              stats.relocationsFromCache);
+  findCounter(block, "number of relative relocations:",
+              stats.relativeRelocations);
+  return found;
+}
+
+bool runLoaderDebug(const std::vector<std::string> &argv, const char *debug,
+                    const std::vector<std::string> &env, std::string &err) {
+  if (argv.empty()) return false;
+  std::vector<std::string> vars = env;
+  vars.push_back(std::string("LD_DEBUG=") + debug);
+  // The loader's output is written before main, so programs that do not
+  // exit on their own are killed once it is in.
+  SpawnOptions opts;
+  opts.timeout = loaderTimeout;
+  opts.digest = true;
+  opts.headSize = maxLoaderOutput;
+  Process proc;
+  if (!runProcess(argv, vars, opts, proc)) return false;
+  err = std::move(proc.err.head);
+  return true;
+}
+
+static uint64_t median(std::vector<uint64_t> &values) {
+  std::nth_element(values.begin(), values.begin() + values.size() / 2,
+                   values.end());
+  return values[values.size() / 2];
+}
+
+LoaderStats medianStats(const std::vector<LoaderStats> &runs) {
+  assert(!runs.empty() && "No runs.");
+  LoaderStats result;
+  uint64_t LoaderStats::*counters[] = {
+      &LoaderStats::startupCycles, &LoaderStats::relocCycles,
+      &LoaderStats::relocations, &LoaderStats::relocationsFromCache,
+      &LoaderStats::relativeRelocations};
+  for (auto counter : counters) {
+    std::vector<uint64_t> values;
+    for (const auto &run : runs) values.push_back(run.*counter);
+    result.*counter = median(values);
+  }
+  return result;
+}
+
+bool measureLoader(const std::vector<std::string> &argv, int runs,
+                   LoaderStats &result, const std::vector<std::string> &env) {
+  std::vector<LoaderStats> measured;
+  for (int i = 0; i < runs; ++i) {
+    std::string err;
+    LoaderStats stats;
+    if (runLoaderDebug(argv, "statistics", env, err) &&
+        parseLoaderStats(err, stats))
+      measured.push_back(stats);
+  }
+  if (measured.empty()) return false;
+  result = medianStats(measured);
+  return true;
+}
+
+bool measureStartup(const Elf &elf, const char *fname, int runs,
+                    LoaderStats &median) {
+  const std::string path = std::filesystem::absolute(fname);
+  const bool hasInterp =
+      std::any_of(elf.segments().begin(), elf.segments().end(),
+                  [](const Segment &s) { return s.type == PT_INTERP; });
+  if (hasInterp && access(fname, X_OK) == 0)
+    return measureLoader({path}, runs, median);
+  if (elf.type() == ET_DYN)
+    return measureLoader({"/bin/true"}, runs, median, {"LD_PRELOAD=" + path});
+  return false;
+}
+
+void printStartup(int runs, const LoaderStats &before,
+                  const LoaderStats &after) {
+  std::cout << "Measured loader startup (median of " << runs << " runs)"
+            << std::endl;
+  for (const auto &[label, stats] : {std::make_pair("Before", &before),
+                                     std::make_pair("After ", &after)})
+    std::cout << "  " << label << ": " << stats->startupCycles << " cycles, "
+              << stats->relocCycles << " relocating, "
+              << stats->relocationsFromCache << " lookups from cache"
+              << std::endl;
+}
+
@@ -0,0 +1,49 @@
+#ifndef RELOCSWAP_LOADSTATS_H
+#define RELOCSWAP_LOADSTATS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "elffile.h"
+
+// Counters reported by the glibc dynamic loader with LD_DEBUG=statistics.
+struct LoaderStats {
+  uint64_t startupCycles = 0;
+  uint64_t relocCycles = 0;
+  uint64_t relocations = 0;
+  uint64_t relocationsFromCache = 0;
+  uint64_t relativeRelocations = 0;
+};
+
+// Parse the first statistics block of the loader's debug output.  Returns
+// false if 'text' contains none.
+bool parseLoaderStats(const std::string &text, LoaderStats &stats);
+
+// Run 'argv' once with LD_DEBUG set to 'debug', and the NAME=VALUE variables
+// of 'env', and return what it wrote to stderr in 'err'.  The program's stdin
+// is /dev/null, its stdout is discarded, and it is killed after a few
+// seconds.
+bool runLoaderDebug(const std::vector<std::string> &argv, const char *debug,
+                    const std::vector<std::string> &env, std::string &err);
+
+// The median of each counter over several runs.
+LoaderStats medianStats(const std::vector<LoaderStats> &runs);
+
+// Run 'argv' 'runs' times with the loader statistics enabled and store the
+// median of each counter in 'median'.  Returns false if no run reported
+// statistics.
+bool measureLoader(const std::vector<std::string> &argv, int runs,
+                   LoaderStats &median,
+                   const std::vector<std::string> &env = {});
+
+// Measure the loader startup with 'fname', parsed as 'elf': executables are
+// run without arguments, shared objects are preloaded into /bin/true.
+bool measureStartup(const Elf &elf, const char *fname, int runs,
+                    LoaderStats &median);
+
+// Print the startup statistics of a file before and after a rewrite.
+void printStartup(int runs, const LoaderStats &before,
+                  const LoaderStats &after);
+
+#endif  // RELOCSWAP_LOADSTATS_H
@@ -1,288 +1,488 @@
-#include <elf.h>
+#include <getopt.h>
 #include <unistd.h>
 
-#include <algorithm>
 #include <cassert>
-#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
-#include <memory>
 #include <string>
-#include <vector>
 
-[[noreturn]] static void errExit(std::string msg) {
-  std::cerr << msg << std::endl;
-  exit(EXIT_FAILURE);
-}
-
-struct Elf {
-  virtual void dumpRelocs() const = 0;
-  virtual void swapN(std::ofstream &output, int n) const = 0;
-  virtual void parse(std::ifstream &fp) = 0;
+#include "batch.h"
+#include "budget.h"
+#include "campaign.h"
+#include "census.h"
+#include "demangle.h"
+#include "elffile.h"
+#include "footprint.h"
+#include "interpose.h"
+#include "optimize.h"
+#include "pack.h"
+#include "profile.h"
+#include "readelf.h"
+#include "reach.h"
+#include "relr.h"
+#include "store.h"
+#include "trace.h"
+#include "watch.h"
+
+// Options without a short form.
+enum LongOpt {
+  optOptimizeOrder = 256,
+  optMeasureRuns,
+  optPackRelr,
+  optFootprint,
+  optWeights,
+  optInterposition,
+  optProfileLoad,
+  optBudgetCompare,
+  optThreshold,
+  optCensus,
+  optUnusedWeight,
+  optReach,
+  optRun,
+  optJobs,
+  optTimeout,
+  optNoPrefilter,
+  optKeep,
+  optBaselineRuns,
+  optAudit,
+  optPack,
+  optExtract,
+  optStore,
+  optGc,
+  optCachePolicy,
+  optTimings,
+  optQuiet,
+  optWatch,
+  optIndex,
+  optDebounce,
+  optQuery,
+  optTrace,
+  optFormat,
+  optType,
+  optSymbol,
+  optSection,
+  optAddress,
+  optDemangle,
 };
 
-template <class EhdrT, class ShdrT, class RelT, class RelaT, class SymT>
-class ElfT : public Elf {
-  // The uint64_t in each pair represents the offset in the file for that reloc.
-  std::vector<std::pair<uint64_t, RelT>> relocs;  // Relocs without addends.
-  std::vector<std::pair<uint64_t, RelaT>> relocsAddends;  // Relocs + addends.
-  std::vector<SymT> symbolTable;
-  std::vector<char> stringTable;
-  std::vector<char> sectionStringTable;
-
-  void addRels(std::ifstream &fp, const ShdrT &shdr) {
-    assert(fp && "Invalid input stream.");
-    assert((shdr.sh_type == SHT_REL || shdr.sh_type == SHT_RELA) &&
-           "Invalid section header.");
-    const auto pos = fp.tellg();
-
-    fp.seekg(shdr.sh_offset);
-
-    if (shdr.sh_type == SHT_REL) {
-      for (size_t i = 0; i < shdr.sh_size / shdr.sh_entsize; ++i) {
-        RelT rel;
-        const auto relOffset = fp.tellg();
-        fp.read((char *)&rel, sizeof(RelT));
-        if (!fp) errExit("Failed to read relocation.");
-        relocs.emplace_back(relOffset, rel);
-      }
-    } else {
-      for (size_t i = 0; i < shdr.sh_size / shdr.sh_entsize; ++i) {
-        RelaT relA;
-        const auto relAOffset = fp.tellg();
-        fp.read((char *)&relA, sizeof(RelaT));
-        if (!fp) errExit("Failed to read relocation.");
-        relocsAddends.emplace_back(relAOffset, relA);
-      }
-    }
-
-    fp.seekg(pos);
-  }
-
-  void addSectionStringTable(std::ifstream &fp, const EhdrT &hdr) {
-    assert(fp && "Invalid input stream.");
-    const auto pos = fp.tellg();
-
-    fp.seekg(hdr.e_shoff + (hdr.e_shstrndx * hdr.e_shentsize));
-    ShdrT shdr;
-    fp.read((char *)&shdr, hdr.e_shentsize);
-    if (!fp) errExit("Failed to read the section string table header.");
-
-    fp.seekg(shdr.sh_offset);
-    sectionStringTable.resize(shdr.sh_size);
-    fp.read(sectionStringTable.data(), shdr.sh_size);
-    if (!fp) errExit("Failed to read the section string table.");
-
-    fp.seekg(pos);
-  }
-
-  void addStringTable(std::ifstream &fp, const ShdrT &shdr) {
-    assert(shdr.sh_type == SHT_STRTAB && "Invalid section header.");
-    assert(fp && "Invalid input stream.");
-    const auto pos = fp.tellg();
-    fp.seekg(shdr.sh_offset);
-    stringTable.resize(shdr.sh_size);
-    fp.read(stringTable.data(), shdr.sh_size);
-    if (!fp) errExit("Failed to read string table.");
-    fp.seekg(pos);
-  }
-
-  void addSymbolTable(std::ifstream &fp, const ShdrT &shdr) {
-    assert(fp && "Invalid input stream.");
-    assert(shdr.sh_type == SHT_DYNSYM && "Invalid section header.");
-    const auto pos = fp.tellg();
-    const int n = shdr.sh_size / shdr.sh_entsize;
-    fp.seekg(shdr.sh_offset);
-    for (int i = 0; i < n; ++i) {
-      SymT sym;
-      fp.read((char *)&sym, shdr.sh_entsize);
-      if (!fp) errExit("Failed to read symbol table entry.");
-      symbolTable.push_back(sym);
-    }
-    fp.seekg(pos);
-  }
-
-  std::string relocSymName(const uint64_t rInfo) const {
-    const uint64_t symIdx = (sizeof(RelT) == sizeof(Elf32_Rel))
-                                ? ELF32_R_SYM(rInfo)
-                                : ELF64_R_SYM(rInfo);
-    if (symIdx < symbolTable.size()) {
-      const SymT *sym = &symbolTable[symIdx];
-      if (sym->st_name < stringTable.size()) return &stringTable[sym->st_name];
-    }
-    return "N/A";
-  }
-
-  void dumpReloc(const RelT &rel) const {
-    std::cout << std::hex << rel.r_offset << ", 0x" << rel.r_info
-              << relocSymName(rel.r_info) << std::dec;
-  }
-
-  void dumpReloc(const RelaT &rel) const {
-    std::cout << std::hex << rel.r_offset << ", 0x" << rel.r_info << ", 0x"
-              << rel.r_addend << ", " << relocSymName(rel.r_info) << std::dec;
-  }
-
- public:
-  void dumpRelocs() const override {
-    if (!relocs.empty()) {
-      std::cout << "Dynamic relocs (" << relocs.size() << ')' << std::endl;
-      int i = 0;
-      std::cout << "ELFOffset, RelocOffset, RelocInfo, SymName" << std::endl;
-      std::for_each(relocs.begin(), relocs.end(),
-                    [&](const std::pair<uint64_t, RelT> &pr) {
-                      std::cout << "  " << i++ << ") 0x" << std::hex << pr.first
-                                << ", " << std::dec;
-                      dumpReloc(pr.second);
-                      std::cout << std::endl;
-                    });
-    }
-
-    if (!relocsAddends.empty()) {
-      std::cout << "Dynamic or PLT relocs with addends ("
-                << relocsAddends.size() << ')' << std::endl;
-      int i = 0;
-      std::cout << "ELFOffset, RelocOffset, RelocInfo, RelocAddend, SymName"
-                << std::endl;
-      std::for_each(relocsAddends.begin(), relocsAddends.end(),
-                    [&](const std::pair<uint64_t, RelaT> &pr) {
-                      std::cout << "  " << i++ << ") 0x" << std::hex << pr.first
-                                << ", " << std::dec;
-                      dumpReloc(pr.second);
-                      std::cout << std::endl;
-                    });
-    }
-  }
-
-  void swapN(std::ofstream &output, int n) const override {
-    assert(n > 0 && "Invalid input.");
-    // Swap 'n' pseudo-random relocs.
-    for (int i = 0; i < n; ++i) {
-      bool useRelocs = false;
-      if (!relocs.empty() && !relocsAddends.empty())
-        useRelocs = rand() % 2;
-      else if (!relocs.empty())
-        useRelocs = true;
-      else if (!relocsAddends.empty())
-        useRelocs = false;
-      else  // Both sets are empty.
-        return;
-
-      // Choose what reloc collection to use.
-      if (useRelocs) {  // Swap 2 relocs.
-        const size_t aIdx = rand() % relocs.size();
-        const size_t bIdx = rand() % relocs.size();
-        RelT a = relocs[aIdx].second;
-        RelT b = relocs[bIdx].second;
-
-        // Swap a with b. (Do not modify r_info).
-        std::swap(a.r_offset, b.r_offset);
-        output.seekp(relocs[aIdx].first);
-        output.write((char *)&a, sizeof(RelT));
-        output.seekp(relocs[bIdx].first);
-        output.write((char *)&b, sizeof(RelT));
-        std::cout << "Swapped reloc " << aIdx << " with " << bIdx << std::endl;
-      } else {  // Else, swap 2 relocs with addends.
-        const size_t aIdx = rand() % relocsAddends.size();
-        const size_t bIdx = rand() % relocsAddends.size();
-        RelaT a = relocsAddends[aIdx].second;
-        RelaT b = relocsAddends[bIdx].second;
-
-        // Swap a with b. (Do not modify r_info).
-        std::swap(a.r_offset, b.r_offset);
-        std::swap(a.r_addend, b.r_addend);
-        output.seekp(relocsAddends[aIdx].first);
-        output.write((char *)&a, sizeof(RelaT));  // a = b
-        output.seekp(relocsAddends[bIdx].first);
-        output.write((char *)&b, sizeof(RelaT));  // b = a
-        std::cout << "Swapped reloc with addend " << aIdx << " with " << bIdx
-                  << std::endl;
-      }
-    }
-  }
-
-  bool isSection(size_t idx, const std::string &name) const {
-    return (idx < sectionStringTable.size()) &&
-           (name == &sectionStringTable[idx]);
-  }
-
-  void parse(std::ifstream &fp) override {
-    assert(fp && "Invalid fp state.");
-
-    // Read the header.
-    EhdrT hdr;
-    fp.read((char *)&hdr, sizeof(EhdrT));
-    if (!fp) errExit("Failed to read ELF header.");
-
-    // Read the section string table.
-    addSectionStringTable(fp, hdr);
-
-    // Read the sections.
-    fp.seekg(hdr.e_shoff);
-    for (size_t i = 0; i < hdr.e_shnum; ++i) {
-      ShdrT shdr;
-      fp.read((char *)&shdr, sizeof(ShdrT));
-      if (!fp) errExit("Failed to read section header.");
-
-      // Read in specific sections.
-      if ((shdr.sh_type == SHT_REL || shdr.sh_type == SHT_RELA) &&
-          (isSection(shdr.sh_name, ".rel.dyn") ||
-           isSection(shdr.sh_name, ".rela.dyn") ||
-           isSection(shdr.sh_name, ".rela.plt")))
-        addRels(fp, shdr);
-      else if (shdr.sh_type == SHT_STRTAB && isSection(shdr.sh_name, ".dynstr"))
-        addStringTable(fp, shdr);
-      else if (shdr.sh_type == SHT_DYNSYM && isSection(shdr.sh_name, ".dynsym"))
-        addSymbolTable(fp, shdr);
-    }
-  }
+static const struct option longOpts[] = {
+    {"help", no_argument, nullptr, 'h'},
+    {"optimize-order", no_argument, nullptr, optOptimizeOrder},
+    {"measure-runs", required_argument, nullptr, optMeasureRuns},
+    {"pack-relr", no_argument, nullptr, optPackRelr},
+    {"footprint", no_argument, nullptr, optFootprint},
+    {"weights", required_argument, nullptr, optWeights},
+    {"interposition", no_argument, nullptr, optInterposition},
+    {"profile-load", no_argument, nullptr, optProfileLoad},
+    {"budget-compare", no_argument, nullptr, optBudgetCompare},
+    {"threshold", required_argument, nullptr, optThreshold},
+    {"census", required_argument, nullptr, optCensus},
+    {"unused-weight", required_argument, nullptr, optUnusedWeight},
+    {"reach", no_argument, nullptr, optReach},
+    {"run", required_argument, nullptr, optRun},
+    {"jobs", required_argument, nullptr, optJobs},
+    {"timeout", required_argument, nullptr, optTimeout},
+    {"no-prefilter", no_argument, nullptr, optNoPrefilter},
+    {"keep", required_argument, nullptr, optKeep},
+    {"baseline-runs", required_argument, nullptr, optBaselineRuns},
+    {"audit", required_argument, nullptr, optAudit},
+    {"pack", required_argument, nullptr, optPack},
+    {"extract", required_argument, nullptr, optExtract},
+    {"store", required_argument, nullptr, optStore},
+    {"gc", required_argument, nullptr, optGc},
+    {"cache-policy", required_argument, nullptr, optCachePolicy},
+    {"timings", no_argument, nullptr, optTimings},
+    {"quiet", no_argument, nullptr, optQuiet},
+    {"watch", required_argument, nullptr, optWatch},
+    {"index", required_argument, nullptr, optIndex},
+    {"debounce", required_argument, nullptr, optDebounce},
+    {"query", required_argument, nullptr, optQuery},
+    {"trace", required_argument, nullptr, optTrace},
+    {"format", required_argument, nullptr, optFormat},
+    {"type", required_argument, nullptr, optType},
+    {"symbol", required_argument, nullptr, optSymbol},
+    {"section", required_argument, nullptr, optSection},
+    {"address", required_argument, nullptr, optAddress},
+    {"demangle", no_argument, nullptr, optDemangle},
+    {nullptr, 0, nullptr, 0},
 };
 
-using Elf32 = ElfT<Elf32_Ehdr, Elf32_Shdr, Elf32_Rel, Elf32_Rela, Elf32_Sym>;
-using Elf64 = ElfT<Elf64_Ehdr, Elf64_Shdr, Elf64_Rel, Elf64_Rela, Elf64_Sym>;
-
 static void usage(const char *execname) {
   std::cout
-      << "Usage: " << execname << " [-h] [-d] [-n NUM] [-o OUTFILE] FILE"
+      << "Usage: " << execname
+      << " [-h] [-d] [--format FMT] [-n NUM] [-o OUTFILE] [--optimize-order]"
+      << std::endl
+      << "                 [--pack-relr] [--type TYPE] [--symbol REGEX]"
+         " [--section NAME]"
+      << std::endl
+      << "                 [--address BEGIN-END] [--demangle] FILE" << std::endl
+      << "       " << execname
+      << " -n NUM -o OUTFILE [--census CENSUS]... [--reach] [--unused-weight W]"
+      << std::endl
+      << "                 [--quiet] FILE" << std::endl
+      << "       " << execname << " --reach FILE|DIR..." << std::endl
+      << "       " << execname
+      << " --run VARIANTS [-n NUM] [--jobs NUM] [--timeout SEC] [--keep DIR]"
+      << std::endl
+      << "                 [--baseline-runs NUM] [--no-prefilter] [--audit SO]"
+         " [--pack PACK]"
+      << std::endl
+      << "                 [--store STORE] FILE [-- CMD [ARG...]]" << std::endl
+      << "       " << execname << " --gc STORE" << std::endl
+      << "       " << execname
+      << " --watch DIR [--index INDEX] [--debounce SEC]" << std::endl
+      << "       " << execname << " --query INDEX [PATTERN]" << std::endl
+      << "       " << execname << " --extract ID --pack PACK -o OUTFILE [FILE]"
+      << std::endl
+      << "       " << execname << " --footprint [--weights FILE] FILE|DIR..."
+      << std::endl
+      << "       " << execname << " --interposition FILE|DIR..." << std::endl
+      << "       " << execname
+      << " --profile-load [--measure-runs NUM] (-- CMD [ARG...] | FILE|DIR...)"
+      << std::endl
+      << "       " << execname
+      << " --budget-compare [--threshold NAME=LIMIT]... OLD NEW [OLD NEW]..."
       << std::endl
       << "  -h:         This help message." << std::endl
       << "  -d:         Dump relocs." << std::endl
+      << "  --format default|readelf: Dump relocs as -d does, or as readelf -r "
+         "does."
+      << std::endl
+      << "  --type TYPE:      Dump only relocs of TYPE, a name readelf prints, "
+         "with or"
+      << std::endl
+      << "                    without its R_MACHINE_ prefix, a number, or "
+         "RELATIVE,"
+      << std::endl
+      << "                    IRELATIVE, COPY, JUMP_SLOT or GLOB_DAT on any "
+         "machine."
+      << std::endl
+      << "  --symbol REGEX:   Dump only relocs of symbols matching REGEX."
+      << std::endl
+      << "  --section NAME:   Dump only relocs of addresses in section NAME."
+      << std::endl
+      << "  --address BEGIN-END: Dump only relocs of addresses in [BEGIN, "
+         "END), in hex."
+      << std::endl
+      << "                    Each filter may be repeated; a reloc must match "
+         "one of each"
+      << std::endl
+      << "                    kind given." << std::endl
+      << "  --demangle:       Print C++ symbol names demangled, in dumps and "
+         "reports."
+      << std::endl
+      << "                    --symbol then matches the demangled names."
+      << std::endl
       << "  -n NUM:     Swap 'num' number of relocs." << std::endl
       << "  -o OUTFILE: Output file (required to shuffle the relocs in FILE)."
       << std::endl
+      << "  --cache-policy keep|drop|direct: Keep written variants and batch "
+         "inputs in"
+      << std::endl
+      << "                    the page cache, drop them once written or read, "
+         "or write"
+      << std::endl
+      << "                    variants with O_DIRECT." << std::endl
+      << "  --timings:        Report the time spent writing variants."
+      << std::endl
+      << "  --quiet:          Do not list the swaps made with -o." << std::endl
       << "  FILE:       Input ELF file, if -o is specified the relocs in FILE "
          "will "
          "be shuffled and output to the file specified in OUTFILE."
-      << std::endl;
+      << std::endl
+      << "  --optimize-order: Instead of shuffling, write OUTFILE with the "
+         "dynamic relocs"
+      << std::endl
+      << "                    ordered for a faster startup." << std::endl
+      << "  --pack-relr:      Instead of shuffling, write OUTFILE with the "
+         "RELATIVE relocs"
+      << std::endl
+      << "                    packed into .relr.dyn." << std::endl
+      << "  --measure-runs NUM: Runs of the input before and after "
+         "--optimize-order or"
+      << std::endl
+      << "                    --pack-relr to measure the loader startup "
+         "(default: 0), or"
+      << std::endl
+      << "                    of --profile-load (default: 20).  Each run "
+         "is killed after"
+      << std::endl
+      << "                    5 seconds." << std::endl
+      << "  --footprint:      Report the pages dirtied by relocs in each FILE, "
+         "and in"
+      << std::endl
+      << "                    the ELF files under each DIR." << std::endl
+      << "  --weights FILE:   Lines of \"COUNT PATH\": the processes loading "
+         "each"
+      << std::endl
+      << "                    library, to weight fleet totals." << std::endl
+      << "  --interposition:  Report the symbol relocs that "
+         "-Bsymbolic-functions or"
+      << std::endl
+      << "                    protected visibility would remove." << std::endl
+      << "  --profile-load:   Run CMD, or each executable FILE, with the "
+         "loader's"
+      << std::endl
+      << "                    statistics and rank the loaded objects by "
+         "relocation cost."
+      << std::endl
+      << "  --budget-compare: Compare the relocs of the binaries in each OLD "
+         "and NEW"
+      << std::endl
+      << "                    file or directory, matched by soname or path, "
+         "and exit"
+      << std::endl
+      << "                    with 1 if a threshold is exceeded." << std::endl
+      << "  --threshold NAME=LIMIT: Allowed growth of relocs, lookups, pages "
+         "or bytes,"
+      << std::endl
+      << "                    as a count or a percentage (default: 5%)."
+      << std::endl
+      << "  --census CENSUS:  Swap the PLT relocs bound in the runs recorded "
+         "by"
+      << std::endl
+      << "                    relocswap-audit.so, favoring the most called."
+      << std::endl
+      << "  --reach:          Rank the GOT slots by the references to them in "
+         "the code,"
+      << std::endl
+      << "                    and swap the referenced ones." << std::endl
+      << "  --unused-weight W: Weight of the relocs --census or --reach find "
+         "unused,"
+      << std::endl
+      << "                    relative to other relocs (default: 0)."
+      << std::endl
+      << "  --run VARIANTS:   Run VARIANTS copies of FILE with NUM relocs "
+         "swapped, or CMD"
+      << std::endl
+      << "                    with \"{}\" replaced by the copy, and count "
+         "the outcomes:"
+      << std::endl
+      << "                    ok, slow, memhog, exit, crash, timeout or "
+         "load-fail."
+      << std::endl
+      << "                    CMD finds a shared object FILE by soname in "
+         "LD_LIBRARY_PATH."
+      << std::endl
+      << "  --jobs NUM:       Variants run at once (default: one per core)."
+      << std::endl
+      << "  --timeout SEC:    Seconds before a variant is killed (default: "
+         "10)."
+      << std::endl
+      << "  --no-prefilter:   Run every variant, even those ld.so fails to "
+         "load."
+      << std::endl
+      << "  --keep DIR:       Keep the variants that fail, and their swaps, "
+         "in DIR."
+      << std::endl
+      << "  --baseline-runs NUM: Runs of the unmodified FILE that variants "
+         "are compared"
+      << std::endl
+      << "                    with to class them slow or memhog (default: "
+         "10)."
+      << std::endl
+      << "  --audit SO:       Preload relocswap-audit.so SO in the variants to "
+         "report"
+      << std::endl
+      << "                    relocation times and fault addresses."
+      << std::endl
+      << "  --pack PACK:      Append the swaps and outcome of every variant to "
+         "the"
+      << std::endl
+      << "                    variant pack PACK." << std::endl
+      << "  --extract ID:     Write variant ID of PACK to OUTFILE, applied to "
+         "FILE or"
+      << std::endl
+      << "                    the binary PACK was made from." << std::endl
+      << "  --store STORE:    Store the variants that fail in STORE, by "
+         "content, and"
+      << std::endl
+      << "                    list them in a results file of the campaign."
+      << std::endl
+      << "  --gc STORE:       Remove the variants no results file of STORE "
+         "lists."
+      << std::endl
+      << "  --watch DIR:      Index the binaries below DIR and keep the index "
+         "up to date"
+      << std::endl
+      << "                    as files change (default index: "
+         "DIR/.relocswap-index)."
+      << std::endl
+      << "  --debounce SEC:   Time a file must be left alone before it is "
+         "indexed"
+      << std::endl
+      << "                    (default: 0.5)." << std::endl
+      << "  --query INDEX:    Print the binaries of INDEX whose path or "
+         "DT_NEEDED"
+      << std::endl
+      << "                    contain PATTERN." << std::endl
+      << "  --trace FILE:     Write a timeline of the work of each thread to "
+         "FILE, as"
+      << std::endl
+      << "                    Chrome trace-event JSON." << std::endl;
+}
+
+// Materialize variant 'id' of a pack.
+static void extractVariant(const char *packName, uint64_t id,
+                           const char *baseName, const char *outFname) {
+  PackReader pack(packName);
+  const std::string base = baseName ? baseName : pack.header().path;
+  PackEntry entry;
+  if (!pack.get(id, entry))
+    errExit("No variant " + std::to_string(id) + " in " + packName);
+  std::ifstream fp(base);
+  if (!fp) errExit("Failed to open input file " + base);
+  std::unique_ptr<Elf> elf(parseElf(fp));
+  const PackHeader header = packHeader(base, *elf);
+  if (header.baseSize != pack.header().baseSize ||
+      header.baseHash != pack.header().baseHash)
+    errExit(base + " is not the binary " + packName + " was made from.");
+  if (!std::filesystem::copy_file(
+          base, outFname, std::filesystem::copy_options::overwrite_existing))
+    errExit(std::string("Failed to replicate ") + base);
+  FileSink out(outFname);
+  elf->applySwaps(out, entry.plan);
+  std::cout << "Variant " << id << ": "
+            << entry.plan.rel.size() + entry.plan.rela.size()
+            << " relocs moved";
+  if (entry.outcome >= 0 && entry.outcome < outcomeCount)
+    std::cout << ", " << outcomeName((Outcome)entry.outcome) << " "
+              << entry.detail;
+  std::cout << std::endl;
+}
+
+// ", N skipped" if a batch skipped inputs.
+static std::string skipped(size_t failed) {
+  return failed ? ", " + std::to_string(failed) + " skipped" : "";
 }
 
-static Elf *parseElf(std::ifstream &fp) {
-  assert(fp && "Invalid input.");
-  char buf[EI_NIDENT] = {0};
-  fp.read(buf, EI_NIDENT);
-  if (!fp || (memcmp(buf, ELFMAG, SELFMAG) != 0) ||
-      (buf[EI_CLASS] != ELFCLASS32 && buf[EI_CLASS] != ELFCLASS64))
-    errExit("Failed to read ELF header.");
-  fp.seekg(0);
+// The batch reports return false if inputs were skipped.
+static bool reportFootprints(const std::vector<std::string> &inputs,
+                             const FleetWeights &weights) {
+  const auto footprints = mapInputs<Footprint>(inputs, computeFootprint);
+  double pages = 0, relroPages = 0, textPages = 0;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!footprints.ok(i)) continue;
+    const Footprint &footprint = footprints.values[i];
+    printFootprint(inputs[i], footprint);
+    const double weight = weights.weight(inputs[i]);
+    pages += weight * footprint.pages;
+    relroPages += weight * footprint.relroPages;
+    textPages += weight * footprint.textPages;
+  }
+  if (inputs.size() > 1)
+    std::cout << "Fleet (" << inputs.size() - footprints.failed
+              << " binaries" << skipped(footprints.failed)
+              << ", weighted): " << (uint64_t)pages << " dirty pages ("
+              << (uint64_t)(pages * 4096 / (1024 * 1024)) << " MiB), "
+              << (uint64_t)relroPages << " RELRO, " << (uint64_t)textPages
+              << " text" << std::endl;
+  return !footprints.failed;
+}
 
-  Elf *elf;
-  if (buf[EI_CLASS] == ELFCLASS32)
-    elf = new Elf32();
-  else
-    elf = new Elf64();
-  elf->parse(fp);
+static bool reportInterpositions(const std::vector<std::string> &inputs) {
+  const auto results = mapInputs<Interposition>(inputs, analyzeInterposition);
+  Interposition total;
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    if (!results.ok(i)) continue;
+    const Interposition &ip = results.values[i];
+    printInterposition(inputs[i], ip);
+    total.symbolRelocs += ip.symbolRelocs;
+    total.ownRelocs += ip.ownRelocs;
+    total.ownSymbols += ip.ownSymbols;
+    total.funcSlotsRemoved += ip.funcSlotsRemoved;
+    total.funcToRelative += ip.funcToRelative;
+    total.funcLookupsSaved += ip.funcLookupsSaved;
+    total.dataToRelative += ip.dataToRelative;
+    total.dataLookupsSaved += ip.dataLookupsSaved;
+  }
+  if (inputs.size() > 1)
+    printInterposition("Total (" +
+                           std::to_string(inputs.size() - results.failed) +
+                           " binaries" + skipped(results.failed) + ")",
+                       total);
+  return !results.failed;
+}
 
-  return elf;
+static bool reportReach(const std::vector<std::string> &inputs) {
+  const auto results = mapInputs<Reach>(inputs, computeReach);
+  for (size_t i = 0; i < inputs.size(); ++i)
+    if (results.ok(i)) printReach(inputs[i], results.values[i]);
+  if (results.failed)
+    std::cout << "Reach: " << results.failed << " of " << inputs.size()
+              << " binaries skipped" << std::endl;
+  return !results.failed;
+}
+
+// Combine the weights of a census and the static references.
+static std::vector<double> swapWeights(const Elf &elf, const char *fname,
+                                       const Census &census, bool doReach,
+                                       double unusedWeight) {
+  std::vector<double> weights(elf.relocations().size(), 1);
+  if (census.files) weights = censusWeights(elf, census, unusedWeight);
+  if (doReach) {
+    const Reach reach = computeReach(fname, elf);
+    printReach(fname, reach);
+    const auto reached = reachWeights(elf, reach, unusedWeight);
+    for (size_t i = 0; i < weights.size(); ++i) weights[i] *= reached[i];
+  }
+  return weights;
+}
+
+static bool profileCommand(const std::vector<std::string> &argv, int runs) {
+  LoadProfile profile;
+  if (!profileLoad(argv, runs, profile)) {
+    std::cerr << "The loader reported no statistics for " << argv[0]
+              << std::endl;
+    return false;
+  }
+  printLoadProfile(profile);
+  return true;
+}
+
+static bool profileFleet(const std::vector<std::string> &inputs, int runs) {
+  std::vector<LoadProfile> profiles;
+  for (const auto &input : inputs) {
+    LoadProfile profile;
+    if (access(input.c_str(), X_OK) != 0 ||
+        !profileLoad({std::filesystem::absolute(input)}, runs, profile))
+      continue;
+    printLoadProfile(profile);
+    profiles.push_back(std::move(profile));
+  }
+  if (profiles.size() > 1) printFleetProfile(profiles);
+  return !profiles.empty();
 }
 
 int main(int argc, char **argv) {
   int opt;
   int nSwaps = 1;
+  int measureRuns = -1;  // Set by --measure-runs.
   bool doDump = false;
+  bool readelfFormat = false;
+  RelocFilter filter;
+  bool doOptimizeOrder = false;
+  bool doPackRelr = false;
+  bool doFootprint = false;
+  bool doInterposition = false;
+  bool doProfileLoad = false;
+  bool doBudgetCompare = false;
+  bool doReach = false;
+  bool quiet = false;
+  Budget budget;
+  FleetWeights weights;
+  Census census;
+  double unusedWeight = 0;
+  CampaignOptions campaign;
   const char *outFname = nullptr;
+  const char *extractId = nullptr;
+  const char *gcStore = nullptr;
+  const char *watchDir = nullptr;
+  const char *queryIndexName = nullptr;
+  WatchOptions watch;
   srand(time(NULL));
-  while ((opt = getopt(argc, argv, "dhn:o:")) != -1) {
+  while ((opt = getopt_long(argc, argv, "dhn:o:", longOpts, nullptr)) != -1) {
     switch (opt) {
       case 'd':
         doDump = true;
@@ -296,6 +496,129 @@ int main(int argc, char **argv) {
       case 'o':
         outFname = optarg;
         break;
+      case optOptimizeOrder:
+        doOptimizeOrder = true;
+        break;
+      case optPackRelr:
+        doPackRelr = true;
+        break;
+      case optFootprint:
+        doFootprint = true;
+        break;
+      case optInterposition:
+        doInterposition = true;
+        break;
+      case optProfileLoad:
+        doProfileLoad = true;
+        break;
+      case optBudgetCompare:
+        doBudgetCompare = true;
+        break;
+      case optThreshold:
+        budget.setLimit(optarg);
+        break;
+      case optWeights:
+        weights.load(optarg);
+        break;
+      case optCensus:
+        loadCensus(optarg, census);
+        break;
+      case optUnusedWeight:
+        unusedWeight = std::atof(optarg);
+        break;
+      case optReach:
+        doReach = true;
+        break;
+      case optRun:
+        campaign.variants = std::atoi(optarg);
+        break;
+      case optJobs:
+        campaign.jobs = std::atoi(optarg);
+        break;
+      case optTimeout:
+        campaign.timeout = std::atof(optarg);
+        break;
+      case optNoPrefilter:
+        campaign.prefilter = false;
+        break;
+      case optKeep:
+        campaign.keepDir = optarg;
+        break;
+      case optBaselineRuns:
+        campaign.baselineRuns = std::atoi(optarg);
+        break;
+      case optAudit:
+        if (access(optarg, R_OK) != 0)
+          errExit(std::string("Error: Cannot read ") + optarg);
+        campaign.audit = std::filesystem::absolute(optarg);
+        break;
+      case optPack:
+        campaign.pack = optarg;
+        break;
+      case optExtract:
+        extractId = optarg;
+        break;
+      case optStore:
+        campaign.store = optarg;
+        break;
+      case optGc:
+        gcStore = optarg;
+        break;
+      case optCachePolicy:
+        if (!parseCachePolicy(optarg, campaign.cachePolicy))
+          errExit("Error: --cache-policy is keep, drop or direct.");
+        setInputCachePolicy(campaign.cachePolicy);
+        break;
+      case optQuiet:
+        quiet = true;
+        break;
+      case optTimings:
+        campaign.timings = true;
+        break;
+      case optWatch:
+        watchDir = optarg;
+        break;
+      case optIndex:
+        watch.index = optarg;
+        break;
+      case optDebounce:
+        watch.debounce = std::atof(optarg);
+        break;
+      case optQuery:
+        queryIndexName = optarg;
+        break;
+      case optTrace:
+        startTrace(optarg);
+        break;
+      case optFormat:
+        if (std::string(optarg) == "readelf")
+          readelfFormat = true;
+        else if (std::string(optarg) != "default")
+          errExit("Error: --format is default or readelf.");
+        doDump = true;
+        break;
+      case optType:
+        filter.addType(optarg);
+        doDump = true;
+        break;
+      case optSymbol:
+        filter.addSymbol(optarg);
+        doDump = true;
+        break;
+      case optSection:
+        filter.addSection(optarg);
+        doDump = true;
+        break;
+      case optAddress:
+        filter.addRange(optarg);
+        doDump = true;
+        break;
+      case optDemangle:
+        demangleOn = true;
+        break;
+      case optMeasureRuns:
+        measureRuns = std::atoi(optarg);
+        break;
       default:
         errExit("Error: Unrecognized argument, see help (-h).");
     }
@@ -303,6 +626,73 @@ int main(int argc, char **argv) {
 
   if (nSwaps < 0) nSwaps = 0;
 
+  if (doProfileLoad) {
+    if (optind == argc) errExit("Missing command argument (see -h for help)");
+    std::vector<std::string> args(argv + optind, argv + argc);
+    if (std::string(argv[optind - 1]) == "--")
+      return !profileCommand(args, measureRuns < 0 ? 20 : measureRuns);
+    return !profileFleet(collectInputs(args),
+                         measureRuns < 0 ? 20 : measureRuns);
+  }
+
+  if (doBudgetCompare) {
+    if (optind == argc || (argc - optind) % 2)
+      errExit("--budget-compare takes pairs of OLD and NEW arguments.");
+    bool within = true;
+    for (int i = optind; i < argc; i += 2)
+      within &= budget.compare(argv[i], collectInputs({argv[i]}),
+                               argv[i + 1], collectInputs({argv[i + 1]}));
+    return within ? 0 : 1;
+  }
+
+  if (watchDir) return watchTree(watchDir, watch) ? 0 : 1;
+  if (queryIndexName) {
+    queryIndex(queryIndexName, optind < argc ? argv[optind] : "");
+    return 0;
+  }
+
+  if (gcStore) {
+    uint64_t freed;
+    const uint64_t removed = storeGc(gcStore, freed);
+    std::cout << "Removed " << removed << " variants, freeing " << freed
+              << " bytes." << std::endl;
+    return 0;
+  }
+
+  if (extractId) {
+    if (campaign.pack.empty() || !outFname)
+      errExit("--extract requires a pack (--pack) and an output file (-o).");
+    extractVariant(campaign.pack.c_str(), std::strtoull(extractId, nullptr, 10),
+                   optind < argc ? argv[optind] : nullptr, outFname);
+    return 0;
+  }
+
+  if (campaign.variants > 0) {
+    if (optind == argc) errExit("Missing filename argument (see -h for help)");
+    const char *fname = argv[optind];
+    std::ifstream fp(fname);
+    if (!fp) errExit(std::string("Failed to open input file ") + fname);
+    std::unique_ptr<Elf> elf(parseElf(fp));
+    campaign.swaps = std::max(nSwaps, 1);
+    campaign.command.assign(argv + optind + 1, argv + argc);
+    if (census.files || doReach)
+      elf->setSwapWeights(swapWeights(*elf, fname, census, doReach,
+                                      unusedWeight));
+    return runCampaign(*elf, fname, campaign) ? 0 : 1;
+  }
+
+  // Batch reports.
+  if (doFootprint || doInterposition || (doReach && !outFname)) {
+    if (optind == argc) errExit("Missing filename argument (see -h for help)");
+    const auto inputs =
+        collectInputs(std::vector<std::string>(argv + optind, argv + argc));
+    bool all = true;
+    if (doFootprint) all &= reportFootprints(inputs, weights);
+    if (doInterposition) all &= reportInterpositions(inputs);
+    if (doReach) all &= reportReach(inputs);
+    return all ? 0 : 1;
+  }
+
   if (optind + 1 != argc) {
     std::cerr << "Missing filename argument (see -h for help)" << std::endl;
     return 0;
@@ -313,18 +703,35 @@ int main(int argc, char **argv) {
 
   auto elf = parseElf(fp);
   assert(elf && "Failed to parse ELF file.");
-  if (doDump) elf->dumpRelocs();
-  if (outFname && nSwaps > 0) {
-    std::ofstream outFile(outFname, std::ofstream::trunc);
-    if (!outFile) errExit(std::string("Failed to open/truncate ") + outFname);
-
-    // Copy input to output.
-    if (!std::filesystem::copy_file(
-            fname, outFname, std::filesystem::copy_options::overwrite_existing))
-      errExit(std::string("Failed to replicate ") + fname);
-
-    // Swap 'n' relocs.
-    elf->swapN(outFile, nSwaps);
+  if (doDump) {
+    filter.bind(*elf);
+    std::cout.flush();
+    TextBuffer out(STDOUT_FILENO);
+    if (readelfFormat)
+      dumpRelocsReadelf(fname, *elf, filter, out);
+    else
+      elf->dumpRelocs(filter, out);
+  }
+  if (doOptimizeOrder) {
+    if (!outFname) errExit("--optimize-order requires an output file (-o).");
+    optimizeOrder(*elf, fname, outFname, std::max(measureRuns, 0));
+  } else if (doPackRelr) {
+    if (!outFname) errExit("--pack-relr requires an output file (-o).");
+    packRelr(*elf, fname, outFname, std::max(measureRuns, 0));
+  } else if (outFname && nSwaps > 0) {
+    // Swap 'n' relocs in a copy of the input.
+    if (census.files || doReach)
+      elf->setSwapWeights(swapWeights(*elf, fname, census, doReach,
+                                      unusedWeight));
+    std::string log;
+    PatchRecorder patches;
+    elf->applySwaps(patches, elf->planSwaps(nSwaps, quiet ? nullptr : &log));
+    std::cout.flush();
+    TextBuffer(STDOUT_FILENO).put(log);
+    WriteTimings timings;
+    writeVariant(fname, outFname, std::move(patches.patches),
+                 campaign.cachePolicy, timings);
+    if (campaign.timings) timings.print(std::cout, campaign.cachePolicy);
   }
 
   return 0;
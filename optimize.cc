@@ -0,0 +1,180 @@
+#include "optimize.h"
+
+#include <elf.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "loadstats.h"
+#include "output.h"
+
+namespace {
+constexpr uint64_t pageSize = 4096;
+
+// The loader caches the last symbol lookup of each object, keyed by the
+// symbol and the class of the reloc type (PLT, COPY or any other).
+using LookupKey = std::pair<uint32_t, int>;
+
+LookupKey lookupKey(const Elf &elf, const Reloc &rel) {
+  const RelocKind kind = relocKind(elf.machine(), rel.type);
+  return {rel.sym, kind == RelocKind::JumpSlot ? 1
+                   : kind == RelocKind::Copy   ? 2
+                                               : 0};
+}
+
+struct OrderCost {
+  size_t leadingRelative = 0;  // RELATIVE relocs before any other type.
+  size_t lookups = 0;          // Symbol lookups not served by the cache.
+  size_t pageSwitches = 0;     // Consecutive relocs on different pages.
+};
+
+OrderCost estimateCost(const Elf &elf, const std::vector<Reloc> &relocs) {
+  OrderCost cost;
+  bool leading = true;
+  bool haveLast = false;
+  LookupKey last;
+  uint64_t lastPage = ~0ULL;
+  for (const auto &rel : relocs) {
+    const RelocKind kind = relocKind(elf.machine(), rel.type);
+    if (kind != RelocKind::Relative) leading = false;
+    if (leading) ++cost.leadingRelative;
+    if (rel.sym != 0) {
+      const LookupKey key = lookupKey(elf, rel);
+      if (!haveLast || key != last) ++cost.lookups;
+      last = key;
+      haveLast = true;
+    }
+    if (rel.offset / pageSize != lastPage) ++cost.pageSwitches;
+    lastPage = rel.offset / pageSize;
+  }
+  return cost;
+}
+
+// Returns 'relocs' in the optimized order.
+std::vector<Reloc> optimizedOrder(const Elf &elf,
+                                  const std::vector<Reloc> &relocs) {
+  std::vector<Reloc> relative, symbolic, irelative;
+  for (const auto &rel : relocs) {
+    switch (relocKind(elf.machine(), rel.type)) {
+      case RelocKind::Relative:
+        relative.push_back(rel);
+        break;
+      case RelocKind::IRelative:  // Resolvers may depend on everything else.
+        irelative.push_back(rel);
+        break;
+      default:
+        symbolic.push_back(rel);
+    }
+  }
+
+  std::stable_sort(
+      relative.begin(), relative.end(),
+      [](const Reloc &a, const Reloc &b) { return a.offset < b.offset; });
+
+  // Groups sharing a lookup are ordered by their lowest address.
+  std::map<LookupKey, uint64_t> groupStart;
+  for (const auto &rel : symbolic) {
+    const auto [it, inserted] =
+        groupStart.emplace(lookupKey(elf, rel), rel.offset);
+    if (!inserted) it->second = std::min(it->second, rel.offset);
+  }
+  std::stable_sort(symbolic.begin(), symbolic.end(),
+                   [&](const Reloc &a, const Reloc &b) {
+                     const LookupKey ka = lookupKey(elf, a);
+                     const LookupKey kb = lookupKey(elf, b);
+                     return std::tie(groupStart[ka], ka, a.offset) <
+                            std::tie(groupStart[kb], kb, b.offset);
+                   });
+
+  std::vector<Reloc> order = std::move(relative);
+  order.insert(order.end(), symbolic.begin(), symbolic.end());
+  order.insert(order.end(), irelative.begin(), irelative.end());
+  return order;
+}
+
+void printCost(const char *label, const OrderCost &cost) {
+  std::cout << "  " << label << ": " << cost.leadingRelative
+            << " leading relative, " << cost.lookups << " symbol lookups, "
+            << cost.pageSwitches << " page switches" << std::endl;
+}
+
+}  // namespace
+
+void optimizeOrder(const Elf &elf, const char *inFname, const char *outFname,
+                   int runs) {
+  if (relativeType(elf.machine()) == 0)
+    errExit("Unsupported machine for reordering relocs.");
+  if (!std::filesystem::copy_file(
+          inFname, outFname, std::filesystem::copy_options::overwrite_existing))
+    errExit(std::string("Failed to replicate ") + inFname);
+  PatchRecorder edits;
+
+  const std::vector<Reloc> &all = elf.relocations();
+  std::vector<DynEntry> dyn = elf.dynamic();
+  const auto &sections = elf.sections();
+  // The sections with several relocs of the same address.
+  const std::vector<uint32_t> &byOffset = elf.relocsByOffset();
+  std::vector<char> sharedTargets(sections.size());
+  for (size_t i = 0, j; i < byOffset.size(); i = j) {
+    const uint64_t offset = all[byOffset[i]].offset;
+    for (j = i + 1; j < byOffset.size() && all[byOffset[j]].offset == offset;)
+      ++j;
+    for (size_t k = i; k < j; ++k)
+      for (size_t l = k + 1; l < j; ++l)
+        if (all[byOffset[k]].section == all[byOffset[l]].section)
+          sharedTargets[all[byOffset[k]].section] = 1;
+  }
+  for (uint32_t secIdx = 0; secIdx < sections.size(); ++secIdx) {
+    const Section &sec = sections[secIdx];
+    if (sec.name != ".rela.dyn" && sec.name != ".rel.dyn") continue;
+    const bool withAddends = sec.type == SHT_RELA;
+
+    std::vector<Reloc> relocs;
+    for (const auto &rel : all)
+      if (rel.section == secIdx) relocs.push_back(rel);
+    if (relocs.empty()) continue;
+    // Relocs applied to the same address must stay in order.
+    if (sharedTargets[secIdx])
+      errExit("Multiple relocs of " + sec.name +
+              " target the same address, refusing to reorder.");
+
+    std::vector<Reloc> order = optimizedOrder(elf, relocs);
+    std::vector<Patch> batch;
+    for (size_t i = 0; i < relocs.size(); ++i)
+      batch.emplace_back(relocs[i].fileOffset,
+                         elf.encodeReloc(order[i], withAddends));
+    std::sort(batch.begin(), batch.end());
+    edits.write(batch);
+
+    const OrderCost before = estimateCost(elf, relocs);
+    const OrderCost after = estimateCost(elf, order);
+    const int64_t countTag = withAddends ? DT_RELACOUNT : DT_RELCOUNT;
+    if (!setDynEntry(dyn, countTag, after.leadingRelative))
+      std::cerr << "Warning: no room to add "
+                << (withAddends ? "DT_RELACOUNT" : "DT_RELCOUNT") << std::endl;
+
+    std::cout << "Reordered " << sec.name << " (" << relocs.size() << ')'
+              << std::endl;
+    printCost("Before", before);
+    printCost("After ", after);
+  }
+  writeDynamic(elf, edits, dyn);
+  std::sort(edits.patches.begin(), edits.patches.end());
+  FileSink(outFname).write(edits.patches);
+
+  // Measure the startup of both files.
+  if (runs <= 0) return;
+  LoaderStats inStats, outStats;
+  if (!measureStartup(elf, inFname, runs, inStats) ||
+      !measureStartup(elf, outFname, runs, outStats)) {
+    std::cerr << "Warning: the loader reported no statistics." << std::endl;
+    return;
+  }
+  printStartup(runs, inStats, outStats);
+}
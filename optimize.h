@@ -0,0 +1,14 @@
+#ifndef RELOCSWAP_OPTIMIZE_H
+#define RELOCSWAP_OPTIMIZE_H
+
+#include "elffile.h"
+
+// Write a copy of 'inFname' to 'outFname' with .rela.dyn/.rel.dyn reordered
+// for a faster startup: RELATIVE relocs first (counted by DT_RELACOUNT or
+// DT_RELCOUNT), then the rest grouped by symbol and sorted by r_offset.  If
+// 'runs' is positive and the input is executable, the loader's startup time
+// is measured for both files.
+void optimizeOrder(const Elf &elf, const char *inFname, const char *outFname,
+                   int runs);
+
+#endif  // RELOCSWAP_OPTIMIZE_H
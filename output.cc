@@ -0,0 +1,237 @@
+#include "output.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+
+#include "elffile.h"
+#include "trace.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double since(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// O_DIRECT needs buffers, offsets and sizes aligned to the logical block
+// size, at most a page.
+constexpr size_t directAlign = 4096;
+constexpr size_t directChunk = 1 << 20;
+
+// Copy 'patches' over the bytes they overlap in [offset, offset + size).
+void applyPatches(const std::vector<Patch> &patches, char *buf,
+                  uint64_t offset, size_t size) {
+  auto it = std::upper_bound(
+      patches.begin(), patches.end(), offset,
+      [](uint64_t off, const Patch &p) { return off < p.first; });
+  if (it != patches.begin()) --it;
+  for (; it != patches.end() && it->first < offset + size; ++it) {
+    const uint64_t begin = std::max(it->first, offset);
+    const uint64_t end =
+        std::min<uint64_t>(it->first + it->second.size(), offset + size);
+    if (begin < end)
+      memcpy(buf + (begin - offset), it->second.data() + (begin - it->first),
+             end - begin);
+  }
+}
+
+// Write 'patches', sorted by offset, to 'fd': each run of adjacent ones with
+// a pwritev.
+void writeRuns(int fd, const std::vector<Patch> &patches,
+               const std::string &path) {
+  std::vector<iovec> iov;
+  for (size_t i = 0; i < patches.size();) {
+    const uint64_t start = patches[i].first;
+    uint64_t end = start;
+    iov.clear();
+    for (; i < patches.size() && patches[i].first == end &&
+           iov.size() < IOV_MAX;
+         ++i) {
+      const std::string &bytes = patches[i].second;
+      iov.push_back({(void *)bytes.data(), bytes.size()});
+      end += bytes.size();
+    }
+    if (pwritev(fd, iov.data(), iov.size(), start) != (ssize_t)(end - start))
+      errExit("Failed to write " + path);
+  }
+}
+
+// Read the input in aligned chunks, patch each one in memory and write it
+// past the page cache.  False if the filesystem refuses O_DIRECT.
+bool writeDirect(const std::string &input, const std::string &output,
+                 const std::vector<Patch> &patches, WriteTimings &timings) {
+  const int in = open(input.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (in < 0 || fstat(in, &st) != 0) errExit("Failed to open " + input);
+  const int out = open(output.c_str(),
+                       O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT | O_CLOEXEC,
+                       st.st_mode & 07777);
+  if (out < 0) {
+    close(in);
+    if (errno == EINVAL) return false;
+    errExit("Failed to open " + output);
+  }
+  fchmod(out, st.st_mode & 07777);
+
+  const auto start = Clock::now();
+  std::unique_ptr<char, decltype(&free)> buf(
+      (char *)aligned_alloc(directAlign, directChunk), free);
+  if (!buf) errExit("Out of memory.");
+  double patchSeconds = 0;
+  uint64_t offset = 0;
+  for (;;) {
+    size_t n = 0;
+    for (ssize_t r; n < directChunk; n += r) {
+      r = pread(in, buf.get() + n, directChunk - n, offset + n);
+      if (r < 0 && errno == EINTR) {
+        r = 0;
+        continue;
+      }
+      if (r < 0) errExit("Failed to read " + input);
+      if (r == 0) break;
+    }
+    if (n == 0) break;
+    TraceSpan chunk("direct write");
+    const auto patchStart = Clock::now();
+    applyPatches(patches, buf.get(), offset, n);
+    patchSeconds += since(patchStart);
+    // The tail is padded to a block and truncated below.
+    const size_t padded = (n + directAlign - 1) & ~(directAlign - 1);
+    memset(buf.get() + n, 0, padded - n);
+    if (pwrite(out, buf.get(), padded, offset) != (ssize_t)padded)
+      errExit("Failed to write " + output);
+    offset += n;
+    if (n < directChunk) break;
+  }
+  if (offset != (uint64_t)st.st_size)
+    errExit("Failed to read " + input + ", it changed while being copied.");
+  if (ftruncate(out, offset) != 0) errExit("Failed to truncate " + output);
+  close(in);
+  close(out);
+  timings.copy += since(start) - patchSeconds;
+  timings.patch += patchSeconds;
+  timings.bytes += offset;
+  return true;
+}
+}  // namespace
+
+bool parseCachePolicy(const std::string &name, CachePolicy &policy) {
+  for (CachePolicy p :
+       {CachePolicy::Keep, CachePolicy::Drop, CachePolicy::Direct})
+    if (name == cachePolicyName(p)) {
+      policy = p;
+      return true;
+    }
+  return false;
+}
+
+const char *cachePolicyName(CachePolicy policy) {
+  switch (policy) {
+    case CachePolicy::Keep:
+      return "keep";
+    case CachePolicy::Drop:
+      return "drop";
+    case CachePolicy::Direct:
+      return "direct";
+  }
+  return "?";
+}
+
+void PatchRecorder::write(const std::vector<Patch> &batch) {
+  for (const auto &[offset, bytes] : batch) {
+    if (!patches.empty() &&
+        patches.back().first + patches.back().second.size() == offset)
+      patches.back().second += bytes;
+    else
+      patches.emplace_back(offset, bytes);
+  }
+}
+
+FileSink::FileSink(const std::string &path)
+    : path(path), fd(open(path.c_str(), O_WRONLY | O_CLOEXEC)) {
+  if (fd < 0) errExit("Failed to open " + path);
+}
+
+FileSink::~FileSink() { close(fd); }
+
+void FileSink::write(const std::vector<Patch> &batch) {
+  TraceSpan span("patch", path);
+  writeRuns(fd, batch, path);
+}
+
+void MemorySink::write(const std::vector<Patch> &batch) {
+  applyPatches(batch, image.data(), offset, image.size());
+}
+
+void WriteTimings::print(std::ostream &out, CachePolicy policy) const {
+  const double total = copy + patch + flush;
+  out << "Timings: wrote " << files << " files, " << std::fixed
+      << std::setprecision(1) << bytes / (1024.0 * 1024) << " MiB ("
+      << cachePolicyName(policy) << ") in " << std::setprecision(3) << total
+      << " s: copy " << copy << " s, patch " << patch << " s, flush " << flush
+      << " s";
+  if (total > 0)
+    out << ", " << std::setprecision(1) << bytes / total / (1024 * 1024)
+        << " MiB/s";
+  out << std::defaultfloat << std::endl;
+}
+
+void writeVariant(const std::string &input, const std::string &output,
+                  std::vector<Patch> patches, CachePolicy policy,
+                  WriteTimings &timings) {
+  TraceSpan span("write", output);
+  std::sort(patches.begin(), patches.end());
+  ++timings.files;
+  static std::atomic<bool> warned{false};
+  if (policy == CachePolicy::Direct) {
+    if (writeDirect(input, output, patches, timings)) return;
+    if (!warned.exchange(true))
+      std::cerr << "O_DIRECT is not supported for " << output
+                << ", dropping written pages instead." << std::endl;
+    policy = CachePolicy::Drop;
+  }
+
+  auto start = Clock::now();
+  {
+    TraceSpan copy("copy");
+    std::filesystem::copy_file(
+        input, output, std::filesystem::copy_options::overwrite_existing);
+  }
+  timings.copy += since(start);
+  timings.bytes += std::filesystem::file_size(output);
+
+  start = Clock::now();
+  const int fd = open(output.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) errExit("Failed to open " + output);
+  {
+    TraceSpan patch("patch");
+    writeRuns(fd, patches, output);
+  }
+  timings.patch += since(start);
+
+  if (policy == CachePolicy::Drop) {
+    // Dirty pages cannot be dropped: write them back first.
+    start = Clock::now();
+    TraceSpan flush("flush");
+    sync_file_range(fd, 0, 0,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    timings.flush += since(start);
+  }
+  close(fd);
+}
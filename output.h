@@ -0,0 +1,77 @@
+#ifndef RELOCSWAP_OUTPUT_H
+#define RELOCSWAP_OUTPUT_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// How much of the files relocswap writes, and of the inputs it scans in batch
+// mode, stays in the page cache.  Campaigns write many short-lived variants
+// that would otherwise evict the libraries everything else runs.
+enum class CachePolicy {
+  Keep,    // Plain writes and reads.
+  Drop,    // Write back, then drop the pages of outputs and batch inputs.
+  Direct,  // Write outputs with O_DIRECT, drop batch inputs.
+};
+bool parseCachePolicy(const std::string &name, CachePolicy &policy);
+const char *cachePolicyName(CachePolicy policy);
+
+// A write at an offset of an output file.
+using Patch = std::pair<uint64_t, std::string>;
+
+// Where the edits of an output file go: Elf::applySwaps, writeDynamic and
+// the rewriters hand over batches of patches sorted by offset and not
+// overlapping, and each sink applies them the cheapest way it has.
+class PatchSink {
+ public:
+  virtual ~PatchSink() = default;
+  virtual void write(const std::vector<Patch> &batch) = 0;
+};
+
+// Collects the patches, adjacent ones merged, for writeVariant or a pack.
+class PatchRecorder : public PatchSink {
+ public:
+  std::vector<Patch> patches;
+  void write(const std::vector<Patch> &batch) override;
+};
+
+// Patches a file in place, each run of adjacent patches with one pwritev.
+class FileSink : public PatchSink {
+  std::string path;
+  int fd;
+
+ public:
+  explicit FileSink(const std::string &path);
+  ~FileSink();
+  FileSink(const FileSink &) = delete;
+  FileSink &operator=(const FileSink &) = delete;
+  void write(const std::vector<Patch> &batch) override;
+};
+
+// Patches the bytes [offset, offset + image.size()) of a file held in
+// memory, dropping what falls outside: the reference for the other sinks.
+class MemorySink : public PatchSink {
+ public:
+  uint64_t offset;
+  std::string image;
+  MemorySink(uint64_t offset, std::string image)
+      : offset(offset), image(std::move(image)) {}
+  void write(const std::vector<Patch> &batch) override;
+};
+
+// Time spent writing outputs, for --timings.
+struct WriteTimings {
+  uint64_t files = 0, bytes = 0;
+  double copy = 0, patch = 0, flush = 0;  // Seconds.
+  void print(std::ostream &out, CachePolicy policy) const;
+};
+
+// Write a copy of 'input' with 'patches' applied to 'output'.  Direct writes
+// fall back to Drop on filesystems without O_DIRECT.
+void writeVariant(const std::string &input, const std::string &output,
+                  std::vector<Patch> patches, CachePolicy policy,
+                  WriteTimings &timings);
+
+#endif  // RELOCSWAP_OUTPUT_H
@@ -0,0 +1,216 @@
+#include "pack.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+#include "spawn.h"
+
+namespace {
+constexpr char headerMagic[8] = {'R', 'S', 'P', 'A', 'C', 'K', 0, 1};
+constexpr char trailerMagic[8] = {'R', 'S', 'P', 'A', 'C', 'K', 'I', 'X'};
+constexpr uint64_t maxId = 1ULL << 32;
+
+uint64_t align8(uint64_t n) { return (n + 7) & ~7ULL; }
+
+// FNV-1a.
+uint32_t checksum(const char *data, size_t size) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < size; ++i)
+    hash = (hash ^ (unsigned char)data[i]) * 16777619u;
+  return hash;
+}
+
+void putVarint(std::string &out, uint64_t value) {
+  for (; value >= 0x80; value >>= 7) out += (char)(value | 0x80);
+  out += (char)value;
+}
+
+bool getVarint(const char *&p, const char *end, uint64_t &value) {
+  value = 0;
+  for (unsigned shift = 0; p < end && shift < 64; shift += 7) {
+    const unsigned char c = *p++;
+    value |= (uint64_t)(c & 0x7f) << shift;
+    if (!(c & 0x80)) return true;
+  }
+  return false;
+}
+
+void encodeSwaps(std::string &out, const std::vector<Swap> &swaps) {
+  putVarint(out, swaps.size());
+  size_t prev = 0;
+  for (const auto &[slot, src] : swaps) {
+    const int64_t delta = (int64_t)src - (int64_t)slot;
+    putVarint(out, slot - prev);
+    putVarint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+    prev = slot;
+  }
+}
+
+bool decodeSwaps(const char *&p, const char *end, std::vector<Swap> &swaps) {
+  uint64_t n, slot = 0;
+  if (!getVarint(p, end, n) || n > (uint64_t)(end - p)) return false;
+  swaps.resize(n);
+  for (auto &swap : swaps) {
+    uint64_t delta, zigzag;
+    if (!getVarint(p, end, delta) || !getVarint(p, end, zigzag)) return false;
+    slot += delta;
+    swap = {slot, slot + ((int64_t)(zigzag >> 1) ^ -(int64_t)(zigzag & 1))};
+  }
+  return true;
+}
+}  // namespace
+
+PackHeader packHeader(const std::string &path, const Elf &elf) {
+  PackHeader header = {};
+  memcpy(header.magic, headerMagic, sizeof(headerMagic));
+  std::ifstream fp(path, std::ios::binary);
+  if (!fp) errExit("Failed to open " + path);
+  StreamHash hash;
+  std::vector<char> buf(1 << 20);
+  while (fp.read(buf.data(), buf.size()) || fp.gcount()) {
+    hash.update(buf.data(), fp.gcount());
+    header.baseSize += fp.gcount();
+  }
+  header.baseHash = hash.digest();
+  fp.clear();
+  const std::string buildId = readBuildId(fp, elf);
+  strncpy(header.buildId, buildId.c_str(), sizeof(header.buildId) - 1);
+  const std::string abs = std::filesystem::absolute(path);
+  strncpy(header.path, abs.c_str(), sizeof(header.path) - 1);
+  return header;
+}
+
+PackReader::PackReader(const std::string &fname) {
+  const int fd = open(fname.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0) errExit("Failed to open pack " + fname);
+  size = st.st_size;
+  void *map = size >= sizeof(PackHeader)
+                  ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0)
+                  : MAP_FAILED;
+  close(fd);
+  if (map == MAP_FAILED) errExit("Failed to map pack " + fname);
+  data = (const char *)map;
+  if (memcmp(header().magic, headerMagic, sizeof(headerMagic)) != 0)
+    errExit(fname + " is not a variant pack.");
+
+  PackTrailer trailer;
+  if (size >= sizeof(PackHeader) + sizeof(trailer)) {
+    memcpy(&trailer, data + size - sizeof(trailer), sizeof(trailer));
+    if (memcmp(trailer.magic, trailerMagic, sizeof(trailerMagic)) == 0 &&
+        trailer.indexOffset >= sizeof(PackHeader) &&
+        trailer.indexOffset % 8 == 0 && trailer.count < maxId &&
+        trailer.indexOffset + trailer.count * 8 + sizeof(trailer) == size) {
+      index = (const uint64_t *)(data + trailer.indexOffset);
+      indexCount = trailer.count;
+      recordsEnd = trailer.indexOffset;
+      return;
+    }
+  }
+
+  // No index: the writer did not finish.  Records end at the first torn one.
+  uint64_t pos = sizeof(PackHeader);
+  for (PackRecord rec; pos + sizeof(rec) <= size;) {
+    memcpy(&rec, data + pos, sizeof(rec));
+    const char *plan = data + pos + sizeof(rec);
+    if (rec.size > size - pos - sizeof(rec) || rec.id >= maxId ||
+        checksum(plan, rec.size) != rec.check)
+      break;
+    if (rec.id >= scanned.size()) scanned.resize(rec.id + 1);
+    scanned[rec.id] = pos;
+    pos += align8(sizeof(rec) + rec.size);
+  }
+  index = scanned.data();
+  indexCount = scanned.size();
+  recordsEnd = std::min<uint64_t>(pos, size);
+}
+
+PackReader::~PackReader() { munmap((void *)data, size); }
+
+bool PackReader::get(uint64_t id, PackEntry &entry) const {
+  if (id >= indexCount || !index[id]) return false;
+  const std::string corrupt =
+      "Corrupt variant " + std::to_string(id) + " in the pack.";
+  const uint64_t pos = index[id];
+  PackRecord rec;
+  // The index is trusted no more than the records: both come from the file.
+  if (pos < sizeof(PackHeader) || pos > recordsEnd ||
+      recordsEnd - pos < sizeof(rec))
+    errExit(corrupt);
+  memcpy(&rec, data + pos, sizeof(rec));
+  const char *p = data + pos + sizeof(rec);
+  if (rec.size > recordsEnd - pos - sizeof(rec) ||
+      checksum(p, rec.size) != rec.check)
+    errExit(corrupt);
+  const char *end = p + rec.size;
+  if (rec.id != id || !decodeSwaps(p, end, entry.plan.rel) ||
+      !decodeSwaps(p, end, entry.plan.rela))
+    errExit(corrupt);
+  entry.outcome = rec.outcome;
+  entry.detail = rec.detail;
+  return true;
+}
+
+PackWriter::PackWriter(const std::string &fname, const PackHeader &header) {
+  struct stat st;
+  if (stat(fname.c_str(), &st) == 0 && st.st_size > 0) {
+    PackReader old(fname);
+    if (old.header().baseSize != header.baseSize ||
+        old.header().baseHash != header.baseHash)
+      errExit("Pack " + fname + " holds variants of another binary, " +
+              old.header().path);
+    offsets.assign(old.count(), 0);
+    for (uint64_t id = 0; id < old.count(); ++id) offsets[id] = old.offset(id);
+    end = old.dataEnd();
+  }
+  fd = open(fname.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) errExit("Failed to open pack " + fname);
+  if (end == 0) {
+    if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+      errExit("Failed to write pack " + fname);
+    end = sizeof(header);
+  }
+  firstFree = offsets.size();
+  // Drop the index, rewritten on close.
+  if (ftruncate(fd, end) != 0) errExit("Failed to truncate pack " + fname);
+}
+
+PackWriter::~PackWriter() {
+  if (fd < 0) return;
+  PackTrailer trailer = {end, offsets.size(), {}};
+  memcpy(trailer.magic, trailerMagic, sizeof(trailerMagic));
+  const size_t indexSize = offsets.size() * sizeof(uint64_t);
+  if (pwrite(fd, offsets.data(), indexSize, end) != (ssize_t)indexSize ||
+      pwrite(fd, &trailer, sizeof(trailer), end + indexSize) !=
+          sizeof(trailer))
+    std::cerr << "Failed to write the pack index." << std::endl;
+  close(fd);
+}
+
+void PackWriter::append(uint64_t id, const SwapPlan &plan, int outcome,
+                        int detail) {
+  if (id >= maxId) errExit("Variant id out of range for a pack.");
+  std::string buf(sizeof(PackRecord), '\0');
+  encodeSwaps(buf, plan.rel);
+  encodeSwaps(buf, plan.rela);
+  PackRecord rec = {id, (uint32_t)(buf.size() - sizeof(rec)), 0, outcome,
+                    detail};
+  rec.check = checksum(buf.data() + sizeof(rec), rec.size);
+  memcpy(buf.data(), &rec, sizeof(rec));
+  buf.resize(align8(buf.size()));
+
+  // Reserve the space, then write without a lock.
+  const uint64_t offset = end.fetch_add(buf.size());
+  if (pwrite(fd, buf.data(), buf.size(), offset) != (ssize_t)buf.size())
+    errExit("Failed to write to the pack.");
+  std::lock_guard<std::mutex> lock(mutex);
+  if (id >= offsets.size()) offsets.resize(id + 1);
+  offsets[id] = offset;
+}
@@ -0,0 +1,92 @@
+#ifndef RELOCSWAP_PACK_H
+#define RELOCSWAP_PACK_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "elffile.h"
+
+// A variant pack: the swap plans of many variants of one binary in a single
+// append-only file, instead of a file per variant.
+//
+//   header   PackHeader, identifying the base binary
+//   records  PackRecord and its plan, 8-byte aligned, in any order
+//   index    uint64_t offset of the record of each id, 0 if none
+//   trailer  PackTrailer
+//
+// Plans are encoded as varints: the count of moved Rel relocs, then per reloc
+// its slot minus the previous slot and its source minus its slot (zigzag),
+// then the same for the Rela relocs.  The index and trailer are written when
+// the writer closes; a pack without them is read by scanning the records.
+struct PackHeader {
+  char magic[8];
+  uint64_t baseSize;
+  uint64_t baseHash;  // StreamHash of the base binary.
+  char buildId[64];   // Hex, NUL-terminated, "" if none.
+  char path[4008];    // Of the base binary when the pack was created.
+};
+static_assert(sizeof(PackHeader) == 4096, "PackHeader is one page.");
+
+struct PackRecord {
+  uint64_t id;
+  uint32_t size;     // Of the encoded plan following the record.
+  uint32_t check;    // Of the encoded plan, to find torn records.
+  int32_t outcome;   // A campaign Outcome, -1 if not run.
+  int32_t detail;
+};
+
+struct PackTrailer {
+  uint64_t indexOffset;
+  uint64_t count;  // Of index entries.
+  char magic[8];
+};
+
+// The identity of a base binary, as recorded in a pack.
+PackHeader packHeader(const std::string &path, const Elf &elf);
+
+// Appends variants to a pack, from any number of threads.  An existing pack
+// of the same base is extended.
+class PackWriter {
+  int fd = -1;
+  std::atomic<uint64_t> end{0};
+  std::mutex mutex;
+  std::vector<uint64_t> offsets;
+  uint64_t firstFree = 0;
+
+ public:
+  PackWriter(const std::string &fname, const PackHeader &header);
+  ~PackWriter();  // Writes the index.
+  void append(uint64_t id, const SwapPlan &plan, int outcome, int detail);
+  // Above every id packed when the writer was opened.
+  uint64_t firstFreeId() const { return firstFree; }
+};
+
+struct PackEntry {
+  SwapPlan plan;
+  int outcome = -1;
+  int detail = 0;
+};
+
+// A mapped pack, with constant time lookup by variant id.
+class PackReader {
+  const char *data = nullptr;
+  size_t size = 0;
+  const uint64_t *index = nullptr;
+  uint64_t indexCount = 0;
+  uint64_t recordsEnd = 0;
+  std::vector<uint64_t> scanned;  // Without an index.
+
+ public:
+  explicit PackReader(const std::string &fname);
+  ~PackReader();
+  const PackHeader &header() const { return *(const PackHeader *)data; }
+  uint64_t count() const { return indexCount; }  // Ids are below count().
+  bool get(uint64_t id, PackEntry &entry) const;  // False if not packed.
+  uint64_t offset(uint64_t id) const { return index[id]; }
+  uint64_t dataEnd() const { return recordsEnd; }  // Of the records.
+};
+
+#endif  // RELOCSWAP_PACK_H
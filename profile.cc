@@ -0,0 +1,222 @@
+#include "profile.h"
+
+#include <elf.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+#include "batch.h"
+#include "elffile.h"
+#include "spawn.h"
+
+namespace {
+// Relative cost of the reloc work, in units of one RELATIVE reloc.  A symbol
+// lookup walks the hash tables of every object in scope, a cached one only
+// redoes the previous result.
+constexpr double relativeCost = 1;
+constexpr double boundCost = 3;  // A symbol reloc served by the cache.
+constexpr double lookupCost = 30;
+
+// The objects that were loaded, from the LD_DEBUG=libs output: the last file
+// tried for each library found, and the objects whose init was called.
+std::vector<std::string> loadedObjects(const std::string &err) {
+  std::vector<std::string> paths;
+  std::string tried;
+  auto add = [&](const std::string &path) {
+    if (!path.empty() &&
+        std::find(paths.begin(), paths.end(), path) == paths.end())
+      paths.push_back(path);
+  };
+  std::istringstream lines(err);
+  for (std::string line; std::getline(lines, line);) {
+    size_t pos;
+    if ((pos = line.find("trying file=")) != std::string::npos) {
+      tried = line.substr(pos + strlen("trying file="));
+    } else if (line.find("find library=") != std::string::npos) {
+      add(tried);
+      tried.clear();
+    } else if ((pos = line.find("calling init: ")) != std::string::npos) {
+      add(tried);
+      tried.clear();
+      add(line.substr(pos + strlen("calling init: ")));
+    }
+  }
+  add(tried);
+  return paths;
+}
+
+ObjectRelocs countRelocs(const Elf &elf, bool bindNow) {
+  ObjectRelocs counts;
+  bindNow |= elf.bindNow();
+  uint32_t lastSym = 0;
+  for (const auto &rel : elf.relocations()) {
+    const RelocKind kind = relocKind(elf.machine(), rel.type);
+    if (kind == RelocKind::JumpSlot && !bindNow) continue;  // Bound lazily.
+    switch (kind) {
+      case RelocKind::Relative:
+        ++counts.relative;
+        break;
+      case RelocKind::GlobDat:
+        ++counts.globDat;
+        break;
+      case RelocKind::JumpSlot:
+        ++counts.jumpSlot;
+        break;
+      default:
+        ++counts.other;
+    }
+    if (rel.sym != 0 && rel.sym != lastSym) ++counts.lookups;
+    if (rel.sym != 0) lastSym = rel.sym;
+  }
+  return counts;
+}
+}  // namespace
+
+double ObjectRelocs::cost() const {
+  const uint64_t symbolic = globDat + jumpSlot + other;
+  return relative * relativeCost + lookups * lookupCost +
+         (symbolic - std::min(symbolic, lookups)) * boundCost;
+}
+
+bool profileLoad(const std::vector<std::string> &argv, int runs,
+                 LoadProfile &profile) {
+  if (argv.empty() || runs <= 0) return false;
+  profile.command.clear();
+  for (const auto &arg : argv)
+    profile.command += (profile.command.empty() ? "" : " ") + arg;
+
+  // Run the command on a pool of workers.  Each run is spawned with its
+  // pipes closed on exec, so a run does not hold those of the others open.
+  std::vector<LoaderStats> measured;
+  std::string firstErr;
+  std::mutex lock;
+  parallelFor(runs, [&](size_t) {
+    std::string err;
+    LoaderStats stats;
+    if (!runLoaderDebug(argv, "statistics,libs", {}, err) ||
+        !parseLoaderStats(err, stats))
+      return;
+    std::lock_guard<std::mutex> guard(lock);
+    measured.push_back(stats);
+    if (firstErr.empty()) firstErr = std::move(err);
+  });
+  if (measured.empty()) return false;
+  profile.runs = measured.size();
+  profile.stats = medianStats(measured);
+
+  // Count the relocs of each loaded object.
+  const char *bindNowEnv = getenv("LD_BIND_NOW");
+  const bool bindNow = bindNowEnv && *bindNowEnv;
+  std::vector<std::string> paths = loadedObjects(firstErr);
+  paths.insert(paths.begin(), findProgram(argv[0]));
+  double totalCost = 0;
+  for (const auto &path : paths) {
+    if (path.find("/ld-linux") != std::string::npos) continue;  // Self reloc.
+    std::ifstream fp(path, std::ios::binary);
+    if (!fp) continue;
+    ObjectProfile object;
+    try {
+      RecoverErrors recover;
+      std::unique_ptr<Elf> elf(parseElf(fp));
+      object.relocs = countRelocs(*elf, bindNow);
+    } catch (const InputError &e) {
+      std::cerr << "Skipped " << path << ": " << e.what() << std::endl;
+      continue;
+    }
+    object.path = std::filesystem::weakly_canonical(path);
+    totalCost += object.relocs.cost();
+    profile.objects.push_back(object);
+  }
+  for (auto &object : profile.objects)
+    object.cycles = totalCost > 0 ? profile.stats.relocCycles *
+                                        object.relocs.cost() / totalCost
+                                  : 0;
+  std::stable_sort(
+      profile.objects.begin(), profile.objects.end(),
+      [](const auto &a, const auto &b) { return a.cycles > b.cycles; });
+  return true;
+}
+
+static void printObjects(const std::vector<ObjectProfile> &objects,
+                         bool withLoads) {
+  char line[256];
+  snprintf(line, sizeof(line), "  %10s %9s %9s %9s %9s %9s %12s%s",
+           "RELATIVE", "GLOB_DAT", "JUMP_SLOT", "Other", "Lookups", "Cost",
+           "Est. cycles", withLoads ? "   Loads  Object" : "  Object");
+  std::cout << line << std::endl;
+  ObjectRelocs total;
+  for (const auto &object : objects) {
+    const ObjectRelocs &r = object.relocs;
+    snprintf(line, sizeof(line), "  %10lu %9lu %9lu %9lu %9lu %9.0f %12.0f",
+             (unsigned long)r.relative, (unsigned long)r.globDat,
+             (unsigned long)r.jumpSlot, (unsigned long)r.other,
+             (unsigned long)r.lookups, r.cost(), object.cycles);
+    std::cout << line;
+    if (withLoads) {
+      snprintf(line, sizeof(line), " %7u", object.loads);
+      std::cout << line;
+    }
+    std::cout << "  " << object.path << std::endl;
+    total.relative += r.relative;
+    total.globDat += r.globDat;
+    total.jumpSlot += r.jumpSlot;
+    total.other += r.other;
+    total.lookups += r.lookups;
+  }
+
+  // Which kinds of work dominate, by the cost model.
+  const double cost = total.cost();
+  if (cost <= 0) return;
+  const uint64_t symbolic = total.globDat + total.jumpSlot + total.other;
+  snprintf(line, sizeof(line),
+           "  By kind: RELATIVE %.1f%%, symbol lookups %.1f%%, cached "
+           "symbol relocs %.1f%%",
+           100 * total.relative * relativeCost / cost,
+           100 * total.lookups * lookupCost / cost,
+           100 * (symbolic - std::min(symbolic, total.lookups)) * boundCost /
+               cost);
+  std::cout << line << std::endl;
+}
+
+void printLoadProfile(const LoadProfile &profile) {
+  const LoaderStats &stats = profile.stats;
+  std::cout << profile.command << " (median of " << profile.runs
+            << " runs): " << stats.startupCycles << " startup cycles, "
+            << stats.relocCycles << " relocating, " << stats.relocations
+            << " symbol relocs (" << stats.relocationsFromCache
+            << " from cache), " << stats.relativeRelocations << " relative"
+            << std::endl;
+  printObjects(profile.objects, false);
+}
+
+void printFleetProfile(const std::vector<LoadProfile> &profiles) {
+  std::map<std::string, ObjectProfile> byPath;
+  uint64_t startup = 0, reloc = 0;
+  for (const auto &profile : profiles) {
+    startup += profile.stats.startupCycles;
+    reloc += profile.stats.relocCycles;
+    for (const auto &object : profile.objects) {
+      auto [it, inserted] = byPath.emplace(object.path, object);
+      if (inserted) continue;
+      it->second.cycles += object.cycles;
+      ++it->second.loads;
+    }
+  }
+  std::vector<ObjectProfile> objects;
+  for (auto &[path, object] : byPath) objects.push_back(object);
+  std::stable_sort(objects.begin(), objects.end(), [](const auto &a,
+                                                      const auto &b) {
+    return a.cycles > b.cycles;
+  });
+  std::cout << "Fleet (" << profiles.size() << " commands): " << startup
+            << " startup cycles, " << reloc << " relocating" << std::endl;
+  printObjects(objects, true);
+}
@@ -0,0 +1,44 @@
+#ifndef RELOCSWAP_PROFILE_H
+#define RELOCSWAP_PROFILE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "loadstats.h"
+
+// The relocs an object makes the loader process at startup.
+struct ObjectRelocs {
+  uint64_t relative = 0;
+  uint64_t globDat = 0;
+  uint64_t jumpSlot = 0;  // Only those bound at startup.
+  uint64_t other = 0;
+  uint64_t lookups = 0;  // Symbol lookups not served by the loader's cache.
+  double cost() const;   // In the units of the cost model.
+};
+
+struct ObjectProfile {
+  std::string path;
+  ObjectRelocs relocs;
+  double cycles = 0;   // Estimated share of the relocation time.
+  unsigned loads = 1;  // Commands loading the object, in a fleet.
+};
+
+struct LoadProfile {
+  std::string command;
+  int runs = 0;
+  LoaderStats stats;  // Medians over the runs.
+  std::vector<ObjectProfile> objects;
+};
+
+// Run 'argv' 'runs' times, several at once, with the loader's statistics and
+// library search output enabled.  The relocation time is divided among the
+// loaded objects by the cost of their relocs.
+bool profileLoad(const std::vector<std::string> &argv, int runs,
+                 LoadProfile &profile);
+void printLoadProfile(const LoadProfile &profile);
+// Merge the objects of several profiles, by path, and print the fleet table.
+void printFleetProfile(const std::vector<LoadProfile> &profiles);
+
+#endif  // RELOCSWAP_PROFILE_H
@@ -0,0 +1,64 @@
+#ifndef RELOCSWAP_RADIX_H
+#define RELOCSWAP_RADIX_H
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include "batch.h"
+
+// Sort 'items' by key(item), a uint64_t, keeping equal keys in order: an LSD
+// radix sort a byte at a time, skipping the bytes no two keys differ in, for
+// the tables of millions of relocs of big binaries.  Chunks of the input are
+// counted and scattered by a pool of workers.
+template <class T, class KeyFn>
+void radixSort(std::vector<T> &items, KeyFn key) {
+  constexpr size_t chunkSize = 1 << 16;
+  const size_t n = items.size();
+  if (n < 2) return;
+  const size_t chunks = (n + chunkSize - 1) / chunkSize;
+  auto chunkBegin = [&](size_t c) { return c * chunkSize; };
+  auto chunkEnd = [&](size_t c) { return std::min(n, (c + 1) * chunkSize); };
+
+  // The bits set in all keys and in any key.
+  std::vector<std::pair<uint64_t, uint64_t>> bits(chunks, {~0ULL, 0});
+  parallelFor(chunks, [&](size_t c) {
+    for (size_t i = chunkBegin(c); i < chunkEnd(c); ++i) {
+      const uint64_t k = key(items[i]);
+      bits[c].first &= k;
+      bits[c].second |= k;
+    }
+  });
+  uint64_t all = ~0ULL, any = 0;
+  for (const auto &[a, o] : bits) all &= a, any |= o;
+  const uint64_t varying = any & ~all;
+
+  std::vector<T> sorted(n);
+  std::vector<std::array<size_t, 256>> counts(chunks);
+  for (unsigned shift = 0; shift < 64; shift += 8) {
+    if (!((varying >> shift) & 0xff)) continue;
+    parallelFor(chunks, [&](size_t c) {
+      counts[c].fill(0);
+      for (size_t i = chunkBegin(c); i < chunkEnd(c); ++i)
+        ++counts[c][(key(items[i]) >> shift) & 0xff];
+    });
+    // Where each chunk puts each byte value: by value, then by chunk, so
+    // equal keys stay in order.
+    size_t pos = 0;
+    for (unsigned b = 0; b < 256; ++b)
+      for (auto &count : counts) {
+        const size_t k = count[b];
+        count[b] = pos;
+        pos += k;
+      }
+    parallelFor(chunks, [&](size_t c) {
+      auto &next = counts[c];
+      for (size_t i = chunkBegin(c); i < chunkEnd(c); ++i)
+        sorted[next[(key(items[i]) >> shift) & 0xff]++] = std::move(items[i]);
+    });
+    items.swap(sorted);
+  }
+}
+
+#endif  // RELOCSWAP_RADIX_H
@@ -0,0 +1,312 @@
+#include "reach.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string_view>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "demangle.h"
+
+namespace {
+constexpr size_t topCount = 10;
+
+int32_t rel32(const char *p) {
+  int32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint32_t word32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+bool isPlt(const Section &sec) {
+  return (sec.flags & SHF_EXECINSTR) && sec.name.compare(0, 4, ".plt") == 0;
+}
+
+// Maps code addresses to GOT slots, and GOT slots to the relocs of each.
+class Resolver {
+  std::vector<std::pair<uint64_t, uint64_t>> stubs;  // (stub, GOT slot).
+  std::vector<std::pair<uint64_t, uint32_t>> slots;  // (address, reloc).
+  uint64_t pltLo = UINT64_MAX, pltHi = 0;
+  uint64_t gotLo = UINT64_MAX, gotHi = 0;
+  std::vector<uint32_t> &refs;
+
+ public:
+  explicit Resolver(std::vector<uint32_t> &refs) : refs(refs) {}
+
+  void addSlot(uint64_t addr, uint32_t reloc) {
+    slots.emplace_back(addr, reloc);
+    gotLo = std::min(gotLo, addr);
+    gotHi = std::max(gotHi, addr + 1);
+  }
+  void addStub(uint64_t stub, uint64_t slot, uint64_t size) {
+    stubs.emplace_back(stub, slot);
+    pltLo = std::min(pltLo, stub);
+    pltHi = std::max(pltHi, stub + size);
+  }
+  void finish() {
+    std::sort(slots.begin(), slots.end());
+    std::sort(stubs.begin(), stubs.end());
+    // Keep the first slot found in each stub.
+    stubs.erase(std::unique(stubs.begin(), stubs.end(),
+                            [](const auto &a, const auto &b) {
+                              return a.first == b.first;
+                            }),
+                stubs.end());
+  }
+
+  // A load of the GOT slot at 'addr'.
+  void load(uint64_t addr) {
+    if (addr < gotLo || addr >= gotHi) return;
+    auto it = std::lower_bound(slots.begin(), slots.end(),
+                               std::make_pair(addr, uint32_t(0)));
+    for (; it != slots.end() && it->first == addr; ++it) ++refs[it->second];
+  }
+  // A call or jump to 'addr'.
+  void branch(uint64_t addr) {
+    if (addr < pltLo || addr >= pltHi) return;
+    auto it = std::lower_bound(stubs.begin(), stubs.end(),
+                               std::make_pair(addr, uint64_t(0)));
+    if (it != stubs.end() && it->first == addr) load(it->second);
+  }
+};
+
+// The GOT slot an x86-64 'jmp *slot(%rip)' at 'code[i]' loads, if there is one.
+bool x86SlotJump(std::string_view code, size_t i, uint64_t addr,
+                 uint64_t &slot) {
+  if (i + 6 > code.size() || code[i] != '\xff' || code[i + 1] != '\x25')
+    return false;
+  slot = addr + i + 6 + rel32(&code[i + 2]);
+  return true;
+}
+
+void x86Stubs(std::string_view code, const Section &sec, Resolver &res) {
+  const uint64_t entSize = sec.entSize ? sec.entSize : 16;
+  uint64_t slot;
+  for (size_t i = 0; i + 6 <= code.size(); ++i)
+    if (x86SlotJump(code, i, sec.addr, slot))
+      res.addStub(sec.addr + i / entSize * entSize, slot, entSize);
+}
+
+// Decode the instruction that may start, or end with an opcode, at 'code[i]'.
+inline void x86Candidate(std::string_view code, size_t i, uint64_t addr,
+                         Resolver &res) {
+  const char *p = code.data() + i;
+  const size_t left = code.size() - i;
+  switch ((uint8_t)p[0]) {
+    case 0xe8:  // call rel32
+    case 0xe9:  // jmp rel32
+      if (left >= 5) res.branch(addr + i + 5 + rel32(p + 1));
+      break;
+    case 0xff:  // call/jmp *rel32(%rip)
+      if (left >= 6 && (p[1] == '\x15' || p[1] == '\x25'))
+        res.load(addr + i + 6 + rel32(p + 2));
+      break;
+    case 0x8b:  // REX.W mov rel32(%rip), reg
+      if (i > 0 && left >= 6 && ((uint8_t)p[-1] & 0xf8) == 0x48 &&
+          ((uint8_t)p[1] & 0xc7) == 0x05)
+        res.load(addr + i + 6 + rel32(p + 2));
+      break;
+  }
+}
+
+void x86Scan(std::string_view code, uint64_t addr, Resolver &res) {
+  size_t i = 0;
+#ifdef __SSE2__
+  // The opcodes above are a small fraction of the bytes: find them 16 bytes at
+  // a time, with the ModRM byte of the RIP-relative forms.
+  const __m128i one = _mm_set1_epi8(1);
+  const __m128i callJmp = _mm_set1_epi8((char)0xe9);  // 0xe8 | 1
+  const __m128i indirect = _mm_set1_epi8((char)0xff);
+  const __m128i mov = _mm_set1_epi8((char)0x8b);
+  const __m128i ripMask = _mm_set1_epi8((char)0xc7);
+  const __m128i rip = _mm_set1_epi8(0x05);
+  for (; i + 17 <= code.size(); i += 16) {
+    const __m128i v = _mm_loadu_si128((const __m128i *)(code.data() + i));
+    const __m128i modrm =
+        _mm_loadu_si128((const __m128i *)(code.data() + i + 1));
+    // ModRM 0x15 and 0x25, and 0x05 with any reg, are disp32(%rip).
+    const __m128i isRip = _mm_cmpeq_epi8(_mm_and_si128(modrm, ripMask), rip);
+    const __m128i hits = _mm_or_si128(
+        _mm_cmpeq_epi8(_mm_or_si128(v, one), callJmp),
+        _mm_and_si128(isRip, _mm_or_si128(_mm_cmpeq_epi8(v, indirect),
+                                          _mm_cmpeq_epi8(v, mov))));
+    for (unsigned mask = _mm_movemask_epi8(hits); mask; mask &= mask - 1)
+      x86Candidate(code, i + __builtin_ctz(mask), addr, res);
+  }
+#endif
+  for (; i < code.size(); ++i) {
+    const uint8_t op = code[i];
+    if ((op | 1) == 0xe9 || op == 0xff || op == 0x8b)
+      x86Candidate(code, i, addr, res);
+  }
+}
+
+// The address an AArch64 adrp+ldr pair starting at 'code[i]' loads from.
+bool a64SlotLoad(std::string_view code, size_t i, uint64_t addr,
+                 uint64_t &slot) {
+  const uint32_t adrp = word32(&code[i]);
+  if ((adrp & 0x9f000000) != 0x90000000) return false;
+  const uint64_t pages = (((adrp >> 5) & 0x7ffff) << 2) | ((adrp >> 29) & 3);
+  const int64_t imm = (int64_t)(pages << 43) >> 31;  // Sign extended, * 4096.
+  const uint64_t page = ((addr + i) & ~(uint64_t)0xfff) + imm;
+  // The ldr is usually next, but may be scheduled a few instructions later.
+  for (size_t j = i + 4; j < i + 20 && j + 4 <= code.size(); j += 4) {
+    const uint32_t ldr = word32(&code[j]);
+    // ldr Xt, [Xn, #imm12 * 8]
+    if ((ldr & 0xffc00000) == 0xf9400000 && ((ldr >> 5) & 31) == (adrp & 31)) {
+      slot = page + ((ldr >> 10) & 0xfff) * 8;
+      return true;
+    }
+  }
+  return false;
+}
+
+void a64Stubs(std::string_view code, const Section &sec, Resolver &res) {
+  uint64_t slot;
+  for (size_t i = 0; i + 4 <= code.size(); i += 4)
+    if (a64SlotLoad(code, i, sec.addr, slot))
+      res.addStub(sec.addr + i, slot, 16);
+}
+
+void a64Scan(std::string_view code, uint64_t addr, Resolver &res) {
+  uint64_t slot;
+  for (size_t i = 0; i + 4 <= code.size(); i += 4) {
+    const uint32_t insn = word32(&code[i]);
+    if ((insn & 0x7c000000) == 0x14000000)  // b, bl
+      res.branch(addr + i + ((int64_t)((uint64_t)insn << 38) >> 36));
+    else if (a64SlotLoad(code, i, addr, slot))
+      res.load(slot);
+  }
+}
+}  // namespace
+
+GotRanges gotRanges(const Elf &elf) {
+  GotRanges ranges;
+  for (const auto &sec : elf.sections())
+    if (sec.name.compare(0, 4, ".got") == 0)
+      ranges.emplace_back(sec.addr, sec.addr + sec.size);
+  return ranges;
+}
+
+bool isGotSlot(const Elf &elf, const GotRanges &got, const Reloc &rel) {
+  const RelocKind kind = relocKind(elf.machine(), rel.type);
+  if (kind == RelocKind::JumpSlot || kind == RelocKind::GlobDat) return true;
+  for (const auto &[begin, end] : got)
+    if (rel.offset >= begin && rel.offset < end) return true;
+  return false;
+}
+
+Reach computeReach(const std::string &path, const Elf &elf) {
+  Reach reach;
+  const uint16_t machine = elf.machine();
+  reach.supported = machine == EM_X86_64 || machine == EM_AARCH64;
+  const auto &relocs = elf.relocations();
+  reach.refs.assign(relocs.size(), 0);
+  if (!reach.supported) return reach;
+
+  const auto start = std::chrono::steady_clock::now();
+  Resolver res(reach.refs);
+  const GotRanges got = gotRanges(elf);
+  std::vector<bool> slot(relocs.size());
+  for (uint32_t i = 0; i < relocs.size(); ++i) {
+    slot[i] = isGotSlot(elf, got, relocs[i]);
+    if (slot[i]) res.addSlot(relocs[i].offset, i);
+  }
+
+  // Map the file rather than read it: the scan touches most code pages once.
+  const int fd = open(path.c_str(), O_RDONLY);
+  const off_t fileSize = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+  void *map = fileSize > 0
+                  ? mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, fd, 0)
+                  : MAP_FAILED;
+  if (fd >= 0) close(fd);
+  if (map == MAP_FAILED) errExit("Failed to map " + path);
+  madvise(map, fileSize, MADV_SEQUENTIAL);
+  std::vector<std::pair<const Section *, std::string_view>> code;
+  for (const auto &sec : elf.sections())
+    if ((sec.flags & SHF_EXECINSTR) && sec.type == SHT_PROGBITS &&
+        sec.offset + sec.size <= (uint64_t)fileSize)
+      code.emplace_back(&sec, std::string_view((const char *)map + sec.offset,
+                                               sec.size));
+  for (const auto &[sec, data] : code) {
+    if (!isPlt(*sec)) continue;
+    if (machine == EM_X86_64)
+      x86Stubs(data, *sec, res);
+    else
+      a64Stubs(data, *sec, res);
+  }
+  res.finish();
+  for (const auto &[sec, data] : code) {
+    if (isPlt(*sec)) continue;
+    reach.codeBytes += data.size();
+    if (machine == EM_X86_64)
+      x86Scan(data, sec->addr, res);
+    else
+      a64Scan(data, sec->addr, res);
+  }
+  munmap(map, fileSize);
+  reach.seconds = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - start)
+                      .count();
+
+  std::map<std::string, uint64_t> bySymbol;
+  for (size_t i = 0; i < relocs.size(); ++i) {
+    if (!slot[i]) continue;
+    ++reach.slots;
+    if (!reach.refs[i]) continue;
+    ++reach.referenced;
+    const uint32_t sym = relocs[i].sym;
+    if (sym && sym < elf.symbolCount())
+      bySymbol[elf.symbol(sym).name] += reach.refs[i];
+  }
+  reach.symbols.assign(bySymbol.begin(), bySymbol.end());
+  std::stable_sort(
+      reach.symbols.begin(), reach.symbols.end(),
+      [](const auto &a, const auto &b) { return a.second > b.second; });
+  if (reach.symbols.size() > topCount) reach.symbols.resize(topCount);
+  return reach;
+}
+
+void printReach(const std::string &path, const Reach &reach) {
+  if (!reach.supported) {
+    std::cout << path << ": code scanning supports x86-64 and AArch64 only"
+              << std::endl;
+    return;
+  }
+  std::cout << path << ": " << reach.referenced << " of " << reach.slots
+            << " GOT slots referenced from code (" << reach.codeBytes / 1024
+            << " KiB scanned in " << (uint64_t)(reach.seconds * 1000)
+            << " ms)" << std::endl;
+  for (const auto &[name, refs] : reach.symbols)
+    std::cout << "  " << demangle(name) << ": " << refs << " references"
+              << std::endl;
+}
+
+std::vector<double> reachWeights(const Elf &elf, const Reach &reach,
+                                 double unreferenced) {
+  const auto &relocs = elf.relocations();
+  std::vector<double> weights(relocs.size(), 1);
+  if (!reach.supported) return weights;
+  const GotRanges got = gotRanges(elf);
+  for (size_t i = 0; i < relocs.size(); ++i)
+    if (isGotSlot(elf, got, relocs[i]))
+      weights[i] = reach.refs[i] ? 1 + std::log2(1 + reach.refs[i])
+                                 : unreferenced;
+  return weights;
+}
@@ -0,0 +1,41 @@
+#ifndef RELOCSWAP_REACH_H
+#define RELOCSWAP_REACH_H
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "elffile.h"
+
+// Static references from code to the GOT slots of a binary, found by scanning
+// its executable sections without running it: calls and jumps into PLT stubs,
+// resolved to the GOT slot each stub loads, and RIP-relative loads of GOT
+// slots (x86-64), or adrp+ldr pairs (AArch64).
+struct Reach {
+  bool supported = false;      // The machine is x86-64 or AArch64.
+  uint64_t codeBytes = 0;      // Bytes of code scanned.
+  double seconds = 0;          // Time taken by the scan.
+  std::vector<uint32_t> refs;  // By index of Elf::relocations().
+  uint64_t slots = 0;          // Relocs of a GOT slot.
+  uint64_t referenced = 0;     // Of those, referenced from code.
+  // Referenced slots by symbol, most references first.
+  std::vector<std::pair<std::string, uint64_t>> symbols;
+};
+
+Reach computeReach(const std::string &path, const Elf &elf);
+void printReach(const std::string &path, const Reach &reach);
+
+// Address ranges [begin, end) of the .got* sections, for isGotSlot.
+using GotRanges = std::vector<std::pair<uint64_t, uint64_t>>;
+GotRanges gotRanges(const Elf &elf);
+
+// True for the relocs computeReach counts references of.
+bool isGotSlot(const Elf &elf, const GotRanges &got, const Reloc &rel);
+
+// Swap weights for Elf::setSwapWeights: GOT slots are weighted by their
+// references, or 'unreferenced'.  Other relocs have a weight of 1.
+std::vector<double> reachWeights(const Elf &elf, const Reach &reach,
+                                 double unreferenced);
+
+#endif  // RELOCSWAP_REACH_H
@@ -0,0 +1,547 @@
+#include "readelf.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+#include "demangle.h"
+
+namespace {
+constexpr uint16_t versymHidden = 0x8000;
+constexpr uint16_t versymVersion = 0x7fff;
+// Walks of version chains give up after this many links, as they may loop.
+constexpr int maxChain = 1 << 16;
+constexpr uint16_t shnX86_64LargeCommon = 0xff02;  // SHN_X86_64_LCOMMON
+
+// A symbol table, with the string table its names are in.
+struct SymTable {
+  uint64_t offset = 0, count = 0, entSize = 0;
+  uint64_t strOffset = 0, strSize = 0;
+  bool hasStrings = false;
+  bool dynamic = false;
+};
+
+struct Sym {
+  uint32_t name;
+  uint64_t value;
+  uint8_t info;
+  uint16_t shndx;
+};
+
+// How readelf shows the version of a symbol: @@ for the public default
+// version, @ for hidden and needed ones.
+enum class VersionKind { Public, Hidden, Undefined };
+
+class ReadelfDump {
+  const Elf &elf;
+  const RelocFilter &filter;
+  TextBuffer &out;
+  const char *data = nullptr;
+  uint64_t size = 0;
+  const bool is64;
+  bool mapped = false;  // Whether 'data' is unmapped with this dump.
+  // With --demangle, the names of each symbol table by section index, and
+  // those of the table of the section being dumped.
+  std::unordered_map<uint32_t, SymbolNames> demangled;
+  const SymbolNames *names = nullptr;
+  // File offsets of the DT_VERSYM, DT_VERDEF and DT_VERNEED tables, 0 if
+  // there is no such tag.
+  uint64_t versym = 0, verdef = 0, verneed = 0;
+
+  // The verdef and verneed entries of a version index, as found by readelf's
+  // walks of the chains.
+  struct DefLookup {
+    bool found = false;
+    bool base = false;
+    bool hasName = false;
+    uint32_t name = 0;
+    uint16_t maxIndex = 0;  // Largest vd_ndx seen on the way.
+  };
+  struct NeedLookup {
+    bool found = false;
+    uint32_t name = 0;
+  };
+  std::unordered_map<uint16_t, DefLookup> defs;
+  std::unordered_map<uint16_t, NeedLookup> needs;
+
+  // Warnings go out whole, as workers may print them at once.
+  static void warn(const std::string &message) {
+    std::cerr << message + "\n" << std::flush;
+  }
+  static std::string hexString(uint64_t v) {
+    char buf[20];
+    snprintf(buf, sizeof(buf), "%llx", (unsigned long long)v);
+    return buf;
+  }
+
+  template <class T>
+  bool get(uint64_t offset, T &value) const {
+    if (offset > size || sizeof(T) > size - offset) return false;
+    memcpy(&value, data + offset, sizeof(T));
+    return true;
+  }
+
+  // readelf's offset_from_vma: addresses outside of PT_LOAD segments are
+  // taken as offsets.
+  uint64_t vmaOffset(uint64_t vma) const {
+    uint64_t offset;
+    return elf.addrToOffset(vma, offset) ? offset : vma;
+  }
+
+  const DefLookup &lookupDef(uint16_t index) {
+    const auto it = defs.find(index);
+    if (it != defs.end()) return it->second;
+    DefLookup def;
+    uint64_t off = verdef;
+    Elf64_Verdef vd;  // The same layout in both classes.
+    for (int n = 0; n < maxChain; ++n) {
+      if (!get(off, vd)) memset(&vd, 0, sizeof(vd));
+      if ((vd.vd_ndx & versymVersion) > def.maxIndex)
+        def.maxIndex = vd.vd_ndx & versymVersion;
+      off += vd.vd_next;
+      if (vd.vd_ndx == index || vd.vd_next == 0) break;
+    }
+    if (vd.vd_ndx == index) {
+      def.found = true;
+      def.base = vd.vd_ndx == 1 && vd.vd_flags == VER_FLG_BASE;
+      Elf64_Verdaux aux;
+      if (get(off - vd.vd_next + vd.vd_aux, aux)) {
+        def.hasName = true;
+        def.name = aux.vda_name;
+      }
+    }
+    return defs[index] = def;
+  }
+
+  const NeedLookup &lookupNeed(uint16_t versionData) {
+    const auto it = needs.find(versionData);
+    if (it != needs.end()) return it->second;
+    NeedLookup need;
+    uint64_t off = verneed;
+    Elf64_Verneed vn;
+    Elf64_Vernaux vna = {};
+    for (int n = 0; n < maxChain; ++n) {
+      if (!get(off, vn)) {
+        vna = {};
+        break;
+      }
+      uint64_t auxOff = off + vn.vn_aux;
+      for (int m = 0; m < maxChain; ++m) {
+        if (!get(auxOff, vna)) vna = {};
+        auxOff += vna.vna_next;
+        if (vna.vna_other == versionData || vna.vna_next == 0) break;
+      }
+      if (vna.vna_other == versionData || vn.vn_next == 0) break;
+      off += vn.vn_next;
+    }
+    if (vna.vna_other == versionData) {
+      need.found = true;
+      need.name = vna.vna_name;
+    }
+    return needs[versionData] = need;
+  }
+
+  // readelf's get_symbol_version_string.
+  const char *versionString(const SymTable &table, uint64_t idx,
+                            const Sym &sym, VersionKind &kind) {
+    uint16_t versionData;
+    if (!table.dynamic || !versym || !get(versym + idx * 2, versionData) ||
+        versionData == 0)
+      return nullptr;
+    kind = versionData & versymHidden ? VersionKind::Hidden
+                                      : VersionKind::Public;
+    auto name = [&](uint32_t offset) {
+      return offset < table.strSize ? data + table.strOffset + offset
+                                    : "<corrupt>";
+    };
+    uint16_t maxIndex = 0;
+    if (sym.shndx != SHN_UNDEF && versionData != 0x8001 && verdef) {
+      const DefLookup &def = lookupDef(versionData & versymVersion);
+      maxIndex = def.maxIndex;
+      if (def.found) {
+        if (def.base) return nullptr;
+        if (def.hasName && sym.name != def.name) return name(def.name);
+      }
+    }
+    if (verneed) {
+      const NeedLookup &need = lookupNeed(versionData);
+      if (need.found) {
+        kind = VersionKind::Undefined;
+        return name(need.name);
+      }
+      if ((maxIndex || (versionData & versymVersion) != 1) &&
+          (versionData & versymVersion) > maxIndex)
+        return "<corrupt>";
+    }
+    return nullptr;
+  }
+
+  bool symbol(const SymTable &table, uint64_t idx, Sym &sym) const {
+    if (idx >= table.count) return false;
+    const uint64_t off = table.offset + idx * table.entSize;
+    if (is64) {
+      Elf64_Sym s;
+      if (!get(off, s)) return false;
+      sym = {s.st_name, s.st_value, s.st_info, s.st_shndx};
+    } else {
+      Elf32_Sym s;
+      if (!get(off, s)) return false;
+      sym = {s.st_name, s.st_value, s.st_info, s.st_shndx};
+    }
+    return true;
+  }
+
+  // readelf's print_symbol in its default, narrow mode: names longer than
+  // 'width' are cut and marked with "[...]".  Returns the columns printed.
+  // With 'shown', its demangled form, readelf still cuts by the length of
+  // 'name'.
+  size_t printSymbol(const char *name, size_t limit, size_t width = 22,
+                     const char *shown = nullptr) {
+    const size_t len = strnlen(name, limit);
+    const bool dots = len > width;
+    const size_t shownLen = shown ? strlen(shown) : len;
+    if (!shown) shown = name;
+    size_t left = dots ? width - 5 : width, printed = 0;
+    for (size_t i = 0; i < shownLen && left; ++i) {
+      const unsigned char c = shown[i];
+      if (c < 0x20 || c == 0x7f) {
+        if (left < 2) break;
+        out.put('^').put((char)(c ^ 0x40));
+        left -= 2, printed += 2;
+      } else {
+        out.put((char)c);
+        --left, ++printed;
+      }
+    }
+    if (dots) out.put("[...]", 5);
+    return printed + (dots ? 5 : 0);
+  }
+
+  // readelf's printable_section_name: control characters as ^X, other
+  // non-printable bytes as <XX>, and no more than 256 columns.
+  void printSectionName(const std::string &name) {
+    static const char hex[] = "0123456789ABCDEF";
+    size_t left = 256;
+    for (size_t i = 0; i < name.size() && name[i] && left; ++i) {
+      const unsigned char c = name[i];
+      if (c < 0x20 || c == 0x7f) {
+        if (left < 2) break;
+        out.put('^').put((char)(c + 0x40));
+        left -= 2;
+      } else if (c < 0x7f) {
+        out.put((char)c);
+        --left;
+      } else {
+        if (left < 4) break;
+        out.put('<').put(hex[c >> 4]).put(hex[c & 0xf]).put('>');
+        left -= 4;
+      }
+    }
+  }
+
+  void printVersion(const char *version, VersionKind kind) {
+    if (!version) return;
+    out.put(kind == VersionKind::Public ? "@@" : "@");
+    out.put(version);
+  }
+
+  void sectionName(const Sym &sym) {
+    const auto &sections = elf.sections();
+    std::string name = "<null>";
+    if (ELF64_ST_TYPE(sym.info) == STT_SECTION) {
+      if (sym.shndx < sections.size())
+        name = sections[sym.shndx].name;
+      else if (sym.shndx == SHN_ABS)
+        name = "ABS";
+      else if (sym.shndx == SHN_COMMON)
+        name = "COMMON";
+      else if (elf.machine() == EM_X86_64 && sym.shndx == shnX86_64LargeCommon)
+        name = "LARGE_COMMON";
+      else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "<section 0x%x>", sym.shndx);
+        name = buf;
+      }
+    }
+    printSymbol(name.c_str(), name.size());
+  }
+
+  void addend(int64_t value, bool afterSymbol) {
+    if (afterSymbol) out.put(value < 0 ? " - " : " + ");
+    else if (value < 0) out.put('-');
+    out.hex(value < 0 ? -(uint64_t)value : value);
+  }
+
+  // Field 'field' of entry 'i' of the reloc section 'sec'.
+  uint64_t word(const Section &sec, uint64_t i, unsigned field) const {
+    const unsigned wordSize = is64 ? 8 : 4;
+    const uint64_t entSize = (sec.type == SHT_RELA ? 3 : 2) * wordSize;
+    uint64_t value = 0;
+    memcpy(&value, data + sec.offset + i * entSize + field * wordSize,
+           wordSize);
+    return value;
+  }
+
+  void dumpEntries(const Section &sec, const SymTable *table) {
+    const bool rela = sec.type == SHT_RELA;
+    const uint64_t entSize = (rela ? 3 : 2) * (is64 ? 8 : 4);
+    if (is64)
+      out.put(rela ? "  Offset          Info           Type           "
+                     "Sym. Value    Sym. Name + Addend\n"
+                   : "  Offset          Info           Type           "
+                     "Sym. Value    Sym. Name\n");
+    else
+      out.put(rela ? " Offset     Info    Type            Sym.Value  "
+                     "Sym. Name + Addend\n"
+                   : " Offset     Info    Type            Sym.Value  "
+                     "Sym. Name\n");
+    if (sec.offset > size) return;
+    const uint64_t n = std::min(sec.size, size - sec.offset) / entSize;
+    // The parse knows the order of the dynamic tables it decoded alike.
+    const std::optional<bool> sorted =
+        sec.entSize == entSize ? elf.relocsSorted(&sec - elf.sections().data())
+                               : std::nullopt;
+    const auto [begin, end] = filter.candidates(
+        n, [&](uint64_t i) { return word(sec, i, 0); }, sorted);
+    filter.addSymbols(sec.link, table ? table->count : 0);
+    names = table && demangleOn ? demangleRange(sec, *table, begin, end)
+                                : nullptr;
+    formatChunks(end - begin, out,
+                 [&, begin = begin](size_t first, size_t last,
+                                    TextBuffer &buffer) {
+                   ReadelfDump(*this, buffer)
+                       .dumpRange(sec, table, begin + first, begin + last);
+                 });
+  }
+
+  // The mangled name of symbol 'idx' of 'table', or nullptr if it has none.
+  const char *symbolName(const SymTable &table, uint64_t idx) const {
+    Sym sym;
+    if (!symbol(table, idx, sym) || !table.hasStrings || sym.name == 0 ||
+        sym.name >= table.strSize)
+      return nullptr;
+    const char *name = data + table.strOffset + sym.name;
+    return memchr(name, 0, table.strSize - sym.name) ? name : nullptr;
+  }
+
+  // Demangle the symbols of the entries [begin, end) of 'sec' the type and
+  // address filters let through.
+  const SymbolNames *demangleRange(const Section &sec, const SymTable &table,
+                                   uint64_t begin, uint64_t end) {
+    SymbolNames &names =
+        demangled.try_emplace(sec.link, table.count).first->second;
+    for (uint64_t i = begin; i < end; ++i) {
+      const uint64_t info = word(sec, i, 1);
+      if (filter.matchType(is64 ? ELF64_R_TYPE(info) : ELF32_R_TYPE(info)) &&
+          filter.matchOffset(word(sec, i, 0)))
+        names.want(is64 ? ELF64_R_SYM(info) : ELF32_R_SYM(info));
+    }
+    names.demangle([&](uint64_t idx) { return symbolName(table, idx); });
+    return &names;
+  }
+
+  // Print the entries [begin, end) of 'sec'.  Fields of the entries are only
+  // read as the filter gets to them.
+  void dumpRange(const Section &sec, const SymTable *table, uint64_t begin,
+                 uint64_t end) {
+    const bool rela = sec.type == SHT_RELA;
+    for (uint64_t i = begin; i < end; ++i) {
+      const uint64_t info = word(sec, i, 1);
+      const uint32_t type = is64 ? ELF64_R_TYPE(info) : ELF32_R_TYPE(info);
+      const uint64_t symIdx = is64 ? ELF64_R_SYM(info) : ELF32_R_SYM(info);
+      if (!filter.matchType(type)) continue;
+      const uint64_t offset = word(sec, i, 0);
+      if (!filter.matchOffset(offset)) continue;
+      Sym sym;
+      if (filter.filtersSymbols() &&
+          !filter.matchSymbol(sec.link, symIdx, [&] {
+            const char *name = table && symbol(*table, symIdx, sym) &&
+                                       table->hasStrings &&
+                                       sym.name < table->strSize
+                                   ? data + table->strOffset + sym.name
+                                   : "";
+            return names ? (*names)(symIdx, name) : name;
+          }))
+        continue;
+      int64_t add = 0;
+      if (rela)
+        add = is64 ? (int64_t)word(sec, i, 2)
+                   : (int64_t)(int32_t)word(sec, i, 2);
+      out.hex(offset, is64 ? 12 : 8).put("  ", 2).hex(info, is64 ? 12 : 8);
+      out.put(' ');
+      if (const char *name = relocTypeName(elf.machine(), type)) {
+        out.left(name, 17);
+      } else {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "unrecognized: %-7x", type);
+        out.put(buf);
+      }
+      if (symIdx) {
+        if (!table || !symbol(*table, symIdx, sym)) {
+          warn("Bad symbol index " + hexString(symIdx) + " in reloc " +
+               std::to_string(i) + " of " + sec.name);
+        } else {
+          VersionKind kind = VersionKind::Public;
+          const char *version = versionString(*table, symIdx, sym, kind);
+          out.put(' ');
+          if (ELF64_ST_TYPE(sym.info) == STT_GNU_IFUNC) {
+            // The value is the resolver: readelf shows its name as a call.
+            const char *name =
+                !table->hasStrings || sym.name == 0 ||
+                        sym.name >= table->strSize
+                    ? "??"
+                    : data + table->strOffset + sym.name;
+            const size_t width = is64 ? 14 : 8;
+            const size_t len = printSymbol(
+                name, SIZE_MAX, width, names ? (*names)(symIdx, name) : name);
+            printVersion(version, kind);
+            out.put("()").spaces(len <= width ? width + 1 - len : 1);
+          } else {
+            out.hex(sym.value, is64 ? 16 : 8).put(is64 ? " " : "   ");
+          }
+          if (sym.name == 0) {
+            sectionName(sym);
+          } else if (!table->hasStrings) {
+            char buf[48];
+            snprintf(buf, sizeof(buf), "<string table index: %3u>", sym.name);
+            out.put(buf);
+          } else if (sym.name >= table->strSize) {
+            warn("Corrupt string table index " + std::to_string(sym.name));
+          } else {
+            const char *name = data + table->strOffset + sym.name;
+            printSymbol(name, table->strSize - sym.name, 22,
+                        names ? (*names)(symIdx, nullptr) : nullptr);
+            printVersion(version, kind);
+          }
+          if (rela) addend(add, true);
+        }
+      } else if (rela) {
+        out.spaces(is64 ? 20 : 12);
+        addend(add, false);
+      }
+      out.put('\n');
+    }
+  }
+
+  void dumpRelr(const Section &sec) {
+    const unsigned wordSize = is64 ? 8 : 4;
+    if (sec.offset > size || sec.size > size - sec.offset) return;
+    auto addrs =
+        decodeRelr(std::string(data + sec.offset, sec.size), wordSize);
+    if (!filter.empty()) {
+      // RELR entries are relative relocs without a symbol.
+      const bool keep = !filter.filtersSymbols() &&
+                        filter.matchType(relativeType(elf.machine()));
+      addrs.erase(std::remove_if(addrs.begin(), addrs.end(),
+                                 [&](uint64_t addr) {
+                                   return !keep || !filter.matchOffset(addr);
+                                 }),
+                  addrs.end());
+    }
+    out.put("  ").dec(addrs.size());
+    out.put(addrs.size() == 1 ? " offset\n" : " offsets\n");
+    formatChunks(addrs.size(), out,
+                 [&](size_t first, size_t last, TextBuffer &buffer) {
+                   for (size_t i = first; i < last; ++i)
+                     buffer.hex(addrs[i], 2 * wordSize).put('\n');
+                 });
+  }
+
+  bool symbolTable(const Section &sec, SymTable &table) const {
+    const auto &sections = elf.sections();
+    if (sec.link == 0 || sec.link >= sections.size()) return false;
+    const Section &symSec = sections[sec.link];
+    table.offset = symSec.offset;
+    table.entSize = symSec.entSize;
+    table.count = symSec.entSize ? symSec.size / symSec.entSize : 0;
+    table.dynamic = symSec.type == SHT_DYNSYM;
+    if (symSec.link != 0 && symSec.link < sections.size()) {
+      const Section &strSec = sections[symSec.link];
+      table.hasStrings = strSec.offset <= size &&
+                         strSec.size <= size - strSec.offset;
+      table.strOffset = strSec.offset;
+      table.strSize = strSec.size;
+    }
+    return true;
+  }
+
+ public:
+  ReadelfDump(const std::string &path, const Elf &elf,
+              const RelocFilter &filter, TextBuffer &out)
+      : elf(elf), filter(filter), out(out), is64(elf.is64()) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) errExit("Failed to open " + path);
+    size = st.st_size;
+    void *map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0)
+                     : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) errExit("Failed to map " + path);
+    data = (const char *)map;
+    mapped = true;
+    if (const DynEntry *dyn = elf.findDyn(DT_VERSYM))
+      versym = vmaOffset(dyn->val);
+    if (const DynEntry *dyn = elf.findDyn(DT_VERDEF))
+      verdef = vmaOffset(dyn->val);
+    if (const DynEntry *dyn = elf.findDyn(DT_VERNEED))
+      verneed = vmaOffset(dyn->val);
+  }
+  // A dump of the same file into 'out', for a worker to print a chunk of a
+  // table with.  Its caches of version lookups are its own.
+  ReadelfDump(const ReadelfDump &dump, TextBuffer &out)
+      : elf(dump.elf),
+        filter(dump.filter),
+        out(out),
+        data(dump.data),
+        size(dump.size),
+        is64(dump.is64),
+        names(dump.names),
+        versym(dump.versym),
+        verdef(dump.verdef),
+        verneed(dump.verneed) {}
+  ~ReadelfDump() {
+    if (mapped) munmap((void *)data, size);
+  }
+
+  void dump() {
+    bool found = false;
+    for (const Section &sec : elf.sections()) {
+      if ((sec.type != SHT_REL && sec.type != SHT_RELA &&
+           sec.type != SHT_RELR) ||
+          sec.size == 0)
+        continue;
+      const uint64_t count = sec.entSize ? sec.size / sec.entSize : 0;
+      out.put("\nRelocation section '");
+      printSectionName(sec.name);
+      out.put("' at offset ");
+      if (sec.offset) out.put("0x");
+      out.hex(sec.offset).put(" contains ").dec(count);
+      out.put(count == 1 ? " entry:\n" : " entries:\n");
+      found = true;
+      SymTable table;
+      if (sec.type == SHT_RELR) {
+        dumpRelr(sec);
+      } else if (symbolTable(sec, table)) {
+        const Section &symSec = elf.sections()[sec.link];
+        if (symSec.type != SHT_SYMTAB && symSec.type != SHT_DYNSYM) continue;
+        dumpEntries(sec, &table);
+      } else {
+        dumpEntries(sec, nullptr);
+      }
+    }
+    if (!found) out.put("\nThere are no relocations in this file.\n");
+  }
+};
+}  // namespace
+
+void dumpRelocsReadelf(const std::string &path, const Elf &elf,
+                       const RelocFilter &filter, TextBuffer &out) {
+  ReadelfDump(path, elf, filter, out).dump();
+}
@@ -0,0 +1,17 @@
+#ifndef RELOCSWAP_READELF_H
+#define RELOCSWAP_READELF_H
+
+#include <string>
+
+#include "elffile.h"
+#include "filter.h"
+#include "format.h"
+
+// Print the reloc sections of 'elf', the file 'path', as `readelf -r` of
+// binutils 2.40 does: the same bytes for the machines relocTypeName knows,
+// with symbol versions and the addresses of SHT_RELR sections.  Only the
+// entries 'filter' lets through are decoded and printed.
+void dumpRelocsReadelf(const std::string &path, const Elf &elf,
+                       const RelocFilter &filter, TextBuffer &out);
+
+#endif  // RELOCSWAP_READELF_H
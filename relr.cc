@@ -0,0 +1,337 @@
+#include "relr.h"
+
+#include <elf.h>
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "loadstats.h"
+#include "output.h"
+
+namespace {
+constexpr const char *relrVersion = "GLIBC_ABI_DT_RELR";
+
+template <class T>
+T readAt(const std::string &bytes, uint64_t offset) {
+  T val;
+  if (offset + sizeof(T) > bytes.size()) errExit("Truncated version section.");
+  memcpy(&val, bytes.data() + offset, sizeof(T));
+  return val;
+}
+
+uint32_t elfHash(const char *name) {
+  uint32_t h = 0;
+  for (; *name; ++name) {
+    h = (h << 4) + (unsigned char)*name;
+    const uint32_t g = h & 0xf0000000;
+    if (g) h ^= g >> 24;
+    h &= ~g;
+  }
+  return h;
+}
+
+// Encode sorted, distinct addresses as RELR words of 'wordSize' bytes.
+std::vector<uint64_t> encodeRelr(const std::vector<uint64_t> &addrs,
+                                 unsigned wordSize) {
+  const unsigned nBits = wordSize * 8 - 1;
+  std::vector<uint64_t> words;
+  for (size_t i = 0; i < addrs.size();) {
+    words.push_back(addrs[i]);
+    uint64_t base = addrs[i++] + wordSize;
+    for (;;) {
+      uint64_t bitmap = 0;
+      for (; i < addrs.size(); ++i) {
+        const uint64_t delta = addrs[i] - base;
+        if (delta >= nBits * wordSize || delta % wordSize) break;
+        bitmap |= 1ULL << (delta / wordSize);
+      }
+      if (!bitmap) break;
+      words.push_back((bitmap << 1) | 1);
+      base += nBits * wordSize;
+    }
+  }
+  return words;
+}
+
+// Where the GLIBC_ABI_DT_RELR dependency must be added in .gnu.version_r.
+struct VersionPatch {
+  bool needed = false;
+  const Section *section = nullptr;  // .gnu.version_r
+  uint64_t needOffset = 0;     // Offset of libc's Elf*_Verneed in 'section'.
+  uint64_t lastAuxOffset = 0;  // Offset of its last Elf*_Vernaux.
+  uint16_t nextIndex = 0;      // An unused version index.
+};
+
+// Glibc refuses DT_RELR in objects with version needs that do not include
+// GLIBC_ABI_DT_RELR.  Exits if there is no libc entry to add it to.
+VersionPatch findVersionPatch(const Elf &elf, std::istream &in) {
+  VersionPatch patch;
+  uint16_t maxIndex = 1;
+  const Section *libcNeed = nullptr, *verneed = nullptr;
+  for (const auto &sec : elf.sections()) {
+    if (sec.type == SHT_GNU_verdef) {
+      const std::string bytes = readBytes(in, sec.offset, sec.size);
+      for (uint64_t off = 0;;) {
+        const auto def = readAt<Elf64_Verdef>(bytes, off);
+        maxIndex = std::max(maxIndex, def.vd_ndx);
+        if (!def.vd_next) break;
+        off += def.vd_next;
+      }
+    } else if (sec.type == SHT_GNU_verneed) {
+      verneed = &sec;
+      const std::string bytes = readBytes(in, sec.offset, sec.size);
+      for (uint64_t off = 0;;) {
+        const auto need = readAt<Elf64_Verneed>(bytes, off);
+        const bool isLibc =
+            strncmp(elf.dynString(need.vn_file), "libc.so", 7) == 0;
+        bool hasRelr = false;
+        uint64_t auxOff = off + need.vn_aux;
+        for (uint16_t i = 0; i < need.vn_cnt; ++i) {
+          const auto aux = readAt<Elf64_Vernaux>(bytes, auxOff);
+          maxIndex = std::max<uint16_t>(maxIndex, aux.vna_other & 0x7fff);
+          hasRelr |= strcmp(elf.dynString(aux.vna_name), relrVersion) == 0;
+          if (!aux.vna_next) break;
+          auxOff += aux.vna_next;
+        }
+        if (hasRelr) return VersionPatch();
+        if (isLibc) {
+          libcNeed = &sec;
+          patch.needOffset = off;
+          patch.lastAuxOffset = auxOff;
+        }
+        if (!need.vn_next) break;
+        off += need.vn_next;
+      }
+    }
+  }
+  if (!verneed) return VersionPatch();
+  if (!libcNeed)
+    errExit("No libc version needs to add " + std::string(relrVersion) +
+            " to.");
+  patch.needed = true;
+  patch.section = libcNeed;
+  patch.nextIndex = maxIndex + 1;
+  return patch;
+}
+}  // namespace
+
+void packRelr(const Elf &elf, const char *inFname, const char *outFname,
+              int runs) {
+  const unsigned wordSize = elf.is64() ? 8 : 4;
+  if (relativeType(elf.machine()) == 0)
+    errExit("Unsupported machine for packing relocs.");
+  if (elf.findDyn(DT_RELR)) errExit("The input already uses DT_RELR.");
+
+  const Section *relSec = elf.findSection(".rela.dyn");
+  if (!relSec) relSec = elf.findSection(".rel.dyn");
+  if (!relSec || relSec->size == 0) errExit("No dynamic relocs to pack.");
+  const uint32_t relSecIdx = relSec - elf.sections().data();
+  const bool withAddends = relSec->type == SHT_RELA;
+  const int64_t addrTag = withAddends ? DT_RELA : DT_REL;
+  const int64_t sizeTag = withAddends ? DT_RELASZ : DT_RELSZ;
+  const int64_t countTag = withAddends ? DT_RELACOUNT : DT_RELCOUNT;
+  const DynEntry *addrDyn = elf.findDyn(addrTag);
+  const DynEntry *sizeDyn = elf.findDyn(sizeTag);
+  if (!addrDyn || !sizeDyn || addrDyn->val != relSec->addr ||
+      sizeDyn->val != relSec->size)
+    errExit("The dynamic section does not describe " + relSec->name + '.');
+
+  // Split the relocs into the packable RELATIVE ones and the rest.  Packed
+  // relocs must target distinct, aligned, file backed words that no other
+  // reloc touches.
+  const std::vector<Reloc> &all = elf.relocations();
+  const std::vector<uint32_t> &byOffset = elf.relocsByOffset();
+  std::vector<char> shared(all.size());  // Another reloc has its target.
+  for (size_t i = 1; i < byOffset.size(); ++i)
+    if (all[byOffset[i]].offset == all[byOffset[i - 1]].offset)
+      shared[byOffset[i]] = shared[byOffset[i - 1]] = 1;
+  // Kept relocs stay in file order, packed ones go by address.
+  std::vector<Reloc> kept, packed;
+  std::vector<char> packable(all.size());
+  for (size_t i = 0; i < all.size(); ++i) {
+    const Reloc &rel = all[i];
+    if (rel.section != relSecIdx) continue;
+    uint64_t fileOffset;
+    packable[i] = relocKind(elf.machine(), rel.type) == RelocKind::Relative &&
+                  rel.offset % wordSize == 0 && !shared[i] &&
+                  elf.addrToOffset(rel.offset, fileOffset) &&
+                  elf.addrToOffset(rel.offset + wordSize - 1, fileOffset);
+    if (!packable[i]) kept.push_back(rel);
+  }
+  for (uint32_t i : byOffset)
+    if (packable[i]) packed.push_back(all[i]);
+  if (packed.empty()) errExit("No RELATIVE relocs can be packed.");
+
+  std::ifstream in(inFname, std::ios::binary);
+  if (!in) errExit(std::string("Failed to open input file ") + inFname);
+  const VersionPatch version = findVersionPatch(elf, in);
+
+  // Lay out the reused space: kept relocs, the RELR words and, for the
+  // version dependency, copies of .gnu.version_r and .dynstr grown by an
+  // Elf*_Vernaux and its name.  readelf -V and other tools reject version
+  // entries and names outside of those sections, so the sections move.
+  std::vector<uint64_t> addrs;
+  for (const auto &rel : packed) addrs.push_back(rel.offset);
+  const std::vector<uint64_t> words = encodeRelr(addrs, wordSize);
+  const uint64_t keptSize = kept.size() * relSec->entSize;
+  const uint64_t relrStart = (keptSize + wordSize - 1) / wordSize * wordSize;
+  const uint64_t relrSize = words.size() * wordSize;
+  const Section *verneed = version.section, *dynstr = nullptr;
+  const uint64_t verneedStart = (relrStart + relrSize + 7) / 8 * 8;
+  uint64_t dynstrStart = 0, used = relrStart + relrSize;
+  if (version.needed) {
+    const auto &secs = elf.sections();
+    dynstr = verneed->link < secs.size() ? &secs[verneed->link] : nullptr;
+    const DynEntry *strtab = elf.findDyn(DT_STRTAB);
+    const DynEntry *strsz = elf.findDyn(DT_STRSZ);
+    const DynEntry *needDyn = elf.findDyn(DT_VERNEED);
+    if (!dynstr || !strtab || !strsz || !needDyn ||
+        strtab->val != dynstr->addr || strsz->val != dynstr->size ||
+        needDyn->val != verneed->addr)
+      errExit("Cannot add the " + std::string(relrVersion) + " dependency.");
+    dynstrStart = verneedStart + verneed->size + sizeof(Elf64_Vernaux);
+    used = dynstrStart + dynstr->size + strlen(relrVersion) + 1;
+  }
+  if (used > relSec->size)
+    errExit(version.needed ? "Not enough room for .relr.dyn and the " +
+                                 std::string(relrVersion) + " dependency."
+                           : std::string("Not enough room for .relr.dyn."));
+
+  PatchRecorder edits;
+  auto put = [&](uint64_t offset, const void *data, size_t size) {
+    edits.patches.emplace_back(offset, std::string((const char *)data, size));
+  };
+
+  // RELR has no addends, the loader adds the base to the word in place.
+  std::string space(relSec->size, '\0');
+  for (size_t i = 0; i < kept.size(); ++i)
+    space.replace(i * relSec->entSize, relSec->entSize,
+                  elf.encodeReloc(kept[i], withAddends));
+  for (size_t i = 0; i < words.size(); ++i)
+    memcpy(&space[relrStart + i * wordSize], &words[i], wordSize);
+  if (withAddends) {
+    for (const auto &rel : packed) {
+      uint64_t fileOffset;
+      elf.addrToOffset(rel.offset, fileOffset);
+      put(fileOffset, &rel.addend, wordSize);
+    }
+  }
+
+  std::vector<DynEntry> dyn = elf.dynamic();
+  std::vector<Section> sections = elf.sections();
+  if (version.needed) {
+    // Link the new entry, at the end of the section, after libc's last one.
+    std::string needs = readBytes(in, verneed->offset, verneed->size);
+    auto lastAux = readAt<Elf64_Vernaux>(needs, version.lastAuxOffset);
+    lastAux.vna_next = needs.size() - version.lastAuxOffset;
+    memcpy(&needs[version.lastAuxOffset], &lastAux, sizeof(lastAux));
+    auto need = readAt<Elf64_Verneed>(needs, version.needOffset);
+    ++need.vn_cnt;
+    memcpy(&needs[version.needOffset], &need, sizeof(need));
+    const Elf64_Vernaux aux = {elfHash(relrVersion), 0, version.nextIndex,
+                               (uint32_t)dynstr->size, 0};
+    needs.append((const char *)&aux, sizeof(aux));
+    std::string strings = readBytes(in, dynstr->offset, dynstr->size);
+    strings.append(relrVersion).push_back('\0');
+    space.replace(verneedStart, needs.size(), needs);
+    space.replace(dynstrStart, strings.size(), strings);
+
+    setDynEntry(dyn, DT_VERNEED, relSec->addr + verneedStart);
+    setDynEntry(dyn, DT_STRTAB, relSec->addr + dynstrStart);
+    setDynEntry(dyn, DT_STRSZ, strings.size());
+    for (auto [sec, start, size] :
+         {std::make_tuple(verneed, verneedStart, needs.size()),
+          std::make_tuple(dynstr, dynstrStart, strings.size())}) {
+      Section &moved = sections[sec - elf.sections().data()];
+      moved.offset = relSec->offset + start;
+      moved.addr = relSec->addr + start;
+      moved.size = size;
+    }
+  }
+  put(relSec->offset, space.data(), space.size());
+
+  // Update the dynamic section.
+  size_t leadingRelative = 0;
+  while (leadingRelative < kept.size() &&
+         relocKind(elf.machine(), kept[leadingRelative].type) ==
+             RelocKind::Relative)
+    ++leadingRelative;
+  setDynEntry(dyn, sizeTag, keptSize);
+  if (elf.findDyn(countTag) && leadingRelative)
+    setDynEntry(dyn, countTag, leadingRelative);
+  else
+    removeDynEntry(dyn, countTag);
+  if (!setDynEntry(dyn, DT_RELR, relSec->addr + relrStart) ||
+      !setDynEntry(dyn, DT_RELRSZ, relrSize) ||
+      !setDynEntry(dyn, DT_RELRENT, wordSize))
+    errExit("Not enough spare entries in the dynamic section for DT_RELR.");
+  writeDynamic(elf, edits, dyn);
+
+  // Rewrite the section headers at the end of the file, with a .relr.dyn
+  // section appended so the result can be inspected with the usual tools.
+  const Section *shstrtab = elf.findSection(".shstrtab");
+  if (shstrtab && shstrtab->type == SHT_STRTAB) {
+    std::string names = readBytes(in, shstrtab->offset, shstrtab->size);
+    Section relr = *relSec;
+    relr.name = ".relr.dyn";
+    relr.nameIdx = names.size();
+    relr.type = SHT_RELR;
+    relr.addr += relrStart;
+    relr.offset += relrStart;
+    relr.size = relrSize;
+    relr.entSize = relr.align = wordSize;
+    relr.link = relr.info = 0;
+    names += relr.name + '\0';
+    sections[relSecIdx].size = keptSize;
+    sections[shstrtab - elf.sections().data()].size = names.size();
+    sections.push_back(relr);
+
+    // Reuse the old section header table if it ends the file.
+    const uint64_t oldShoff = elf.sections().front().headerOffset;
+    const uint64_t oldShEnd = elf.sections().back().headerOffset +
+                              elf.encodeSection(sections.back()).size();
+    const uint64_t fileSize = std::filesystem::file_size(inFname);
+    const uint64_t namesOffset = oldShEnd == fileSize ? oldShoff : fileSize;
+    sections[shstrtab - elf.sections().data()].offset = namesOffset;
+    const uint64_t shoff = (namesOffset + names.size() + 7) / 8 * 8;
+    std::string tail = names;
+    tail.append(shoff - namesOffset - names.size(), '\0');
+    for (const auto &sec : sections) tail += elf.encodeSection(sec);
+    put(namesOffset, tail.data(), tail.size());
+    const std::string header = elf.encodeHeader(shoff, sections.size());
+    put(0, header.data(), header.size());
+  }
+
+  // Every check is done: only now is the output created.
+  if (!std::filesystem::copy_file(
+          inFname, outFname, std::filesystem::copy_options::overwrite_existing))
+    errExit(std::string("Failed to replicate ") + inFname);
+  std::sort(edits.patches.begin(), edits.patches.end());
+  FileSink(outFname).write(edits.patches);
+
+  const uint64_t before = relSec->size;
+  const uint64_t after = keptSize + relrSize;
+  std::cout << "Packed " << packed.size() << " of "
+            << packed.size() + kept.size() << " relocs of " << relSec->name
+            << " into " << words.size() << " RELR words" << std::endl
+            << "  " << relSec->name << ": " << before << " -> " << keptSize
+            << " bytes, .relr.dyn: " << relrSize << " bytes, saved "
+            << before - after << " bytes" << std::endl;
+  if (version.needed)
+    std::cout << "  Added the " << relrVersion << " dependency" << std::endl;
+
+  if (runs <= 0) return;
+  LoaderStats inStats, outStats;
+  if (!measureStartup(elf, inFname, runs, inStats) ||
+      !measureStartup(elf, outFname, runs, outStats)) {
+    std::cerr << "Warning: the loader reported no statistics." << std::endl;
+    return;
+  }
+  printStartup(runs, inStats, outStats);
+}
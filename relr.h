@@ -0,0 +1,16 @@
+#ifndef RELOCSWAP_RELR_H
+#define RELOCSWAP_RELR_H
+
+#include "elffile.h"
+
+// Write a copy of 'inFname' to 'outFname' with the RELATIVE relocs of
+// .rela.dyn/.rel.dyn packed into a .relr.dyn bitmap stored in the space they
+// free.  The dynamic section gains the DT_RELR tags, and a GLIBC_ABI_DT_RELR
+// version dependency is added to libc's when the input lacks it, with
+// .gnu.version_r and .dynstr moved to the freed space to make room.  Exits
+// without writing 'outFname' if any of this is not possible.  If 'runs' is
+// positive, the loader's startup time is measured for both files.
+void packRelr(const Elf &elf, const char *inFname, const char *outFname,
+              int runs);
+
+#endif  // RELOCSWAP_RELR_H
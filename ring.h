@@ -0,0 +1,85 @@
+/* A single producer, single consumer ring of run results in shared memory,
+ * written by relocswap-audit.so in a variant's process and read by the
+ * campaign.  The threads and signal handlers of the variant take a lock to
+ * push, so there is one producer at a time.  Included by both audit.c and the
+ * C++ sources, so it is C. */
+#ifndef RELOCSWAP_RING_H
+#define RELOCSWAP_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RELOCSWAP_RING_MAGIC 0x72737772u /* "rswr" */
+
+/* Environment of a run reporting to a ring. */
+#define RELOCSWAP_RING_FD "RELOCSWAP_RING_FD"         /* The shared memory. */
+#define RELOCSWAP_RING_SLOT "RELOCSWAP_RING_SLOT"     /* Ring in it. */
+#define RELOCSWAP_RING_ID "RELOCSWAP_RING_ID"         /* The variant. */
+#define RELOCSWAP_RING_PARENT "RELOCSWAP_RING_PARENT" /* Campaign pid. */
+
+enum {
+  RELOCSWAP_RESULT_LOADED = 1, /* Relocated, before main. */
+  RELOCSWAP_RESULT_FAULT = 2,  /* A fatal signal. */
+  RELOCSWAP_RESULT_EXIT = 3,   /* Normal exit. */
+};
+
+struct relocswap_result {
+  uint64_t id;     /* RELOCSWAP_RING_ID. */
+  uint32_t kind;   /* RELOCSWAP_RESULT_*. */
+  int32_t signo;   /* Of a fault. */
+  uint64_t addr;   /* si_addr of a fault. */
+  uint64_t timeNs; /* CLOCK_MONOTONIC. */
+  uint64_t bound;  /* PLT relocs bound so far. */
+};
+
+/* The head and tail count records, the consumer and producer each own one of
+ * them and sit on separate cache lines. */
+struct relocswap_ring {
+  uint32_t magic;
+  uint32_t capacity; /* Records, a power of 2. */
+  uint64_t dropped;  /* Records not written because the ring was full. */
+  char pad0[48];
+  uint64_t head; /* Written by the producer. */
+  char pad1[56];
+  uint64_t tail; /* Written by the consumer. */
+  char pad2[56];
+};
+
+static inline size_t relocswap_ring_size(uint32_t capacity) {
+  return sizeof(struct relocswap_ring) +
+         capacity * sizeof(struct relocswap_result);
+}
+
+static inline struct relocswap_result *relocswap_ring_records(
+    struct relocswap_ring *ring) {
+  return (struct relocswap_result *)(ring + 1);
+}
+
+/* Producer: returns 0 if the ring is full. */
+static inline int relocswap_ring_push(struct relocswap_ring *ring,
+                                      const struct relocswap_result *result) {
+  const uint64_t head = ring->head;
+  const uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  if (head - tail >= ring->capacity) {
+    __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+  relocswap_ring_records(ring)[head & (ring->capacity - 1)] = *result;
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return 1;
+}
+
+/* Consumer: copy up to 'max' records to 'out' and return their number. */
+static inline size_t relocswap_ring_drain(struct relocswap_ring *ring,
+                                          struct relocswap_result *out,
+                                          size_t max) {
+  const uint64_t tail = ring->tail;
+  const uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  size_t n = 0;
+  for (; n < max && tail + n < head; ++n)
+    out[n] = relocswap_ring_records(ring)[(tail + n) & (ring->capacity - 1)];
+  __atomic_store_n(&ring->tail, tail + n, __ATOMIC_RELEASE);
+  return n;
+}
+
+#endif /* RELOCSWAP_RING_H */
@@ -0,0 +1,378 @@
+#include "spawn.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <sstream>
+
+#include "trace.h"
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t maxCapture = 64 * 1024;
+
+// The environment with the NAME=VALUE variables of 'overrides' set.
+std::vector<std::string> makeEnv(const std::vector<std::string> &overrides) {
+  std::vector<std::string> env;
+  for (char **var = environ; *var; ++var) {
+    const std::string entry(*var);
+    const std::string name = entry.substr(0, entry.find('=') + 1);
+    if (std::none_of(overrides.begin(), overrides.end(),
+                     [&](const std::string &o) {
+                       return o.compare(0, name.size(), name) == 0;
+                     }))
+      env.push_back(entry);
+  }
+  env.insert(env.end(), overrides.begin(), overrides.end());
+  return env;
+}
+
+// A pipe from the child, read into a capture buffer or a digest.
+struct Stream {
+  int fd = -1;
+  std::string *capture = nullptr;
+  size_t limit = 0;  // Of 'capture'.
+  StreamHash hash;
+  OutputDigest *digest = nullptr;
+
+  // Read what is available on the non-blocking 'fd'.  Returns false at the
+  // end of the file.
+  bool drain() {
+    // Large reads, from a pipe enlarged to match, keep the number of wakeups
+    // and copies down when a variant writes a lot.
+    static thread_local char buf[256 * 1024];
+    for (;;) {
+      const ssize_t got = read(fd, buf, sizeof(buf));
+      if (got == 0) return false;
+      if (got < 0) return errno == EAGAIN || errno == EINTR;
+      if (capture)
+        capture->append(buf,
+                        std::min<size_t>(got, limit - capture->size()));
+      if (digest) {
+        hash.update(buf, got);
+        digest->bytes += got;
+      }
+    }
+  }
+  void close() {
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+    if (digest) {
+      digest->hash = hash.digest();
+      digest = nullptr;
+    }
+  }
+};
+
+// A counter of 'pid' and the children it forks from now on, enabled when it
+// execs.  -1 if the kernel does not allow it.
+int openCounter(pid_t pid, uint32_t type, uint64_t config) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.enable_on_exec = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;  // Allowed with perf_event_paranoid 2.
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, pid, -1, -1,
+                 PERF_FLAG_FD_CLOEXEC);
+}
+
+// Write 'text' to a cgroup interface file.
+bool writeControl(const std::string &path, const std::string &text) {
+  std::ofstream file(path);
+  return bool(file << text << std::flush);
+}
+
+bool hasMemory(const std::string &controlPath) {
+  std::ifstream control(controlPath);
+  const std::string controllers{std::istreambuf_iterator<char>(control),
+                                std::istreambuf_iterator<char>()};
+  return controllers.find("memory") != std::string::npos;
+}
+
+// This process, moved out of its cgroup 'parent' into 'leaf', is put back
+// at exit.
+std::string leafParent, leafDir;
+
+void leaveLeaf() {
+  if (writeControl(leafParent + "/cgroup.subtree_control", "-memory") &&
+      writeControl(leafParent + "/cgroup.procs", std::to_string(getpid())))
+    rmdir(leafDir.c_str());
+}
+
+// A cgroup v2 directory with the memory controller enabled for its children,
+// in which this process may create cgroups.  Empty if there is none.  No
+// cgroup but the root may hold processes and enable a controller for its
+// children, so this process first moves into a leaf cgroup of its own, and
+// the cgroups of the runs are created beside it.
+const std::string &cgroupBase() {
+  static const std::string base = []() -> std::string {
+    std::ifstream mounts("/proc/self/mounts");
+    std::string mount, dev, dir, type, rest;
+    while (mounts >> dev >> dir >> type && std::getline(mounts, rest))
+      if (type == "cgroup2") mount = dir;
+    std::ifstream self("/proc/self/cgroup");
+    std::string line, path;
+    while (std::getline(self, line))
+      if (line.compare(0, 3, "0::") == 0) path = line.substr(3);
+    const std::string base = mount + path;
+    if (mount.empty() || access(base.c_str(), W_OK) != 0) return "";
+    if (hasMemory(base + "/cgroup.subtree_control")) return base;  // The root.
+    if (!hasMemory(base + "/cgroup.controllers")) return "";
+    const std::string pid = std::to_string(getpid());
+    const std::string leaf = base + "/relocswap-" + pid;
+    if (mkdir(leaf.c_str(), 0755) != 0) return "";
+    if (!writeControl(leaf + "/cgroup.procs", pid)) {
+      rmdir(leaf.c_str());
+      return "";
+    }
+    // Fails while other processes are left in 'base'.
+    if (!writeControl(base + "/cgroup.subtree_control", "+memory")) {
+      writeControl(base + "/cgroup.procs", pid);
+      rmdir(leaf.c_str());
+      return "";
+    }
+    leafParent = base;
+    leafDir = leaf;
+    atexit(leaveLeaf);
+    return base;
+  }();
+  return base;
+}
+
+// A cgroup holding one child, to read its peak memory.
+class Cgroup {
+  std::string dir;
+
+ public:
+  explicit Cgroup(pid_t pid) {
+    static std::atomic<unsigned> next{0};
+    if (cgroupBase().empty()) return;
+    dir = cgroupBase() + "/relocswap-" + std::to_string(getpid()) + "-" +
+          std::to_string(next++);
+    std::ofstream procs;
+    if (mkdir(dir.c_str(), 0755) == 0)
+      procs.open(dir + "/cgroup.procs");
+    if (!(procs << pid << std::flush)) {
+      rmdir(dir.c_str());
+      dir.clear();
+    }
+  }
+  ~Cgroup() {
+    if (!dir.empty()) rmdir(dir.c_str());
+  }
+  // In bytes, -1 if unknown.
+  int64_t peak() const {
+    int64_t bytes = -1;
+    if (!dir.empty()) std::ifstream(dir + "/memory.peak") >> bytes;
+    return bytes;
+  }
+};
+}  // namespace
+
+void StreamHash::mix(uint64_t word) {
+  state ^= word * 0x87c37b91114253d5ULL;
+  state = ((state << 31) | (state >> 33)) * 0x4cf5ad432745937fULL;
+}
+
+void StreamHash::update(const char *data, size_t size) {
+  // Complete the pending word first.
+  while (size && length % 8) {
+    pending |= (uint64_t)(uint8_t)*data++ << (length++ % 8 * 8);
+    --size;
+    if (length % 8 == 0) {
+      mix(pending);
+      pending = 0;
+    }
+  }
+  for (; size >= 8; data += 8, size -= 8, length += 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    mix(word);
+  }
+  for (; size; --size)
+    pending |= (uint64_t)(uint8_t)*data++ << (length++ % 8 * 8);
+}
+
+uint64_t StreamHash::digest() const {
+  uint64_t h = state ^ (pending * 0x87c37b91114253d5ULL) ^ length;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  return h ^ (h >> 33);
+}
+
+bool peakMemoryAvailable() { return !cgroupBase().empty(); }
+
+const char *metricName(int metric) {
+  static const char *const names[] = {"instructions", "task-clock",
+                                      "page-faults", "peak-memory"};
+  return metric < metricCount ? names[metric] : "?";
+}
+
+std::string findProgram(const std::string &name) {
+  if (name.find('/') != std::string::npos) return name;
+  const char *path = getenv("PATH");
+  std::istringstream dirs(path ? path : "/usr/bin:/bin");
+  for (std::string dir; std::getline(dirs, dir, ':');) {
+    const std::string candidate = (dir.empty() ? "." : dir) + "/" + name;
+    if (access(candidate.c_str(), X_OK) == 0) return candidate;
+  }
+  return name;
+}
+
+bool runProcess(const std::vector<std::string> &argv,
+                const std::vector<std::string> &overrides,
+                const SpawnOptions &opts, Process &proc) {
+  // Everything the child needs is prepared before forking.
+  const std::vector<std::string> env = makeEnv(overrides);
+  std::vector<char *> args, envp;
+  for (const auto &arg : argv) args.push_back((char *)arg.c_str());
+  args.push_back(nullptr);
+  for (const auto &var : env) envp.push_back((char *)var.c_str());
+  envp.push_back(nullptr);
+
+  // The write ends of the child's stdout and stderr pipes, and a pipe the
+  // child waits on for its counters when measuring.
+  Stream streams[2];
+  int childOut[2] = {-1, -1}, go[2] = {-1, -1};
+  auto closeAll = [&] {
+    for (int fd : {childOut[0], childOut[1], go[0], go[1]})
+      if (fd >= 0) close(fd);
+    for (auto &stream : streams) stream.close();
+  };
+  const int nStreams = opts.digest ? 2 : opts.capture ? 1 : 0;
+  for (int i = 0; i < nStreams; ++i) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0) {
+      closeAll();
+      return false;
+    }
+    streams[i].fd = fds[0];
+    childOut[i] = fds[1];
+    fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    fcntl(fds[0], F_SETPIPE_SZ, 1024 * 1024);  // Best effort.
+    if (opts.capture) {
+      streams[i].capture = &proc.output;
+      streams[i].limit = maxCapture;
+    } else {
+      streams[i].capture = i ? &proc.err.head : &proc.out.head;
+      streams[i].limit = opts.headSize;
+      streams[i].digest = i ? &proc.err : &proc.out;
+    }
+  }
+  if (opts.measure && pipe2(go, O_CLOEXEC) != 0) {
+    closeAll();
+    return false;
+  }
+
+  const int64_t spawnStart = traceOn ? TraceSpan::now() : 0;
+  const auto start = Clock::now();
+  const pid_t pid = fork();
+  if (pid < 0) {
+    closeAll();
+    return false;
+  }
+  if (pid == 0) {
+    setpgid(0, 0);
+    const int devNull = open("/dev/null", O_RDWR);
+    dup2(devNull, STDIN_FILENO);
+    dup2(nStreams ? childOut[0] : devNull, STDOUT_FILENO);
+    dup2(nStreams == 2 ? childOut[1] : nStreams ? childOut[0] : devNull,
+         STDERR_FILENO);
+    char c;
+    if (opts.measure && read(go[0], &c, 1) != 1) _exit(127);
+    execvpe(args[0], args.data(), envp.data());
+    _exit(127);
+  }
+  for (int &fd : childOut)
+    if (fd >= 0) close(fd), fd = -1;
+  int counters[metricCount] = {-1, -1, -1, -1};
+  std::unique_ptr<Cgroup> cgroup;
+  if (opts.measure) {
+    counters[mInstructions] =
+        openCounter(pid, PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    counters[mTaskClock] =
+        openCounter(pid, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK);
+    counters[mPageFaults] =
+        openCounter(pid, PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS);
+    cgroup.reset(new Cgroup(pid));
+    const ssize_t sent = write(go[1], "g", 1);
+    (void)sent;  // The child exits if it gets nothing.
+    close(go[0]);
+    close(go[1]);
+    go[0] = go[1] = -1;
+  }
+  proc.startNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                     (opts.measure ? Clock::now() : start).time_since_epoch())
+                     .count();
+  const int64_t waitStart = traceOn ? TraceSpan::now() : 0;
+  if (traceOn) TraceSpan::record("spawn", spawnStart, waitStart, argv[0]);
+
+  // Wait for the exit on a pidfd, reading the output meanwhile.  Without
+  // pidfds, poll the child every 10 ms.
+  const int pidfd = syscall(SYS_pidfd_open, pid, 0);
+  const auto deadline =
+      start + std::chrono::duration_cast<Clock::duration>(
+                  std::chrono::duration<double>(opts.timeout));
+  for (;;) {
+    if (waitpid(pid, &proc.status, WNOHANG) == pid) break;
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                          deadline - Clock::now())
+                          .count();
+    if (left <= 0) {
+      kill(-pid, SIGKILL);
+      waitpid(pid, &proc.status, 0);
+      proc.timedOut = true;
+      break;
+    }
+    pollfd pfds[3];
+    nfds_t n = 0;
+    if (pidfd >= 0) pfds[n++] = {pidfd, POLLIN, 0};
+    for (const auto &stream : streams)
+      if (stream.fd >= 0) pfds[n++] = {stream.fd, POLLIN, 0};
+    poll(pfds, n, pidfd >= 0 ? std::min<long>(left, INT32_MAX) : 10);
+    for (auto &stream : streams)
+      if (stream.fd >= 0 && !stream.drain()) stream.close();
+  }
+  proc.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  for (auto &stream : streams) {
+    if (stream.fd >= 0) stream.drain();
+    stream.close();
+  }
+  if (traceOn) TraceSpan::record("wait", waitStart, TraceSpan::now(), "");
+  if (pidfd >= 0) close(pidfd);
+
+  if (opts.measure) {
+    for (int m = 0; m < metricCount; ++m) {
+      uint64_t value;
+      if (counters[m] < 0) continue;
+      if (read(counters[m], &value, sizeof(value)) == sizeof(value))
+        proc.usage[m] = value;
+      close(counters[m]);
+    }
+    const int64_t peak = cgroup->peak();
+    if (peak >= 0) proc.usage[mPeakMemory] = peak / 1024;
+  }
+  return true;
+}
@@ -0,0 +1,74 @@
+#ifndef RELOCSWAP_SPAWN_H
+#define RELOCSWAP_SPAWN_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Resources used by a process and its children.
+enum Metric {
+  mInstructions,  // User space instructions retired.
+  mTaskClock,     // CPU time, in ns.
+  mPageFaults,
+  // In KiB, from a cgroup v2 with the memory controller.  The max RSS of
+  // wait4 would include the forked copy of this process.
+  mPeakMemory,
+  metricCount,
+};
+const char *metricName(int metric);
+
+// Whether measured runs get mPeakMemory.  The first call may move this
+// process into a cgroup of its own.
+bool peakMemoryAvailable();
+
+// A streaming 64 bit hash: the digest does not depend on how the input is
+// split into update() calls.
+class StreamHash {
+  uint64_t state = 0x9e3779b97f4a7c15ULL;
+  uint64_t pending = 0;  // Up to 7 bytes not yet mixed in.
+  uint64_t length = 0;
+
+  void mix(uint64_t word);
+
+ public:
+  void update(const char *data, size_t size);
+  uint64_t digest() const;
+};
+
+// What a process wrote to stdout or stderr.
+struct OutputDigest {
+  uint64_t hash = 0;
+  uint64_t bytes = 0;
+  std::string head;  // The first SpawnOptions::headSize bytes.
+};
+
+// A finished child process.
+struct Process {
+  int status = 0;
+  bool timedOut = false;
+  double seconds = 0;
+  int64_t startNs = 0;  // CLOCK_MONOTONIC when the command was exec'd.
+  std::string output;  // stdout and stderr, if captured.
+  OutputDigest out, err;  // If digested.
+  int64_t usage[metricCount] = {-1, -1, -1, -1};  // -1 if not measured.
+};
+
+struct SpawnOptions {
+  double timeout = 10;   // Seconds before the process group is killed.
+  bool capture = false;  // Keep the start of stdout and stderr, interleaved.
+  bool digest = false;   // Hash stdout and stderr, separately.
+  size_t headSize = 4096;
+  bool measure = false;  // Fill Process::usage.
+};
+
+// The path execvp would run for 'name'.
+std::string findProgram(const std::string &name);
+
+// Run 'argv' in its own process group with stdin on /dev/null and the
+// NAME=VALUE variables of 'env' added to the environment.  stdout and stderr
+// are captured or discarded.  Returns false if the process was not started.
+bool runProcess(const std::vector<std::string> &argv,
+                const std::vector<std::string> &env, const SpawnOptions &opts,
+                Process &proc);
+
+#endif  // RELOCSWAP_SPAWN_H
@@ -0,0 +1,158 @@
+#include "store.h"
+
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <iomanip>
+#include <sstream>
+#include <unordered_set>
+#include <vector>
+
+#include "spawn.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+std::string hex(uint64_t value) {
+  std::ostringstream out;
+  out << std::hex << std::setw(16) << std::setfill('0') << value;
+  return out.str();
+}
+
+uint64_t hashFile(const std::string &path) {
+  std::ifstream fp(path, std::ios::binary);
+  if (!fp) errExit("Failed to open " + path);
+  StreamHash hash;
+  std::vector<char> buf(1 << 20);
+  while (fp.read(buf.data(), buf.size()) || fp.gcount())
+    hash.update(buf.data(), fp.gcount());
+  return hash.digest();
+}
+
+// Copy 'from' to 'to' sharing its blocks, on filesystems with reflinks.
+bool reflink(const std::string &from, const std::string &to) {
+  const int in = open(from.c_str(), O_RDONLY | O_CLOEXEC);
+  if (in < 0) return false;
+  const int out = open(to.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0644);
+  const bool cloned = out >= 0 && ioctl(out, FICLONE, in) == 0;
+  close(in);
+  if (out >= 0) close(out);
+  if (!cloned) unlink(to.c_str());
+  return cloned;
+}
+}  // namespace
+
+std::string storeBaseId(const std::string &path, const Elf &elf) {
+  std::ifstream fp(path, std::ios::binary);
+  const std::string buildId = readBuildId(fp, elf);
+  return buildId.empty() ? "sha-" + hex(hashFile(path)) : buildId;
+}
+
+uint64_t hashPlan(const SwapPlan &plan) {
+  StreamHash hash;
+  for (const auto *swaps : {&plan.rel, &plan.rela}) {
+    const uint64_t n = swaps->size();
+    hash.update((const char *)&n, sizeof(n));
+    for (const auto &[slot, src] : *swaps) {
+      const uint64_t pair[2] = {slot, src};
+      hash.update((const char *)pair, sizeof(pair));
+    }
+  }
+  return hash.digest();
+}
+
+VariantStore::VariantStore(const std::string &dir, const std::string &results)
+    : dir(dir) {
+  fs::create_directories(fs::path(dir) / "objects");
+  fs::create_directories(fs::path(dir) / "results");
+  std::ifstream in(fs::path(dir) / "index");
+  for (std::string base, plan, object; in >> base >> plan >> object;)
+    index[base + " " + plan] = object;
+  indexOut.open(fs::path(dir) / "index", std::ios::app);
+  resultsOut.open(fs::path(dir) / "results" / results, std::ios::app);
+  if (!indexOut || !resultsOut) errExit("Failed to open the store " + dir);
+}
+
+std::string VariantStore::objectPath(const std::string &object) const {
+  return fs::path(dir) / "objects" / object.substr(0, 2) / object.substr(2);
+}
+
+std::string VariantStore::put(const std::string &base, uint64_t plan,
+                              const std::string &path) {
+  const std::string key = base + " " + hex(plan);
+  const auto it = index.find(key);
+  if (it != index.end() && fs::exists(objectPath(it->second)))
+    return it->second;
+
+  const std::string object = hex(hashFile(path));
+  const std::string dest = objectPath(object);
+  std::error_code ec;
+  if (!fs::exists(dest) ||
+      fs::file_size(dest, ec) != fs::file_size(path, ec)) {
+    fs::create_directories(fs::path(dest).parent_path());
+    const std::string tmp = dest + ".tmp." + std::to_string(getpid());
+    fs::remove(tmp, ec);
+    // A link to the variant if it is on the same filesystem, else a reflink,
+    // else a copy.
+    if (link(path.c_str(), tmp.c_str()) != 0 && !reflink(path, tmp))
+      fs::copy_file(path, tmp, fs::copy_options::overwrite_existing);
+    fs::permissions(tmp, fs::perms::owner_read | fs::perms::owner_exec |
+                             fs::perms::group_read | fs::perms::group_exec |
+                             fs::perms::others_read | fs::perms::others_exec);
+    fs::rename(tmp, dest);
+  }
+  index[key] = object;
+  indexOut << key << " " << object << std::endl;
+  return object;
+}
+
+void VariantStore::addResult(const std::string &object, const char *outcome,
+                             int detail) {
+  resultsOut << object << " " << outcome << " " << detail << std::endl;
+}
+
+uint64_t storeGc(const std::string &dir, uint64_t &freedBytes) {
+  const fs::path root(dir);
+  if (!fs::is_directory(root / "objects"))
+    errExit(dir + " is not a variant store.");
+  std::unordered_set<std::string> live;
+  if (fs::is_directory(root / "results"))
+    for (const auto &entry : fs::directory_iterator(root / "results")) {
+      std::ifstream in(entry.path());
+      for (std::string line; std::getline(in, line);)
+        live.insert(line.substr(0, line.find(' ')));
+    }
+
+  uint64_t removed = 0;
+  freedBytes = 0;
+  for (const auto &shard : fs::directory_iterator(root / "objects")) {
+    if (!shard.is_directory()) continue;
+    for (const auto &entry : fs::directory_iterator(shard.path())) {
+      const std::string object =
+          shard.path().filename().string() + entry.path().filename().string();
+      if (live.count(object)) continue;
+      // Blocks are only freed with the last link, outside the store too.
+      if (entry.hard_link_count() == 1) freedBytes += entry.file_size();
+      fs::remove(entry.path());
+      ++removed;
+    }
+  }
+
+  // Drop the index entries of removed objects, and those campaigns running at
+  // once both added.
+  std::ifstream in(root / "index");
+  const fs::path tmp = root / "index.tmp";
+  std::ofstream out(tmp);
+  std::unordered_set<std::string> keys;
+  for (std::string base, plan, object; in >> base >> plan >> object;)
+    if (live.count(object) && keys.insert(base + " " + plan).second)
+      out << base << " " << plan << " " << object << "\n";
+  out.close();
+  if (!out) errExit("Failed to rewrite the index of " + dir);
+  fs::rename(tmp, root / "index");
+  return removed;
+}
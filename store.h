@@ -0,0 +1,45 @@
+#ifndef RELOCSWAP_STORE_H
+#define RELOCSWAP_STORE_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+
+#include "elffile.h"
+
+// A content-addressed store of variants shared by campaigns:
+//
+//   objects/XX/YYYY...   a variant, named by the hash of its contents
+//   index                "BASE PLAN OBJECT" lines: the object of a swap plan
+//                        of a base binary, by build-id or content hash
+//   results/NAME         "OBJECT OUTCOME DETAIL" lines of one campaign
+//
+// Objects are read-only and linked rather than copied where possible.
+// Removing a results file and running storeGc frees the objects only it
+// referenced.
+class VariantStore {
+  std::string dir;
+  std::unordered_map<std::string, std::string> index;
+  std::ofstream indexOut, resultsOut;
+
+ public:
+  // Start the results of a campaign named 'results'.
+  VariantStore(const std::string &dir, const std::string &results);
+  // The object holding 'path', a variant of 'base' made by the plan hashed
+  // to 'plan', storing it if needed.
+  std::string put(const std::string &base, uint64_t plan,
+                  const std::string &path);
+  std::string objectPath(const std::string &object) const;
+  void addResult(const std::string &object, const char *outcome, int detail);
+};
+
+// The identity of a base binary in a store: its build-id, or a hash of its
+// contents.
+std::string storeBaseId(const std::string &path, const Elf &elf);
+uint64_t hashPlan(const SwapPlan &plan);
+
+// Remove the objects no results file references, returning their number.
+uint64_t storeGc(const std::string &dir, uint64_t &freedBytes);
+
+#endif  // RELOCSWAP_STORE_H
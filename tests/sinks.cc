@@ -0,0 +1,119 @@
+// make check: random sorted batches of patches, written through FileSink,
+// PatchRecorder and writeVariant with each cache policy, must give the bytes
+// MemorySink gives.
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../elffile.h"
+#include "../output.h"
+
+namespace {
+std::mt19937_64 rng(1);
+
+uint64_t below(uint64_t n) { return rng() % n; }
+
+std::string randomBytes(size_t n) {
+  std::string bytes(n, '\0');
+  for (auto &c : bytes) c = (char)rng();
+  return bytes;
+}
+
+std::string readFile(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  std::ostringstream bytes;
+  bytes << in.rdbuf();
+  return bytes.str();
+}
+
+void writeFile(const std::string &path, const std::string &bytes) {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), bytes.size());
+  if (!out) errExit("Failed to write " + path);
+}
+
+// Sorted, not overlapping patches of 'size' bytes: runs of adjacent ones,
+// some across the 1 MiB chunks of direct writes, and one at the last byte.
+std::vector<Patch> randomBatch(uint64_t size) {
+  std::vector<Patch> batch;
+  uint64_t pos = below(64);
+  while (pos < size) {
+    const uint64_t len = std::min<uint64_t>(1 + below(24), size - pos);
+    batch.emplace_back(pos, randomBytes(len));
+    pos += len;
+    if (below(3)) pos += below(size / 16 + 1);
+    if (!below(8)) {  // Just before the next chunk.
+      const uint64_t chunkEnd = ((pos >> 20) + 1) << 20;
+      pos = std::max(pos, chunkEnd - below(16));
+    }
+  }
+  if (batch.empty() || batch.back().first + batch.back().second.size() < size)
+    batch.emplace_back(size - 1, randomBytes(1));
+  return batch;
+}
+
+bool same(const std::string &what, const std::string &got,
+          const std::string &want) {
+  if (got == want) return true;
+  size_t at = 0;
+  while (at < got.size() && at < want.size() && got[at] == want[at]) ++at;
+  std::cerr << what << ": " << got.size() << " bytes, expected "
+            << want.size() << ", first difference at " << at << std::endl;
+  return false;
+}
+}  // namespace
+
+int main() {
+  char dirTemplate[] = "sinks.XXXXXX";  // Not tmpfs, for O_DIRECT.
+  if (!mkdtemp(dirTemplate)) errExit("Failed to make a directory.");
+  const std::string dir = dirTemplate;
+  const std::string input = dir + "/input", output = dir + "/output";
+
+  bool ok = true;
+  size_t checks = 0;
+  for (const uint64_t size : {1ULL, 4095ULL, 4096ULL, (3ULL << 20) + 123}) {
+    const std::string base = randomBytes(size);
+    writeFile(input, base);
+    for (int round = 0; round < 4; ++round) {
+      const std::vector<Patch> batch = randomBatch(size);
+      MemorySink reference(0, base);
+      reference.write(batch);
+      const std::string tag = std::to_string(size) + " bytes, round " +
+                              std::to_string(round) + ", ";
+
+      // A window of the file, as campaigns hash the reloc tables.
+      const uint64_t from = below(size), to = from + below(size - from + 1);
+      MemorySink window(from, base.substr(from, to - from));
+      window.write(batch);
+      ok &= same(tag + "window", window.image,
+                 reference.image.substr(from, to - from));
+
+      writeFile(output, base);
+      FileSink(output).write(batch);
+      ok &= same(tag + "FileSink", readFile(output), reference.image);
+
+      PatchRecorder recorder;
+      recorder.write(batch);
+      for (CachePolicy policy :
+           {CachePolicy::Keep, CachePolicy::Drop, CachePolicy::Direct}) {
+        WriteTimings timings;
+        writeVariant(input, output, recorder.patches, policy, timings);
+        ok &= same(tag + "writeVariant " + cachePolicyName(policy),
+                   readFile(output), reference.image);
+      }
+      checks += 6;
+    }
+  }
+  std::filesystem::remove_all(dir);
+  std::cout << (ok ? "Sinks: " : "Sinks FAILED: ") << checks << " checks"
+            << std::endl;
+  return ok ? 0 : 1;
+}
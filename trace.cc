@@ -0,0 +1,123 @@
+#include "trace.h"
+
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+bool traceOn = false;
+
+namespace {
+struct TraceEvent {
+  const char *name;
+  int64_t start, end;
+  std::string detail;
+};
+
+// Locked by its thread to record, so an exit in another thread, from errExit
+// in a worker for one, can write it safely.
+struct ThreadBuffer {
+  pid_t tid;
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+};
+
+std::string traceName;
+std::mutex buffersMutex;  // Taken once per thread, and at exit.
+// Never freed: workers may still record while the process exits.
+auto &buffers = *new std::vector<std::unique_ptr<ThreadBuffer>>;
+thread_local ThreadBuffer *localBuffer = nullptr;
+
+ThreadBuffer &threadBuffer() {
+  if (!localBuffer) {
+    auto buffer = std::make_unique<ThreadBuffer>();
+    buffer->tid = syscall(SYS_gettid);
+    buffer->events.reserve(1024);
+    std::lock_guard<std::mutex> lock(buffersMutex);
+    localBuffer = buffer.get();
+    buffers.push_back(std::move(buffer));
+  }
+  return *localBuffer;
+}
+
+void writeString(FILE *out, const std::string &s) {
+  fputc('"', out);
+  for (const unsigned char c : s)
+    if (c == '"' || c == '\\')
+      fprintf(out, "\\%c", c);
+    else if (c < 0x20)
+      fprintf(out, "\\u%04x", c);
+    else
+      fputc(c, out);
+  fputc('"', out);
+}
+
+// Complete ("X") events in microseconds, with thread names as metadata.
+void writeTrace() {
+  std::lock_guard<std::mutex> lock(buffersMutex);
+  FILE *out = fopen(traceName.c_str(), "w");
+  if (!out) {
+    perror(traceName.c_str());
+    return;
+  }
+  const pid_t pid = getpid();
+  fprintf(out,
+          "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+          "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+          "\"args\":{\"name\":\"relocswap\"}}",
+          pid, pid);
+  std::vector<pid_t> named;
+  for (const auto &buffer : buffers) {
+    bool seen = false;
+    for (pid_t tid : named) seen |= tid == buffer->tid;
+    if (!seen) {
+      named.push_back(buffer->tid);
+      fprintf(out,
+              ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+              "\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+              pid, buffer->tid, buffer->tid == pid ? "main" : "worker");
+    }
+    std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+    for (const auto &e : buffer->events) {
+      fprintf(out,
+              ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+              "\"ts\":%.3f,\"dur\":%.3f",
+              e.name, pid, buffer->tid, e.start / 1000.0,
+              (e.end - e.start) / 1000.0);
+      if (!e.detail.empty()) {
+        fputs(",\"args\":{\"detail\":", out);
+        writeString(out, e.detail);
+        fputc('}', out);
+      }
+      fputc('}', out);
+    }
+  }
+  fputs("\n]}\n", out);
+  if (fclose(out) != 0) perror(traceName.c_str());
+}
+}  // namespace
+
+void startTrace(const std::string &fname) {
+  if (traceOn) return;
+  traceName = fname;
+  traceOn = true;
+  atexit(writeTrace);
+}
+
+int64_t TraceSpan::now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void TraceSpan::record(const char *name, int64_t start, int64_t end,
+                       std::string detail) {
+  ThreadBuffer &buffer = threadBuffer();
+  std::lock_guard<std::mutex> lock(buffer.mutex);
+  buffer.events.push_back({name, start, end, std::move(detail)});
+}
@@ -0,0 +1,51 @@
+#ifndef RELOCSWAP_TRACE_H
+#define RELOCSWAP_TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// Timelines for --trace: each thread records the spans of what it does (open,
+// parse, section loads, swaps, writes, spawns, waits) into a buffer of its
+// own, and the buffers are written at exit as Chrome trace-event JSON, which
+// Perfetto and chrome://tracing open.
+
+extern bool traceOn;  // Set once by startTrace, before any worker starts.
+
+// Record spans from now on, and write them to 'fname' at exit.
+void startTrace(const std::string &fname);
+
+// The time from construction to destruction, as a span of 'name', a string
+// literal, with an optional detail such as the file it is about.  Costs a
+// branch when not tracing.
+class TraceSpan {
+  const char *name;
+  int64_t start = -1;
+  std::string detail;
+
+ public:
+  explicit TraceSpan(const char *name) : name(name) {
+    if (traceOn) start = now();
+  }
+  TraceSpan(const char *name, const std::string &detail) : name(name) {
+    if (!traceOn) return;
+    this->detail = detail;
+    start = now();
+  }
+  TraceSpan(const char *name, const char *detail) : name(name) {
+    if (!traceOn) return;
+    this->detail = detail;
+    start = now();
+  }
+  ~TraceSpan() {
+    if (start >= 0) record(name, start, now(), std::move(detail));
+  }
+  TraceSpan(const TraceSpan &) = delete;
+  TraceSpan &operator=(const TraceSpan &) = delete;
+
+  static int64_t now();  // CLOCK_MONOTONIC, in ns.
+  // Add a span to the buffer of the calling thread.
+  static void record(const char *name, int64_t start, int64_t end,
+                     std::string detail);
+};
+
+#endif  // RELOCSWAP_TRACE_H
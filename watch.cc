@@ -0,0 +1,357 @@
+#include "watch.h"
+
+#include <elf.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+
+#include "batch.h"
+#include "footprint.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+constexpr const char *indexMagic = "# relocswap-index 1";
+constexpr uint32_t watchEvents = IN_CLOSE_WRITE | IN_MODIFY | IN_CREATE |
+                                 IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE |
+                                 IN_ATTRIB;
+
+int64_t mtimeOf(const struct stat &st) {
+  return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// Linkers write the section headers last: a file whose section header table
+// is not all there is still being written.
+bool looksComplete(const std::string &path, uint64_t size) {
+  unsigned char ident[EI_NIDENT];
+  std::ifstream fp(path, std::ios::binary);
+  if (!fp.read((char *)ident, sizeof(ident))) return false;
+  uint64_t shoff, shnum, shentsize;
+  fp.seekg(0);
+  if (ident[EI_CLASS] == ELFCLASS64) {
+    Elf64_Ehdr hdr;
+    if (!fp.read((char *)&hdr, sizeof(hdr))) return false;
+    shoff = hdr.e_shoff, shnum = hdr.e_shnum, shentsize = hdr.e_shentsize;
+  } else {
+    Elf32_Ehdr hdr;
+    if (!fp.read((char *)&hdr, sizeof(hdr))) return false;
+    shoff = hdr.e_shoff, shnum = hdr.e_shnum, shentsize = hdr.e_shentsize;
+  }
+  return shoff + shnum * shentsize <= size;
+}
+
+IndexEntry indexElf(const std::string &path, const Elf &elf) {
+  IndexEntry entry;
+  entry.path = path;
+  std::ifstream fp(path, std::ios::binary);
+  entry.buildId = readBuildId(fp, elf);
+  for (const auto &rel : elf.relocations()) {
+    ++entry.relocs;
+    entry.lookups += rel.sym != 0;
+  }
+  entry.pages = computeFootprint(path, elf).pages;
+  for (size_t i = 1; i < elf.symbolCount(); ++i)
+    entry.imports += elf.symbol(i).shndx == SHN_UNDEF;
+  for (const auto &dyn : elf.dynamic())
+    if (dyn.tag == DT_NEEDED) entry.needed.push_back(elf.dynString(dyn.val));
+  return entry;
+}
+
+void writeEntry(std::ostream &out, const IndexEntry &e) {
+  out << e.path << '\t' << (e.buildId.empty() ? "-" : e.buildId) << '\t'
+      << e.size << '\t' << e.mtimeNs << '\t' << e.relocs << '\t' << e.lookups
+      << '\t' << e.pages << '\t' << e.imports << '\t';
+  for (size_t i = 0; i < e.needed.size(); ++i)
+    out << (i ? "," : "") << e.needed[i];
+  out << '\n';
+}
+
+bool readEntry(const std::string &line, IndexEntry &e) {
+  std::istringstream in(line);
+  std::string needed;
+  if (!std::getline(in, e.path, '\t') ||
+      !(in >> e.buildId >> e.size >> e.mtimeNs >> e.relocs >> e.lookups >>
+        e.pages >> e.imports))
+    return false;
+  if (e.buildId == "-") e.buildId.clear();
+  in.ignore(1);
+  std::getline(in, needed);
+  std::istringstream names(needed);
+  e.needed.clear();
+  for (std::string name; std::getline(names, name, ',');)
+    e.needed.push_back(name);
+  return true;
+}
+
+std::map<std::string, IndexEntry> loadIndex(const std::string &fname) {
+  std::map<std::string, IndexEntry> index;
+  std::ifstream in(fname);
+  std::string line;
+  if (!std::getline(in, line) || line != indexMagic) return index;
+  for (IndexEntry e; std::getline(in, line);)
+    if (readEntry(line, e)) index[e.path] = e;
+  return index;
+}
+
+class Watcher {
+  const std::string dir;
+  const WatchOptions &opts;
+  std::string indexName;
+  std::map<std::string, IndexEntry> index;
+  int fd = -1;
+  std::unordered_map<int, std::string> dirs;  // By watch descriptor.
+  std::unordered_map<std::string, Clock::time_point> pending;
+
+  Clock::duration debounce() const {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(opts.debounce));
+  }
+
+  void touch(const std::string &path) {
+    if (path == indexName || path == indexName + ".tmp") return;
+    pending[path] = Clock::now() + debounce();
+  }
+
+  // Watch 'root' and the directories below it, and queue their files.
+  void addTree(const std::string &root) {
+    std::vector<std::string> trees = {root};
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(
+             root, fs::directory_options::skip_permission_denied, ec),
+         end;
+         it != end; it.increment(ec)) {
+      if (it->is_directory(ec) && !it->is_symlink(ec))
+        trees.push_back(it->path());
+      else if (it->is_regular_file(ec) && !it->is_symlink(ec))
+        touch(it->path());
+    }
+    for (const auto &tree : trees) {
+      const int wd = inotify_add_watch(fd, tree.c_str(), watchEvents);
+      if (wd >= 0)
+        dirs[wd] = tree;
+      else
+        std::cerr << "Cannot watch " << tree << ": " << strerror(errno)
+                  << std::endl;
+    }
+  }
+
+  void readEvents() {
+    alignas(inotify_event) char buf[64 * 1024];
+    const ssize_t n = read(fd, buf, sizeof(buf));
+    for (ssize_t pos = 0; pos < n;) {
+      const auto *ev = (const inotify_event *)(buf + pos);
+      pos += sizeof(inotify_event) + ev->len;
+      if (ev->mask & IN_Q_OVERFLOW) {
+        // Events were lost: look at everything again.
+        for (const auto &[path, entry] : index) touch(path);
+        addTree(dir);
+        continue;
+      }
+      if (ev->mask & IN_IGNORED) {
+        dirs.erase(ev->wd);
+        continue;
+      }
+      const auto it = dirs.find(ev->wd);
+      if (it == dirs.end() || !ev->len) continue;
+      const std::string path = fs::path(it->second) / ev->name;
+      if ((ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+        addTree(path);
+      else if (ev->mask & IN_ISDIR)  // Removed: drop what was below it.
+        for (auto e = index.lower_bound(path + "/");
+             e != index.end() && e->first.compare(0, path.size() + 1,
+                                                  path + "/") == 0;
+             ++e)
+          touch(e->first);
+      else
+        touch(path);
+    }
+  }
+
+  // Re-index the files that have been left alone long enough.
+  void update() {
+    const auto now = Clock::now();
+    std::vector<std::string> ready;
+    for (auto it = pending.begin(); it != pending.end();)
+      if (it->second <= now) {
+        ready.push_back(it->first);
+        it = pending.erase(it);
+      } else {
+        ++it;
+      }
+    if (ready.empty()) return;
+
+    const auto start = Clock::now();
+    size_t removed = 0;
+    std::vector<std::string> changed;
+    std::vector<struct stat> stats;
+    for (const auto &path : ready) {
+      struct stat st;
+      if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) ||
+          !isElfFile(path)) {
+        removed += index.erase(path);
+        continue;
+      }
+      const auto it = index.find(path);
+      if (it != index.end() && it->second.size == (uint64_t)st.st_size &&
+          it->second.mtimeNs == mtimeOf(st))
+        continue;
+      if (!looksComplete(path, st.st_size)) {
+        touch(path);
+        continue;
+      }
+      changed.push_back(path);
+      stats.push_back(st);
+    }
+
+    // Parse the changed files; those keeping their build-id keep their
+    // entry.  A file that fails to parse keeps its old entry, if any, until
+    // it changes again.
+    std::vector<IndexEntry> entries(changed.size());
+    std::vector<char> same(changed.size());
+    std::vector<std::string> errors(changed.size());
+    parallelFor(changed.size(), [&](size_t i) {
+      RecoverErrors recover;
+      try {
+        std::ifstream fp(changed[i], std::ios::binary);
+        std::unique_ptr<Elf> elf(parseElf(fp));
+        const auto old = index.find(changed[i]);
+        fp.clear();
+        const std::string buildId = readBuildId(fp, *elf);
+        if (old != index.end() && !buildId.empty() &&
+            old->second.buildId == buildId) {
+          entries[i] = old->second;
+          same[i] = 1;
+        } else {
+          entries[i] = indexElf(changed[i], *elf);
+        }
+      } catch (const InputError &e) {
+        errors[i] = e.what();
+        return;
+      }
+      entries[i].size = stats[i].st_size;
+      entries[i].mtimeNs = mtimeOf(stats[i]);
+    });
+    size_t added = 0, updated = 0, unchanged = 0, failed = 0;
+    for (size_t i = 0; i < changed.size(); ++i) {
+      if (!errors[i].empty()) {
+        std::cerr << "Skipped " << changed[i] << ": " << errors[i]
+                  << std::endl;
+        ++failed;
+        continue;
+      }
+      if (same[i])
+        ++unchanged;
+      else if (index.count(changed[i]))
+        ++updated;
+      else
+        ++added;
+      index[changed[i]] = std::move(entries[i]);
+    }
+    if (!added && !updated && !removed && !unchanged && !failed) return;
+    save();
+    std::cout << "Index: " << added << " added, " << updated << " changed, "
+              << removed << " removed, " << unchanged
+              << " rebuilt with the same build-id, " << failed
+              << " skipped, " << index.size()
+              << " binaries, in "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(
+                     Clock::now() - start)
+                     .count()
+              << " ms" << std::endl;
+  }
+
+  // Replace the index in one rename, so readers see the old or the new one.
+  void save() const {
+    const std::string tmp = indexName + ".tmp";
+    std::ofstream out(tmp);
+    out << indexMagic << '\n';
+    for (const auto &[path, entry] : index) writeEntry(out, entry);
+    out.close();
+    if (!out) errExit("Failed to write " + tmp);
+    fs::rename(tmp, indexName);
+  }
+
+ public:
+  Watcher(const std::string &dir, const WatchOptions &opts)
+      : dir(dir), opts(opts) {
+    indexName = opts.index.empty() ? (fs::path(dir) / ".relocswap-index")
+                                   : fs::path(opts.index);
+    index = loadIndex(indexName);
+  }
+  ~Watcher() {
+    if (fd >= 0) close(fd);
+  }
+
+  bool run() {
+    fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+      std::cerr << "inotify: " << strerror(errno) << std::endl;
+      return false;
+    }
+    // Entries of files removed while nobody watched.
+    for (const auto &[path, entry] : index) touch(path);
+    addTree(dir);
+    for (;;) {
+      int timeout = -1;
+      if (!pending.empty()) {
+        auto next = Clock::time_point::max();
+        for (const auto &[path, deadline] : pending)
+          next = std::min(next, deadline);
+        timeout = std::max<int64_t>(
+            0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                   next - Clock::now())
+                       .count() +
+                   1);
+      }
+      pollfd pfd = {fd, POLLIN, 0};
+      if (poll(&pfd, 1, timeout) < 0 && errno != EINTR) return false;
+      if (pfd.revents & POLLIN) readEvents();
+      update();
+    }
+  }
+};
+}  // namespace
+
+bool watchTree(const std::string &dir, const WatchOptions &opts) {
+  if (!fs::is_directory(dir)) errExit(dir + " is not a directory.");
+  Watcher watcher(dir, opts);
+  return watcher.run();
+}
+
+void queryIndex(const std::string &fname, const std::string &pattern) {
+  std::ifstream in(fname);
+  std::string line;
+  if (!std::getline(in, line) || line != indexMagic)
+    errExit(fname + " is not a relocswap index.");
+  uint64_t files = 0, relocs = 0, lookups = 0, pages = 0;
+  for (IndexEntry e; std::getline(in, line);) {
+    if (!readEntry(line, e)) continue;
+    bool match = e.path.find(pattern) != std::string::npos;
+    for (const auto &name : e.needed)
+      match |= name.find(pattern) != std::string::npos;
+    if (!match) continue;
+    std::cout << e.path << ": " << e.relocs << " relocs, " << e.lookups
+              << " lookups, " << e.pages << " pages, " << e.imports
+              << " imports";
+    if (!e.buildId.empty()) std::cout << ", build-id " << e.buildId;
+    std::cout << std::endl;
+    ++files;
+    relocs += e.relocs;
+    lookups += e.lookups;
+    pages += e.pages;
+  }
+  std::cout << "Total: " << files << " binaries, " << relocs << " relocs, "
+            << lookups << " lookups, " << pages << " pages" << std::endl;
+}
@@ -0,0 +1,33 @@
+#ifndef RELOCSWAP_WATCH_H
+#define RELOCSWAP_WATCH_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Watch mode: an index of the binaries of a tree, updated as files are added,
+// changed and removed.  The index is a text file replaced atomically after
+// each update, so it can be read at any time.
+struct IndexEntry {
+  std::string path;
+  std::string buildId;  // "" if none.
+  uint64_t size = 0;
+  int64_t mtimeNs = 0;
+  uint64_t relocs = 0;
+  uint64_t lookups = 0;  // Relocs needing a symbol lookup.
+  uint64_t pages = 0;    // File backed pages dirtied by relocs.
+  uint64_t imports = 0;  // Undefined dynamic symbols.
+  std::vector<std::string> needed;
+};
+
+struct WatchOptions {
+  std::string index;      // DIR/.relocswap-index if empty.
+  double debounce = 0.5;  // Seconds a file must be left alone to be parsed.
+};
+
+// Index 'dir', then keep the index up to date.  Returns only on errors.
+bool watchTree(const std::string &dir, const WatchOptions &opts);
+// Print the entries of 'index' whose path or DT_NEEDED contain 'pattern'.
+void queryIndex(const std::string &index, const std::string &pattern);
+
+#endif  // RELOCSWAP_WATCH_H